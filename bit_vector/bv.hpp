@@ -3,7 +3,9 @@
 
 #include "internal/allocator.hpp"
 #include "internal/bit_vector.hpp"
+#include "internal/concurrent_bit_vector.hpp"
 #include "internal/leaf.hpp"
+#include "internal/mapped_bit_vector.hpp"
 #include "internal/node.hpp"
 #include "internal/gap_leaf.hpp"
 
@@ -99,6 +101,18 @@ using small_bv = bit_vector<
  * Buffer size = 8, leaf size = 2^14 and branching factor = 64
  */
 typedef simple_bv<8, 16384, 64> bv;
+
+/**
+ * @brief Read-only memory mapped view of files written by
+ * `bv::bv::serialize_mapped`.
+ */
+typedef mapped_bit_vector<uint64_t, 64> mapped_bv;
+
+/**
+ * @brief Thread safe wrapper of bv::bv with concurrent readers and batched
+ * writes.
+ */
+typedef concurrent_bit_vector<bv, uint64_t> concurrent_bv;
 }  // namespace bv
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <signal.h>
 
+#include <atomic>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
@@ -20,10 +21,48 @@ namespace bv {
  *
  * For leaves, a block is (re)allocated for housing both the leaf "struct" and
  * the associated data.
+ *
+ * Allocation bookkeeping is atomic, so allocation and deallocation is safe
+ * from multiple threads, as required by parallel bulk construction.
+ *
+ * Each allocation is preceded by a reference count used for sharing nodes and
+ * leaves between bit vector snapshots. Objects are allocated with a single
+ * reference. The count is only maintained through `retain` and `release`, and
+ * deallocation frees the object regardless of the count.
+ *
+ * Custom allocators used with bv::bit_vector need to provide `retain`,
+ * `release`, `shared`, `duplicate_node` and `duplicate_leaf` in addition to
+ * allocation and deallocation, since snapshots share nodes and leaves.
  */
 class malloc_alloc : uncopyable {
    private:
-    uint64_t allocations_;  ///< Number of objects currently allocated.
+    /** @brief Reference count header preceding each allocated object. */
+    struct alignas(16) ref_count {
+        std::atomic<uint32_t> refs;
+    };
+    static const constexpr size_t REF_BYTES = sizeof(ref_count);
+
+    std::atomic<uint64_t> allocations_;  ///< Number of objects currently
+                                         ///< allocated.
+
+    /** @brief Reference count of an object allocated by `this`. */
+    template <class T>
+    static ref_count* refs(const T* obj) {
+        return reinterpret_cast<ref_count*>(
+            const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(obj)) -
+            REF_BYTES);
+    }
+
+    /** @brief Allocate `bytes` bytes preceded by a reference count of 1. */
+    void* alloc_counted(size_t bytes) {
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        void* mem = malloc(REF_BYTES + bytes);
+        if (mem == NULL) {
+            [[unlikely]] raise(SIGSEGV);
+        }
+        new (mem) ref_count{1};
+        return reinterpret_cast<uint8_t*>(mem) + REF_BYTES;
+    }
 
    public:
     malloc_alloc() { allocations_ = 0; }
@@ -31,21 +70,21 @@ class malloc_alloc : uncopyable {
     /**
      * @brief Allocate new internal node.
      *
-     * Simply uses `malloc(sizeof(node_type))`.
+     * Simply uses `malloc` for the node and its reference count.
      *
      * @tparam node_type Internal node type. Typically some kind of bv::node.
      */
     template <class node_type>
     node_type* allocate_node() {
-        allocations_++;
-        void* nd = malloc(sizeof(node_type));
+        void* nd = alloc_counted(sizeof(node_type));
         return new (nd) node_type();
     }
 
     /**
      * @brief Deallocate internal node.
      *
-     * Simply does `free(node)`.
+     * Frees the block starting at the reference count preceding `node` and
+     * decrements the number of live allocations.
      *
      * @tparam node_type Internal node type. Typically some kind of bv::node.
      *
@@ -53,8 +92,8 @@ class malloc_alloc : uncopyable {
      */
     template <class node_type>
     void deallocate_node(node_type* node) {
-        allocations_--;
-        free(node);
+        allocations_.fetch_sub(1, std::memory_order_relaxed);
+        free(refs(node));
     }
 
     /**
@@ -70,12 +109,8 @@ class malloc_alloc : uncopyable {
      */
     template <class leaf_type>
     leaf_type* allocate_leaf(uint64_t size, uint32_t elems = 0, bool val = false) {
-        allocations_++;
         constexpr size_t leaf_bytes = sizeof(leaf_type) + sizeof(leaf_type) % 8;
-        void* leaf = malloc(leaf_bytes + size * sizeof(uint64_t));
-        if (leaf == NULL) {
-            [[unlikely]] raise(SIGSEGV);
-        }
+        void* leaf = alloc_counted(leaf_bytes + size * sizeof(uint64_t));
         uint8_t* data_ptr = reinterpret_cast<uint8_t*>(leaf) + leaf_bytes;
         memset(data_ptr, 0, size * sizeof(uint64_t));
         return new (leaf)
@@ -90,14 +125,15 @@ class malloc_alloc : uncopyable {
     /**
      * @brief Deallocates leaf node.
      *
-     * Simply calls `free(leaf)`.
+     * Frees the block starting at the reference count preceding `leaf` and
+     * decrements the number of live allocations.
      *
      * @tparam leaf_type Bit vector leaf type. Typically some kind of bv::leaf.
      */
     template <class leaf_type>
     void deallocate_leaf(leaf_type* leaf) {
-        allocations_--;
-        free(leaf);
+        allocations_.fetch_sub(1, std::memory_order_relaxed);
+        free(refs(leaf));
     }
 
     /**
@@ -117,10 +153,11 @@ class malloc_alloc : uncopyable {
         constexpr size_t leaf_bytes = sizeof(leaf_type) + sizeof(leaf_type) % 8;
 #pragma GCC diagnostic ignored "-Wclass-memaccess"
 
-        leaf_type* n_leaf = reinterpret_cast<leaf_type*>(
-            realloc(leaf, leaf_bytes + new_size * sizeof(uint64_t)));
+        uint8_t* mem = reinterpret_cast<uint8_t*>(realloc(
+            refs(leaf), REF_BYTES + leaf_bytes + new_size * sizeof(uint64_t)));
 #pragma GCC diagnostic pop
-        if (n_leaf == NULL) [[unlikely]] raise(SIGSEGV);
+        if (mem == NULL) [[unlikely]] raise(SIGSEGV);
+        leaf_type* n_leaf = reinterpret_cast<leaf_type*>(mem + REF_BYTES);
         uint8_t* data_ptr = reinterpret_cast<uint8_t*>(n_leaf) + leaf_bytes;
         if (old_size < new_size) {
             memset(data_ptr + sizeof(uint64_t) * old_size, 0,
@@ -131,13 +168,72 @@ class malloc_alloc : uncopyable {
         return n_leaf;
     }
 
+    /**
+     * @brief Allocate an unshared copy of `node`.
+     *
+     * Child pointers are copied as is. The caller is responsible for
+     * retaining the children.
+     */
+    template <class node_type>
+    node_type* duplicate_node(const node_type* node) {
+        void* nd = alloc_counted(sizeof(node_type));
+        memcpy(nd, static_cast<const void*>(node), sizeof(node_type));
+        return reinterpret_cast<node_type*>(nd);
+    }
+
+    /**
+     * @brief Allocate an unshared copy of `leaf` with the same capacity.
+     */
+    template <class leaf_type>
+    leaf_type* duplicate_leaf(const leaf_type* leaf) {
+        constexpr size_t leaf_bytes = sizeof(leaf_type) + sizeof(leaf_type) % 8;
+        uint64_t size = leaf->capacity();
+        uint8_t* mem = reinterpret_cast<uint8_t*>(
+            alloc_counted(leaf_bytes + size * sizeof(uint64_t)));
+        memcpy(mem, static_cast<const void*>(leaf),
+               leaf_bytes + size * sizeof(uint64_t));
+        leaf_type* n_leaf = reinterpret_cast<leaf_type*>(mem);
+        n_leaf->set_data_ptr(reinterpret_cast<uint64_t*>(mem + leaf_bytes));
+        return n_leaf;
+    }
+
+    /**
+     * @brief Add a reference to an object allocated by `this`.
+     */
+    template <class T>
+    void retain(T* obj) {
+        refs(obj)->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Drop a reference to an object allocated by `this`.
+     *
+     * @return True if this was the last reference, in which case the caller
+     * should deallocate the object.
+     */
+    template <class T>
+    bool release(T* obj) {
+        return refs(obj)->refs.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    /**
+     * @brief True if the object is referenced more than once, and should not
+     * be modified in place.
+     */
+    template <class T>
+    bool shared(const T* obj) const {
+        return refs(obj)->refs.load(std::memory_order_acquire) > 1;
+    }
+
     /**
      * @brief Get the number of blocks currenty allocated by this allocator
      * instance.
      *
      * @return Number of blocks currently allocated by this allocator instance.
      */
-    uint64_t live_allocations() const { return allocations_; }
+    uint64_t live_allocations() const {
+        return allocations_.load(std::memory_order_relaxed);
+    }
 };
 }  // namespace bv
 #endif
\ No newline at end of file
@@ -1,11 +1,22 @@
 #ifndef BV_BIT_VECTOR_HPP
 #define BV_BIT_VECTOR_HPP
 
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
+#include "flat_query_support.hpp"
+#include "mapped_bit_vector.hpp"
 #include "query_support.hpp"
+#include "serialize.hpp"
 #include "uncopyable.hpp"
 
 namespace bv {
@@ -49,9 +60,135 @@ class bit_vector : uncopyable {
     leaf* l_root_;  ///< Root if a single leaf is sufficient.
     allocator* allocator_;  ///< Pointer to allocator used for allocating
                             ///< internal nodes and leaves.
+    uint64_t version_ = 0;  ///< Incremented by every modification.
+    uint64_t tracked_version_ = 0;  ///< Version since which the lowest
+                                    ///< modified position is tracked.
+    dtype dirty_from_ = ~dtype(0);  ///< Lowest position modified since
+                                    ///< `tracked_version_`.
+    std::atomic<uint32_t>* group_ = nullptr;  ///< Number of live bit vectors
+                                              ///< sharing nodes with `this`.
+                                              ///< Only allocated by
+                                              ///< `snapshot`.
 
     /** @brief Number of bits in a computer word. */
     static const constexpr uint64_t WORD_BITS = 64;
+    /** @brief Identifies serialized bit vectors. */
+    static const constexpr char SERIAL_MAGIC[8] = {'b', 'v', 't', 'r',
+                                                   'e', 'e', 0,   0};
+
+    /**
+     * @brief Records a modification at or after position "index".
+     *
+     * Used for keeping query support structures up to date without full
+     * rebuilds.
+     *
+     * @param index Lowest position affected by the modification.
+     */
+    void modified(dtype index) {
+        version_++;
+        dirty_from_ = index < dirty_from_ ? index : dirty_from_;
+    }
+
+    /**
+     * @brief True if nodes or leaves of `this` may be referenced by a
+     * snapshot.
+     */
+    bool shared() const {
+        return group_ != nullptr && group_->load(std::memory_order_acquire) > 1;
+    }
+
+    /**
+     * @brief Ensures that positions \f$[a, b]\f$ can be modified without
+     * affecting snapshots.
+     *
+     * Shared nodes and leaves on the paths to the range, and their immediate
+     * siblings that may take part in rebalancing, are replaced with
+     * unshared duplicates. This is a no-op unless snapshots of `this` exist.
+     *
+     * @param a First position that may be modified.
+     * @param b Last position that may be modified.
+     */
+    void unshare(dtype a, dtype b) {
+        if (!shared()) {
+            [[likely]] return;
+        }
+        unshare_root();
+        if (!root_is_leaf_) {
+            n_root_->unshare(a, b, allocator_);
+        }
+    }
+
+    /**
+     * @brief Ensures that an insertion at `index` can be done without
+     * affecting snapshots.
+     *
+     * Insertions at the boundary of two subtrees go to the end of the left
+     * subtree, so the paths to both neighbours of the position are unshared.
+     *
+     * @param index Position of insertion.
+     */
+    void unshare_insert(dtype index) {
+        unshare(index > 0 ? index - 1 : 0, index);
+    }
+
+    /**
+     * @brief Replaces the root with an unshared duplicate if it is shared
+     * with a snapshot.
+     */
+    void unshare_root() {
+        if (root_is_leaf_) {
+            if (allocator_->shared(l_root_)) {
+                leaf* l = allocator_->duplicate_leaf(l_root_);
+                if (allocator_->release(l_root_)) {
+                    [[unlikely]] allocator_->deallocate_leaf(l_root_);
+                }
+                l_root_ = l;
+            }
+            return;
+        }
+        if (allocator_->shared(n_root_)) {
+            node* n = allocator_->duplicate_node(n_root_);
+            n->retain_children(allocator_);
+            if (allocator_->release(n_root_)) {
+                n_root_->deallocate(allocator_);
+                [[unlikely]] allocator_->deallocate_node(n_root_);
+            }
+            n_root_ = n;
+        }
+    }
+
+    /**
+     * @brief Releases the reference to the root, deallocating the tree
+     * unless it is shared with a snapshot.
+     */
+    void release_root() {
+        if (root_is_leaf_) {
+            if (allocator_->release(l_root_)) {
+                [[likely]] allocator_->deallocate_leaf(l_root_);
+            }
+        } else if (allocator_->release(n_root_)) {
+            n_root_->deallocate(allocator_);
+            [[likely]] allocator_->deallocate_node(n_root_);
+        }
+    }
+
+    /**
+     * @brief Creates a snapshot sharing the tree and allocator of `other`.
+     */
+    bit_vector(const bit_vector& other, std::atomic<uint32_t>* group)
+        : root_is_leaf_(other.root_is_leaf_),
+          owned_allocator_(other.owned_allocator_),
+          n_root_(other.n_root_),
+          l_root_(other.l_root_),
+          allocator_(other.allocator_),
+          version_(other.version_),
+          group_(group) {
+        if (root_is_leaf_) {
+            allocator_->retain(l_root_);
+        } else {
+            allocator_->retain(n_root_);
+        }
+    }
 
     /**
      * @brief Increases the height of the tree by one level.
@@ -114,6 +251,446 @@ class bit_vector : uncopyable {
         root_is_leaf_ = false;
     }
 
+    /**
+     * @brief Capacity in 64-bit words used for leaves created by bulk
+     * construction.
+     *
+     * Leaves get the same amount of slack as leaves created by merging, but
+     * never more capacity than `leaf_size` bits.
+     */
+    static dtype build_capacity(dtype elems) {
+        dtype cap = 2 + elems / WORD_BITS;
+        cap += cap % 2;
+        return cap * WORD_BITS <= leaf_size ? cap : leaf_size / WORD_BITS;
+    }
+
+    /**
+     * @brief Allocate and populate leaves for bulk construction.
+     *
+     * Leaves `from` to `to - 1` out of `count` (near) equal sized leaves are
+     * created and stored in `level`. Ranges of leaves are independent, and
+     * may be populated concurrently.
+     *
+     * @param level Target array for leaf pointers.
+     * @param data  Pointer to packed bits.
+     * @param size  Total number of bits to read from data.
+     * @param count Total number of leaves to create.
+     * @param from  Index of first leaf to create.
+     * @param to    Index after the last leaf to create.
+     */
+    void build_leaves(void** level, const uint64_t* data, dtype size,
+                      dtype count, dtype from, dtype to) {
+        dtype elems = size / count;
+        dtype extra = size % count;
+        uint64_t offset = uint64_t(from) * elems;
+        offset += from < extra ? from : extra;
+        for (dtype i = from; i < to; i++) {
+            dtype l_size = elems + (i < extra ? 1 : 0);
+            leaf* l = allocator_->template allocate_leaf<leaf>(
+                build_capacity(l_size));
+            l->append_bits(data, offset, l_size);
+            offset += l_size;
+            level[i] = l;
+        }
+    }
+
+    /**
+     * @brief Bottom-up construction of the tree from packed data.
+     *
+     * The data is split into \f$\lceil n / \mathrm{leaf\_size}\rceil\f$ leaves
+     * of (near) equal size, that are filled a word at a time. Internal nodes
+     * are then built one level at a time by evenly distributing the nodes or
+     * leaves from the level below, until a single root remains. No
+     * rebalancing of any kind is required, since every leaf will have at
+     * least `leaf_size / 2` elements and every internal node, apart from the
+     * root, will have at least `branches / 2` children.
+     *
+     * Populating leaves dominates the construction time, and is split evenly
+     * between `threads` threads. Internal nodes are built by the calling
+     * thread. Requires a thread safe allocator if `threads > 1`.
+     *
+     * Expects `allocator_` to be set and no root to be allocated.
+     *
+     * @param data    Pointer to packed bits. Bit `i` is read from
+     * `data[i / 64] >> (i % 64)`.
+     * @param size    Number of bits to read from data.
+     * @param threads Number of threads to use for populating leaves.
+     */
+    void build(const uint64_t* data, dtype size, uint32_t threads) {
+        if (size <= leaf_size) {
+            l_root_ = allocator_->template allocate_leaf<leaf>(
+                build_capacity(size));
+            l_root_->append_bits(data, 0, size);
+            return;
+        }
+        dtype count = size / leaf_size + (size % leaf_size ? 1 : 0);
+        void** level = (void**)malloc(count * sizeof(void*));
+        if (threads > count) threads = count;
+        if (threads <= 1) {
+            build_leaves(level, data, size, count, 0, count);
+        } else {
+            std::thread* workers = new std::thread[threads - 1];
+            for (uint32_t t = 0; t < threads - 1; t++) {
+                dtype from = uint64_t(count) * t / threads;
+                dtype to = uint64_t(count) * (t + 1) / threads;
+                workers[t] = std::thread(&bit_vector::build_leaves, this, level,
+                                         data, size, count, from, to);
+            }
+            build_leaves(level, data, size, count,
+                         uint64_t(count) * (threads - 1) / threads, count);
+            for (uint32_t t = 0; t < threads - 1; t++) {
+                workers[t].join();
+            }
+            delete[] workers;
+        }
+        bool leaves = true;
+        while (true) {
+            dtype n_count = count / branches + (count % branches ? 1 : 0);
+            dtype children = count / n_count;
+            dtype extra = count % n_count;
+            dtype idx = 0;
+            for (dtype i = 0; i < n_count; i++) {
+                node* n = allocator_->template allocate_node<node>();
+                dtype c_count = children + (i < extra ? 1 : 0);
+                if (leaves) {
+                    n->has_leaves(true);
+                    for (dtype j = 0; j < c_count; j++) {
+                        n->append_child(reinterpret_cast<leaf*>(level[idx++]));
+                    }
+                } else {
+                    for (dtype j = 0; j < c_count; j++) {
+                        n->append_child(reinterpret_cast<node*>(level[idx++]));
+                    }
+                }
+                level[i] = n;
+            }
+            leaves = false;
+            count = n_count;
+            if (count == 1) break;
+        }
+        n_root_ = reinterpret_cast<node*>(level[0]);
+        root_is_leaf_ = false;
+        free(level);
+    }
+
+    /**
+     * @brief Concurrently add all leaves to a query support structure.
+     *
+     * Used by `generate_query_structure`. Subtrees are expanded one level at a
+     * time until there are at least `4 * threads` of them, or the subtrees are
+     * leaves. The position of each subtree is known from the cumulative sizes
+     * and sums of the parent, so contiguous ranges of subtrees can be placed
+     * independently.
+     *
+     * @param qs      Query support structure.
+     * @param threads Number of threads to use.
+     */
+    template <class Q>
+    void place_query_structure(Q* qs, uint32_t threads) const {
+        std::vector<node*> parts = {n_root_};
+        std::vector<std::pair<dtype, dtype>> offsets = {{0, 0}};
+        while (parts.size() < 4 * size_t(threads) &&
+               !parts[0]->has_leaves()) {
+            std::vector<node*> n_parts;
+            std::vector<std::pair<dtype, dtype>> n_offsets;
+            for (size_t i = 0; i < parts.size(); i++) {
+                node* n = parts[i];
+                for (uint8_t j = 0; j < n->child_count(); j++) {
+                    dtype s = j != 0 ? n->child_sizes()->get(j - 1) : 0;
+                    dtype o = j != 0 ? n->child_sums()->get(j - 1) : 0;
+                    n_parts.push_back(reinterpret_cast<node*>(n->child(j)));
+                    n_offsets.push_back(
+                        {offsets[i].first + s, offsets[i].second + o});
+                }
+            }
+            parts.swap(n_parts);
+            offsets.swap(n_offsets);
+        }
+        auto place = [&](size_t from, size_t to) {
+            for (size_t i = from; i < to; i++) {
+                parts[i]->place_query_structure(qs, offsets[i].first,
+                                                offsets[i].second);
+            }
+        };
+        size_t count = parts.size();
+        if (threads > count) threads = count;
+        std::thread* workers = new std::thread[threads - 1];
+        for (uint32_t t = 0; t < threads - 1; t++) {
+            workers[t] = std::thread(place, count * t / threads,
+                                     count * (t + 1) / threads);
+        }
+        place(count * (threads - 1) / threads, count);
+        for (uint32_t t = 0; t < threads - 1; t++) {
+            workers[t].join();
+        }
+        delete[] workers;
+        qs->placed(size(), sum());
+    }
+
+    /** @brief Number of queries descended in lock-step by batched queries. */
+    static const constexpr size_t QUERY_GROUP = 16;
+
+    /** @brief Query types supported by `query_batch`. */
+    enum class query_kind { access, rank, select };
+
+    /**
+     * @brief Answers a batch of queries by descending the tree in lock-step.
+     *
+     * Queries are processed in groups of `QUERY_GROUP`. For each level of the
+     * tree, the branching data of all nodes in the group is prefetched before
+     * any of the nodes are searched, and the selected children are prefetched
+     * before the next level is processed. This way cache misses for
+     * independent queries overlap instead of being serialized.
+     *
+     * @tparam kind     Type of query to answer.
+     * @tparam out_type Result type (bool for access, dtype otherwise).
+     *
+     * @param q   Query arguments.
+     * @param out Array to store results in.
+     * @param n   Number of queries.
+     */
+    template <query_kind kind, class out_type>
+    void query_batch(const dtype* q, out_type* out, size_t n) const {
+        if (root_is_leaf_) {
+            for (size_t i = 0; i < n; i++) {
+                if constexpr (kind == query_kind::access) {
+                    out[i] = l_root_->at(q[i]);
+                } else if constexpr (kind == query_kind::rank) {
+                    out[i] = l_root_->rank(q[i]);
+                } else {
+                    out[i] = l_root_->select(q[i]);
+                }
+            }
+            [[unlikely]] return;
+        }
+        const void* cur[QUERY_GROUP];
+        dtype arg[QUERY_GROUP];
+        dtype res[QUERY_GROUP];
+        for (size_t start = 0; start < n; start += QUERY_GROUP) {
+            size_t g = n - start < QUERY_GROUP ? n - start : QUERY_GROUP;
+            for (size_t i = 0; i < g; i++) {
+                cur[i] = n_root_;
+                arg[i] = q[start + i];
+                res[i] = 0;
+            }
+            bool leaves = false;
+            while (!leaves) {
+                leaves = reinterpret_cast<const node*>(cur[0])->has_leaves();
+                for (size_t i = 0; i < g; i++) {
+                    reinterpret_cast<const node*>(cur[i])->prefetch(
+                        kind != query_kind::access);
+                }
+                for (size_t i = 0; i < g; i++) {
+                    const node* nd = reinterpret_cast<const node*>(cur[i]);
+                    if constexpr (kind == query_kind::access) {
+                        cur[i] = nd->at_step(arg[i]);
+                    } else if constexpr (kind == query_kind::rank) {
+                        cur[i] = nd->rank_step(arg[i], res[i]);
+                    } else {
+                        cur[i] = nd->select_step(arg[i], res[i]);
+                    }
+                    __builtin_prefetch(cur[i]);
+                }
+            }
+            for (size_t i = 0; i < g; i++) {
+                const leaf* l = reinterpret_cast<const leaf*>(cur[i]);
+                if constexpr (kind == query_kind::access) {
+                    out[start + i] = l->at(arg[i]);
+                } else if constexpr (kind == query_kind::rank) {
+                    out[start + i] = res[i] + l->rank(arg[i]);
+                } else {
+                    out[start + i] = res[i] + l->select(arg[i]);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Insert a contiguous range of elements starting at "index".
+     *
+     * Shared implementation of `insert_range` and `insert_run`. A run is
+     * inserted if "source" is `nullptr`.
+     *
+     * @param index  Location of insertion.
+     * @param source Pointer to packed source data or `nullptr` for a run.
+     * @param v      Value of the inserted run if "source" is `nullptr`.
+     * @param elems  Number of elements to insert.
+     */
+    void splice(dtype index, const uint64_t* source, bool v, dtype elems) {
+#ifdef DEBUG
+        if (index > size()) {
+            std::cerr << "Invalid range insertion to index " << index
+                      << " for " << size() << " element bit vector."
+                      << std::endl;
+            assert(index <= size());
+        }
+#endif
+        modified(index);
+        unshare_insert(index);
+        dtype done = 0;
+        while (root_is_leaf_ && done < elems) {
+            if constexpr (compressed) {
+                constexpr dtype max_size = ((~uint32_t(0)) >> 1) - 1;
+                dtype cap = l_root_->capacity();
+                dtype n_cap = l_root_->desired_capacity() + 2;
+                if (source == nullptr && l_root_->is_compressed() &&
+                    l_root_->size() < max_size &&
+                    n_cap * WORD_BITS <= leaf_size) {
+                    if (n_cap > cap) {
+                        l_root_ =
+                            allocator_->reallocate_leaf(l_root_, cap, n_cap);
+                    }
+                    dtype count = elems - done;
+                    if (count > max_size - l_root_->size()) {
+                        count = max_size - l_root_->size();
+                    }
+                    l_root_->insert_run(index + done, v, count);
+                    done += count;
+                } else {
+                    bool value = source == nullptr
+                                     ? v
+                                     : (source[done / WORD_BITS] >>
+                                        (done % WORD_BITS)) & 1;
+                    insert(index + done, value);
+                    done++;
+                }
+                [[unlikely]] continue;
+            }
+            dtype n_size = l_root_->size() + elems;
+            if (n_size <= leaf_size) {
+                dtype cap = l_root_->capacity();
+                dtype n_cap = build_capacity(n_size);
+                if (n_cap > cap) {
+                    l_root_ = allocator_->reallocate_leaf(l_root_, cap, n_cap);
+                }
+                if (source == nullptr) {
+                    l_root_->insert_run(index, v, elems);
+                } else {
+                    l_root_->insert_bits(index, source, 0, elems);
+                }
+                return;
+            }
+            n_root_ = allocator_->template allocate_node<node>();
+            n_root_->has_leaves(true);
+            n_root_->append_child(l_root_);
+            root_is_leaf_ = false;
+        }
+        while (done < elems) {
+            if (n_root_->child_count() == branches) {
+                [[unlikely]] split_root();
+            }
+            done += n_root_->insert_range(index + done, source, done, v,
+                                          elems - done, allocator_);
+        }
+    }
+
+    /**
+     * @brief Shared implementation of `set_range` and `flip_range`.
+     *
+     * @tparam flip Invert elements instead of setting them to "v".
+     *
+     * @param a Start of range.
+     * @param b End of range.
+     * @param v Value to set elements to.
+     */
+    template <bool flip>
+    void update_range(dtype a, dtype b, bool v) {
+#ifdef DEBUG
+        if (a > b || b > size()) {
+            std::cerr << "Invalid range update [" << a << ", " << b
+                      << ") for " << size() << " element bit vector."
+                      << std::endl;
+            assert(a <= b && b <= size());
+        }
+#endif
+        if (a >= b) return;
+        modified(a);
+        unshare(a, b);
+        if constexpr (compressed) {
+            // Encoded root leaves that can not grow to fit the extra runs are
+            // flattened, or split if they hold more than leaf_size elements.
+            if (root_is_leaf_ && l_root_->is_compressed()) {
+                dtype cap = l_root_->capacity();
+                dtype n_cap = l_root_->desired_capacity() + 2;
+                if (n_cap * WORD_BITS <= leaf_size) {
+                    if (n_cap > cap) {
+                        l_root_ =
+                            allocator_->reallocate_leaf(l_root_, cap, n_cap);
+                    }
+                } else if (l_root_->size() <= leaf_size) {
+                    n_cap = build_capacity(l_root_->size());
+                    if (n_cap > cap) {
+                        l_root_ =
+                            allocator_->reallocate_leaf(l_root_, cap, n_cap);
+                    }
+                    l_root_->uncompress();
+                } else {
+                    split_leaf();
+                }
+            }
+        }
+        if (root_is_leaf_) {
+            if constexpr (flip) {
+                l_root_->flip_range(a, b);
+            } else {
+                l_root_->set_range(a, b, v);
+            }
+            [[unlikely]] return;
+        }
+        while (a < b) {
+            if constexpr (compressed) {
+                if (n_root_->child_count() == branches) {
+                    [[unlikely]] split_root();
+                }
+            }
+            dtype reached = b;
+            n_root_->template update_range<flip>(a, reached, v, allocator_);
+            a = reached;
+        }
+    }
+
+    /**
+     * @brief Shared implementation of `next_one` and `next_zero`.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    template <bool v>
+    dtype next_bit(dtype i) const {
+        if (i >= size()) {
+            [[unlikely]] return size();
+        }
+        if (root_is_leaf_) {
+            [[unlikely]] return l_root_->template next_bit<v>(i);
+        }
+        return n_root_->template next_bit<v>(i);
+    }
+
+    /**
+     * @brief Shared implementation of `prev_one` and `prev_zero`.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    template <bool v>
+    dtype prev_bit(dtype i) const {
+        dtype n = size();
+        if (n == 0) {
+            [[unlikely]] return 0;
+        }
+        i = i < n ? i : n - 1;
+        if (root_is_leaf_) {
+            [[unlikely]] return l_root_->template prev_bit<v>(i);
+        }
+        return n_root_->template prev_bit<v>(i);
+    }
+
    public:
     /**
      * @brief Bit vector constructor with existing allocator
@@ -128,7 +705,7 @@ class bit_vector : uncopyable {
     bit_vector(allocator* alloc, dtype size = 0, bool value = false) {
         allocator_ = alloc;
         if constexpr (compressed) {
-            l_root_->template allocate_leaf<leaf>(2, size, value);
+            l_root_ = allocator_->template allocate_leaf<leaf>(2, size, value);
             return;
         }
         if (size > 0 || value == true) {
@@ -162,6 +739,44 @@ class bit_vector : uncopyable {
         l_root_ = allocator_->template allocate_leaf<leaf>(2);
     }
 
+    /**
+     * @brief Bulk construction from packed data with existing allocator.
+     *
+     * Builds the tree bottom-up in \f$\mathcal{O}(n / 64)\f$ time, which is
+     * considerably faster than `size` calls to `insert`. The resulting
+     * structure is fully dynamic.
+     *
+     * @param alloc   The allocator instance.
+     * @param data    Pointer to packed bits. Bit `i` is read from
+     * `data[i / 64] >> (i % 64)`, i.e. the format produced by `dump`.
+     * @param size    Number of bits to read from data.
+     * @param threads Number of threads used for populating leaves. The
+     * allocator needs to be thread safe if `threads > 1`.
+     */
+    bit_vector(allocator* alloc, const uint64_t* data, dtype size,
+               uint32_t threads = 1) {
+        allocator_ = alloc;
+        build(data, size, threads);
+    }
+
+    /**
+     * @brief Bulk construction from packed data with an owned allocator.
+     *
+     * Builds the tree bottom-up in \f$\mathcal{O}(n / 64)\f$ time, which is
+     * considerably faster than `size` calls to `insert`. The resulting
+     * structure is fully dynamic.
+     *
+     * @param data    Pointer to packed bits. Bit `i` is read from
+     * `data[i / 64] >> (i % 64)`, i.e. the format produced by `dump`.
+     * @param size    Number of bits to read from data.
+     * @param threads Number of threads used for populating leaves.
+     */
+    bit_vector(const uint64_t* data, dtype size, uint32_t threads = 1) {
+        allocator_ = new allocator();
+        owned_allocator_ = true;
+        build(data, size, threads);
+    }
+
     /**
      * @brief Deconstructor that deallocates the entire data structure.
      *
@@ -169,17 +784,916 @@ class bit_vector : uncopyable {
      * recursively deallocated before deallocation of the bit vector container.
      * If the allocator is owned by the bit vector container, that will be
      * dallocated as well.
+     *
+     * Nodes and leaves shared with snapshots are kept alive until the last
+     * bit vector referencing them is deleted, and an owned allocator is
+     * only deallocated along with the last of the snapshots.
      */
     ~bit_vector() {
+        release_root();
+        if (group_ != nullptr) {
+            if (group_->fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            delete group_;
+        }
+        if (owned_allocator_) {
+            delete (allocator_);
+        }
+    }
+
+    /**
+     * @brief Creates a read-only copy-on-write snapshot of the current
+     * contents.
+     *
+     * Creating a snapshot is \f$\mathcal{O}(1)\f$, since the snapshot shares
+     * the entire tree with `this`. Subsequent modifications of `this` copy the
+     * nodes and leaves on the modified root-to-leaf paths before modifying
+     * them, so a single bit update costs \f$\mathcal{O}(\log n)\f$ node and
+     * leaf copies while any snapshots exist. Without snapshots, modifications
+     * work in place as before.
+     *
+     * Snapshots can be queried concurrently from other threads while `this`
+     * is modified, provided the allocator is thread safe. Only the const
+     * query interface should be used on snapshots, excluding query support
+     * structures that flush leaf buffers.
+     *
+     * The snapshot needs to be deleted by the caller. The snapshot and `this`
+     * can be deleted in any order, also when the allocator is owned.
+     *
+     * @return Pointer to a new snapshot.
+     */
+    const bit_vector* snapshot() {
+        if (group_ == nullptr) {
+            group_ = new std::atomic<uint32_t>(1);
+        }
+        group_->fetch_add(1, std::memory_order_acq_rel);
+        return new bit_vector(*this, group_);
+    }
+
+    /**
+     * @brief Append-only builder for populating an empty bit vector.
+     *
+     * Bits are appended to the rightmost leaf directly, without any root to
+     * leaf traversal. Internal nodes are only touched when a leaf gets full,
+     * at which point the leaf is added to the rightmost node on the lowest
+     * level, and nodes are propagated up the right spine as they fill.
+     *
+     * At each level the most recently completed leaf or node is held back, so
+     * that the final (partial) leaf and nodes can be balanced against their
+     * left sibling when building is finished. Cumulative sizes and sums of the
+     * internal nodes are thus computed once per child.
+     *
+     * The target bit vector must not be accessed until `finish` has been
+     * called, either explicitly or by the builder destructor.
+     *
+     * Example:
+     * ```
+     * bv::bv bit_vector;
+     * {
+     *     bv::bv::builder b(&bit_vector);
+     *     b.push_back(true);
+     *     b.append_word(0b1011, 4);
+     * }
+     * ```
+     */
+    class builder : uncopyable {
+       private:
+        /** @brief Maximum supported number of internal node levels. */
+        static const constexpr uint8_t MAX_HEIGHT = 32;
+
+        bit_vector* bv_;         ///< Bit vector to populate.
+        allocator* allocator_;   ///< Allocator of the target bit vector.
+        leaf* leaf_;             ///< Leaf currently being appended to.
+        leaf* prev_leaf_;        ///< Completed leaf not yet in any node.
+        node* cur_[MAX_HEIGHT];  ///< Incomplete node for each level.
+        node* prev_[MAX_HEIGHT];  ///< Completed node not yet in any parent.
+        uint64_t word_;           ///< Bits not yet written to `leaf_`.
+        uint32_t word_bits_;      ///< Number of bits in `word_`.
+        bool finished_;           ///< True if the tree has been installed.
+
+        /**
+         * @brief Adds a child to the incomplete node on the given level.
+         *
+         * If the node gets full, the previously completed node on the level
+         * will be passed on to the next level.
+         *
+         * @param level Level of the node receiving the child. Level 0 nodes
+         * have leaves as children.
+         * @param child Pointer to bv::leaf or bv::node to add.
+         */
+        void add_child(uint8_t level, void* child) {
+            if (cur_[level] == nullptr) {
+                cur_[level] = allocator_->template allocate_node<node>();
+                if (level == 0) cur_[level]->has_leaves(true);
+            }
+            node* n = cur_[level];
+            if (level == 0) {
+                n->append_child(reinterpret_cast<leaf*>(child));
+            } else {
+                n->append_child(reinterpret_cast<node*>(child));
+            }
+            if (n->child_count() == branches) {
+                if (prev_[level] != nullptr) {
+                    assert(level + 1 < MAX_HEIGHT);
+                    add_child(level + 1, prev_[level]);
+                }
+                prev_[level] = n;
+                cur_[level] = nullptr;
+            }
+        }
+
+        /**
+         * @brief Starts a new leaf after `leaf_` has become full.
+         */
+        void next_leaf() {
+            if (prev_leaf_ != nullptr) {
+                add_child(0, prev_leaf_);
+            }
+            prev_leaf_ = leaf_;
+            leaf_ = allocator_->template allocate_leaf<leaf>(leaf_size /
+                                                             WORD_BITS);
+        }
+
+        /**
+         * @brief Reallocates leaf to the capacity used by bulk construction.
+         */
+        leaf* shrink(leaf* l) {
+            dtype cap = l->capacity();
+            dtype n_cap = build_capacity(l->size());
+            if (n_cap < cap) {
+                l = allocator_->reallocate_leaf(l, cap, n_cap);
+            }
+            return l;
+        }
+
+       public:
+        /**
+         * @brief Create builder for populating an empty bit vector.
+         *
+         * @param bv Pointer to an empty bit vector.
+         */
+        builder(bit_vector* bv)
+            : bv_(bv),
+              allocator_(bv->allocator_),
+              prev_leaf_(nullptr),
+              cur_(),
+              prev_(),
+              word_(0),
+              word_bits_(0),
+              finished_(false) {
+            if (!bv->root_is_leaf_ || bv->size() > 0) {
+                std::cerr << "Builder requires an empty bit vector" << std::endl;
+                [[unlikely]] exit(1);
+            }
+            bv->unshare(0, 0);
+            leaf_ = allocator_->reallocate_leaf(
+                bv->l_root_, bv->l_root_->capacity(), leaf_size / WORD_BITS);
+            bv->l_root_ = leaf_;
+        }
+
+        /**
+         * @brief Finishes building if `finish` has not already been called.
+         */
+        ~builder() {
+            if (!finished_) finish();
+        }
+
+        /**
+         * @brief Append a bit to the end of the bit vector.
+         *
+         * @param v Value to append.
+         */
+        void push_back(bool v) {
+            word_ |= uint64_t(v) << word_bits_;
+            if (++word_bits_ == WORD_BITS) {
+                leaf_->append_bits(&word_, 0, WORD_BITS);
+                word_ = 0;
+                word_bits_ = 0;
+                if (leaf_->size() == leaf_size) [[unlikely]] next_leaf();
+            }
+        }
+
+        /**
+         * @brief Append the `nbits` lowest bits of `word` to the bit vector.
+         *
+         * Bits are appended starting from the least significant bit.
+         *
+         * @param word  Bits to append.
+         * @param nbits Number of bits to append (at most 64).
+         */
+        void append_word(uint64_t word, uint32_t nbits) {
+            assert(nbits <= WORD_BITS);
+            if (nbits == 0) [[unlikely]] return;
+            if (nbits < WORD_BITS) {
+                word &= (uint64_t(1) << nbits) - 1;
+            }
+            word_ |= word << word_bits_;
+            word_bits_ += nbits;
+            if (word_bits_ >= WORD_BITS) {
+                leaf_->append_bits(&word_, 0, WORD_BITS);
+                word_bits_ -= WORD_BITS;
+                word_ = word_bits_ ? word >> (nbits - word_bits_) : 0;
+                if (leaf_->size() == leaf_size) [[unlikely]] next_leaf();
+            }
+        }
+
+        /**
+         * @brief Number of bits appended so far.
+         */
+        uint64_t size() const {
+            uint64_t ret = word_bits_ + leaf_->size();
+            if (prev_leaf_ != nullptr) ret += prev_leaf_->size();
+            for (uint8_t i = 0; i < MAX_HEIGHT; i++) {
+                if (cur_[i] != nullptr) ret += cur_[i]->size();
+                if (prev_[i] != nullptr) ret += prev_[i]->size();
+            }
+            return ret;
+        }
+
+        /**
+         * @brief Balance the right spine and install it in the bit vector.
+         *
+         * The final leaf and the final node of each level are balanced
+         * against their (full) left siblings, to ensure that all structural
+         * invariants hold for the resulting tree. After this, the bit vector
+         * may be used normally and the builder may no longer be used.
+         */
+        void finish() {
+            if (finished_) return;
+            finished_ = true;
+            bv_->modified(0);
+            if (word_bits_ > 0) {
+                leaf_->append_bits(&word_, 0, word_bits_);
+            }
+            if (prev_leaf_ == nullptr) {
+                bv_->l_root_ = shrink(leaf_);
+                return;
+            }
+            if (leaf_->size() < leaf_size / 2) {
+                leaf_->transfer_prepend(prev_leaf_,
+                                        (prev_leaf_->size() - leaf_->size()) /
+                                            2);
+            }
+            add_child(0, shrink(prev_leaf_));
+            add_child(0, shrink(leaf_));
+            for (uint8_t level = 0; level < MAX_HEIGHT; level++) {
+                node* a = prev_[level];
+                node* b = cur_[level];
+                if (a != nullptr && b != nullptr &&
+                    b->child_count() < branches / 2) {
+                    b->transfer_prepend(a,
+                                        (a->child_count() - b->child_count()) /
+                                            2);
+                }
+                bool top = level + 1 == MAX_HEIGHT ||
+                           (prev_[level + 1] == nullptr &&
+                            cur_[level + 1] == nullptr);
+                if (top && (a == nullptr || b == nullptr)) {
+                    bv_->n_root_ = a != nullptr ? a : b;
+                    break;
+                }
+                prev_[level] = nullptr;
+                cur_[level] = nullptr;
+                if (a != nullptr) add_child(level + 1, a);
+                if (b != nullptr) add_child(level + 1, b);
+            }
+            bv_->root_is_leaf_ = false;
+        }
+    };
+
+    /**
+     * @brief Finger for bit vector updates with strong locality.
+     *
+     * The cursor caches the path from the root to the most recently used leaf,
+     * along with the position and number of preceding 1-bits for each node on
+     * the path. An operation first climbs to the deepest cached node covering
+     * the target position and only descends from there, so operations close
+     * to the previous one skip most of the search.
+     *
+     * If the target leaf can be modified without reallocation or
+     * rebalancing, the leaf is updated directly and the cumulative sizes and
+     * sums of the cached ancestors are adjusted in place. Otherwise the
+     * operation is delegated to the bit vector and the cached path is
+     * dropped. Modifications are always delegated while snapshots of the bit
+     * vector exist.
+     *
+     * Modifying the bit vector by other means than the cursor invalidates the
+     * cursor.
+     *
+     * Usage example:
+     * ```
+     * bv::bv bit_vector;
+     * bv::bv::cursor c(&bit_vector);
+     * for (uint64_t i = 0; i < 1000; i++) {
+     *     c.insert(i, i % 3 == 0);
+     * }
+     * ```
+     */
+    class cursor : uncopyable {
+       private:
+        /** @brief Maximum supported number of internal node levels. */
+        static const constexpr uint8_t MAX_HEIGHT = 32;
+
+        bit_vector* bv_;             ///< Bit vector to operate on.
+        node* path_[MAX_HEIGHT];     ///< Nodes from the root to `leaf_`.
+        dtype offset_[MAX_HEIGHT];   ///< Position of the first element of
+                                     ///< each node in `path_`.
+        dtype sum_[MAX_HEIGHT];      ///< Number of 1-bits preceding each node
+                                     ///< in `path_`.
+        uint8_t child_[MAX_HEIGHT];  ///< Child followed in each node.
+        uint8_t height_;             ///< Number of nodes in `path_`.
+        leaf* leaf_;                 ///< Cached leaf or nullptr.
+        dtype start_;                ///< Position of the first element of
+                                     ///< `leaf_`.
+        dtype ones_;                 ///< Number of 1-bits preceding `leaf_`.
+
+        /**
+         * @brief Locate the leaf for an operation on the index<sup>th</sup>
+         * element.
+         *
+         * @param index Target position.
+         * @param end   True if the position right after the last element of a
+         *              leaf counts as part of the leaf, as for insertions.
+         *
+         * @return False if the root is a leaf and the operation should be
+         * delegated to the bit vector.
+         */
+        bool seek(dtype index, bool end) {
+            if (bv_->root_is_leaf_) {
+                [[unlikely]] return false;
+            }
+            if (leaf_ != nullptr && index >= start_ &&
+                index - start_ + (end ? 0 : 1) <= leaf_->size()) {
+                [[likely]] return true;
+            }
+            while (height_ > 0) {
+                node* n = path_[height_ - 1];
+                if (index >= offset_[height_ - 1] &&
+                    index - offset_[height_ - 1] + (end ? 0 : 1) <= n->size()) {
+                    break;
+                }
+                height_--;
+            }
+            if (height_ == 0) {
+                path_[0] = bv_->n_root_;
+                offset_[0] = 0;
+                sum_[0] = 0;
+                height_ = 1;
+            }
+            while (true) {
+                node* n = path_[height_ - 1];
+                dtype local = index - offset_[height_ - 1];
+                uint8_t c = n->child_sizes()->find(end ? local : local + 1);
+                child_[height_ - 1] = c;
+                dtype c_offset = offset_[height_ - 1];
+                dtype c_sum = sum_[height_ - 1];
+                if (c != 0) {
+                    c_offset += n->child_sizes()->get(c - 1);
+                    c_sum += n->child_sums()->get(c - 1);
+                }
+                if (n->has_leaves()) {
+                    leaf_ = reinterpret_cast<leaf*>(n->child(c));
+                    start_ = c_offset;
+                    ones_ = c_sum;
+                    return true;
+                }
+                path_[height_] = reinterpret_cast<node*>(n->child(c));
+                offset_[height_] = c_offset;
+                sum_[height_++] = c_sum;
+            }
+        }
+
+        /**
+         * @brief Update cumulative sizes and sums of the cached path after a
+         * modification of `leaf_`.
+         *
+         * @param size_change Change to the number of elements.
+         * @param sum_change  Change to the number of 1-bits.
+         */
+        void propagate(int size_change, int sum_change) {
+            for (uint8_t h = 0; h < height_; h++) {
+                node* n = path_[h];
+                if (size_change != 0) {
+                    n->child_sizes()->increment(child_[h], n->child_count(),
+                                                dtype(size_change));
+                }
+                if (sum_change != 0) {
+                    n->child_sums()->increment(child_[h], n->child_count(),
+                                               dtype(sum_change));
+                }
+            }
+        }
+
+        /** @brief Drop the cached path. */
+        void invalidate() {
+            height_ = 0;
+            leaf_ = nullptr;
+        }
+
+       public:
+        /**
+         * @brief Create a cursor for `bv`.
+         *
+         * @param bv Bit vector to operate on.
+         */
+        cursor(bit_vector* bv) : bv_(bv), height_(0), leaf_(nullptr) {}
+
+        /**
+         * @brief Get the value of the index<sup>th</sup> element.
+         *
+         * @param index Index to access.
+         */
+        bool at(dtype index) {
+            if (!seek(index, false)) {
+                [[unlikely]] return bv_->at(index);
+            }
+            return leaf_->at(index - start_);
+        }
+
+        /**
+         * @brief Number of 1-bits up to position index.
+         *
+         * @param index Number of elements to include in the "summation".
+         */
+        dtype rank(dtype index) {
+            if (!seek(index, true)) {
+                [[unlikely]] return bv_->rank(index);
+            }
+            return ones_ + leaf_->rank(index - start_);
+        }
+
+        /**
+         * @brief Insert "value" into position "index".
+         *
+         * @param index Where should "value" be inserted.
+         * @param value What should be inserted at "index".
+         */
+        void insert(dtype index, bool value) {
+            if (!seek(index, true) || leaf_->need_realloc() ||
+                bv_->shared()) {
+                bv_->insert(index, value);
+                [[unlikely]] invalidate();
+                return;
+            }
+            bv_->modified(index);
+            leaf_->insert(index - start_, value);
+            propagate(1, value);
+        }
+
+        /**
+         * @brief Remove the index<sup>th</sup> element.
+         *
+         * @param index Position of element to remove.
+         *
+         * @return Value of removed element.
+         */
+        bool remove(dtype index) {
+            bool fast = seek(index, false) && leaf_->size() > leaf_size / 3 &&
+                        !bv_->shared();
+            if constexpr (aggressive_realloc) {
+                fast = fast && leaf_->capacity() * WORD_BITS <=
+                                   leaf_->size() - 1 + 4 * WORD_BITS;
+            }
+            if (!fast) {
+                bool v = bv_->remove(index);
+                invalidate();
+                [[unlikely]] return v;
+            }
+            bv_->modified(index);
+            bool v = leaf_->remove(index - start_);
+            propagate(-1, -int(v));
+            return v;
+        }
+
+        /**
+         * @brief Set the value of the index<sup>th</sup> element to "value".
+         *
+         * @param index Position of element to set.
+         * @param value New value of the element.
+         */
+        void set(dtype index, bool value) {
+            bool fast = seek(index, false) && !bv_->shared();
+            if constexpr (compressed) {
+                fast = fast &&
+                       !(leaf_->is_compressed() && leaf_->need_realloc());
+            }
+            if (!fast) {
+                bv_->set(index, value);
+                invalidate();
+                [[unlikely]] return;
+            }
+            bv_->modified(index);
+            propagate(0, leaf_->set(index - start_, value));
+        }
+    };
+
+    /**
+     * @brief Read-only forward iterator over the elements of the bit vector.
+     *
+     * The iterator stores the path from the root to the current leaf, so
+     * moving to the next leaf only needs to touch the nodes that change,
+     * instead of descending from the root for every element like `at` does.
+     *
+     * Leaf words are read directly. Leaves with uncommitted buffer elements
+     * and run-length encoded leaves are decoded into a scratch buffer owned
+     * by the iterator without modifying the leaf.
+     *
+     * Any modification of the bit vector invalidates all iterators.
+     *
+     * Usage example:
+     * ```
+     * uint64_t ones = 0;
+     * for (bool b : bit_vector) ones += b;
+     * ```
+     */
+    class const_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef bool value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef bool reference;
+
+       private:
+        /** @brief Maximum supported number of internal node levels. */
+        static const constexpr uint8_t MAX_HEIGHT = 32;
+
+        const node* path_[MAX_HEIGHT];  ///< Nodes from the root to `leaf_`.
+        uint8_t child_[MAX_HEIGHT];     ///< Child followed in each node.
+        uint8_t height_;                ///< Number of nodes in `path_`.
+        const uint64_t* words_;         ///< Bits of the current leaf.
+        std::vector<uint64_t> scratch_;  ///< Decoded bits if needed.
+        uint32_t pos_;                   ///< Position in the current leaf.
+        uint32_t leaf_size_;             ///< Size of the current leaf.
+        dtype index_;                    ///< Position in the bit vector.
+        dtype size_;                     ///< Size of the bit vector.
+
+        /**
+         * @brief Make `l` the current leaf.
+         *
+         * @param l Leaf to read.
+         */
+        void load_leaf(const leaf* l) {
+            pos_ = 0;
+            leaf_size_ = l->size();
+            if (l->is_compressed() || l->buffer_count() > 0) {
+                scratch_.assign(leaf_size_ / WORD_BITS + 2, 0);
+                l->copy_bits(scratch_.data());
+                words_ = scratch_.data();
+            } else {
+                words_ = l->data();
+            }
+        }
+
+        /**
+         * @brief Advance to the first leaf following the current leaf.
+         *
+         * Ascends until a node with a following child is found, and descends
+         * to the leftmost leaf of that child.
+         */
+        void next_leaf() {
+            while (child_[height_ - 1] + 1 >=
+                   path_[height_ - 1]->child_count()) {
+                height_--;
+            }
+            const node* n = path_[height_ - 1];
+            void* c = n->child(++child_[height_ - 1]);
+            while (!n->has_leaves()) {
+                n = reinterpret_cast<const node*>(c);
+                path_[height_] = n;
+                child_[height_++] = 0;
+                c = n->child(0);
+            }
+            load_leaf(reinterpret_cast<const leaf*>(c));
+        }
+
+       public:
+        /**
+         * @brief Create an iterator pointing to the index<sup>th</sup> element.
+         *
+         * @param bv    Bit vector to iterate.
+         * @param index Starting position. `bv->size()` for the end iterator.
+         */
+        const_iterator(const bit_vector* bv, dtype index)
+            : height_(0),
+              words_(nullptr),
+              scratch_(),
+              pos_(0),
+              leaf_size_(0),
+              index_(index),
+              size_(bv->size()) {
+            if (index >= size_) {
+                [[unlikely]] return;
+            }
+            if (bv->root_is_leaf_) {
+                load_leaf(bv->l_root_);
+                pos_ = index;
+                [[unlikely]] return;
+            }
+            const node* n = bv->n_root_;
+            while (true) {
+                path_[height_] = n;
+                child_[height_] = n->child_index(index);
+                void* c = n->child(child_[height_++]);
+                if (n->has_leaves()) {
+                    load_leaf(reinterpret_cast<const leaf*>(c));
+                    pos_ = index;
+                    return;
+                }
+                n = reinterpret_cast<const node*>(c);
+            }
+        }
+
+        const_iterator(const const_iterator& other) { *this = other; }
+
+        const_iterator(const_iterator&& other) = default;
+
+        const_iterator& operator=(const const_iterator& other) {
+            if (this == &other) {
+                [[unlikely]] return *this;
+            }
+            memcpy(path_, other.path_, other.height_ * sizeof(node*));
+            memcpy(child_, other.child_, other.height_);
+            height_ = other.height_;
+            scratch_ = other.scratch_;
+            words_ = other.words_ == other.scratch_.data() ? scratch_.data()
+                                                          : other.words_;
+            pos_ = other.pos_;
+            leaf_size_ = other.leaf_size_;
+            index_ = other.index_;
+            size_ = other.size_;
+            return *this;
+        }
+
+        const_iterator& operator=(const_iterator&& other) = default;
+
+        /** @brief Value of the current element. */
+        bool operator*() const {
+            return (words_[pos_ / WORD_BITS] >> (pos_ % WORD_BITS)) & 1;
+        }
+
+        /** @brief Advance to the next element. */
+        const_iterator& operator++() {
+            index_++;
+            if (++pos_ == leaf_size_ && index_ < size_) {
+                [[unlikely]] next_leaf();
+            }
+            return *this;
+        }
+
+        /** @brief Advance to the next element. */
+        const_iterator operator++(int) {
+            const_iterator ret = *this;
+            ++(*this);
+            return ret;
+        }
+
+        /**
+         * @brief Read up to 64 elements starting from the current element.
+         *
+         * Reads are limited to the current leaf. The first read element will
+         * be the least significant bit of `w`. The iterator is advanced past
+         * the read elements.
+         *
+         * @param w Output word. Bits beyond the returned count will be 0.
+         *
+         * @return Number of elements read. 0 only at the end.
+         */
+        uint32_t next_word(uint64_t& w) {
+            if (index_ >= size_) {
+                [[unlikely]] return 0;
+            }
+            uint32_t bits = leaf_size_ - pos_;
+            bits = bits < WORD_BITS ? bits : WORD_BITS;
+            uint32_t offset = pos_ % WORD_BITS;
+            const uint64_t* src = words_ + pos_ / WORD_BITS;
+            w = src[0] >> offset;
+            if (offset != 0 && bits > WORD_BITS - offset) {
+                w |= src[1] << (WORD_BITS - offset);
+            }
+            if (bits < WORD_BITS) {
+                w &= (uint64_t(1) << bits) - 1;
+            }
+            index_ += bits;
+            pos_ += bits;
+            if (pos_ == leaf_size_ && index_ < size_) {
+                next_leaf();
+            }
+            return bits;
+        }
+
+        /** @brief Position of the current element in the bit vector. */
+        dtype index() const { return index_; }
+
+        bool operator==(const const_iterator& other) const {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return index_ != other.index_;
+        }
+    };
+
+    /**
+     * @brief Iterator to the first element of the bit vector.
+     *
+     * See `const_iterator`.
+     */
+    const_iterator begin() const { return const_iterator(this, 0); }
+
+    /** @brief Iterator past the last element of the bit vector. */
+    const_iterator end() const { return const_iterator(this, size()); }
+
+    /**
+     * @brief Forward iterator over the positions of 1-bits in a range.
+     *
+     * Reads the bit vector a word at a time through `const_iterator` and
+     * extracts positions with count trailing zeros, instead of doing a
+     * `select` descent per result.
+     *
+     * Any modification of the bit vector invalidates all iterators.
+     *
+     * Usage example:
+     * ```
+     * for (auto it = bv.ones_begin(a, b); it != bv.ones_end(b); ++it) {
+     *     std::cout << *it << std::endl;
+     * }
+     * ```
+     */
+    class ones_iterator {
+       public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef dtype value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        typedef dtype reference;
+
+       private:
+        const_iterator it_;  ///< Position of the next unread word.
+        uint64_t word_;      ///< Not yet reported 1-bits of the current word.
+        dtype base_;         ///< Position of the first bit in `word_`.
+        dtype end_;          ///< End of the iterated range.
+        dtype pos_;          ///< Current position or `end_` if done.
+
+        /** @brief Move to the next 1-bit or to `end_`. */
+        void advance() {
+            while (word_ == 0) {
+                base_ = it_.index();
+                if (base_ >= end_) {
+                    pos_ = end_;
+                    [[unlikely]] return;
+                }
+                uint32_t bits = it_.next_word(word_);
+                if (base_ + bits > end_) {
+                    [[unlikely]] word_ &= (uint64_t(1) << (end_ - base_)) - 1;
+                }
+            }
+            pos_ = base_ + __builtin_ctzll(word_);
+            word_ &= word_ - 1;
+        }
+
+       public:
+        /**
+         * @brief Create an iterator to the first 1-bit in \f$[a, b)\f$.
+         *
+         * @param bv Bit vector to iterate.
+         * @param a  Start of range.
+         * @param b  End of range.
+         */
+        ones_iterator(const bit_vector* bv, dtype a, dtype b)
+            : it_(bv, a < b ? a : b), word_(0), base_(a), end_(b), pos_(b) {
+            advance();
+        }
+
+        /** @brief Position of the current 1-bit. */
+        dtype operator*() const { return pos_; }
+
+        /** @brief Advance to the next 1-bit. */
+        ones_iterator& operator++() {
+            advance();
+            return *this;
+        }
+
+        /** @brief Advance to the next 1-bit. */
+        ones_iterator operator++(int) {
+            ones_iterator ret = *this;
+            advance();
+            return ret;
+        }
+
+        bool operator==(const ones_iterator& other) const {
+            return pos_ == other.pos_;
+        }
+
+        bool operator!=(const ones_iterator& other) const {
+            return pos_ != other.pos_;
+        }
+    };
+
+    /**
+     * @brief Iterator to the first 1-bit in \f$[a, b)\f$.
+     *
+     * See `ones_iterator`.
+     *
+     * @param a Start of range.
+     * @param b End of range.
+     */
+    ones_iterator ones_begin(dtype a, dtype b) const {
+        return ones_iterator(this, a, b);
+    }
+
+    /**
+     * @brief Iterator past the last 1-bit in \f$[a, b)\f$.
+     *
+     * @param b End of range.
+     */
+    ones_iterator ones_end(dtype b) const { return ones_iterator(this, b, b); }
+
+    /**
+     * @brief Call `fn` with the position of each 1-bit in \f$[a, b)\f$.
+     *
+     * Positions are reported in increasing order. Subtrees without 1-bits are
+     * skipped based on cumulative sums, uncompressed leaves are scanned a word
+     * at a time and run-length encoded leaves report positions directly from
+     * runs.
+     *
+     * @tparam F Callable taking a `uint64_t` position.
+     *
+     * @param a  Start of range.
+     * @param b  End of range.
+     * @param fn Function to call.
+     */
+    template <class F>
+    void for_each_one(dtype a, dtype b, F fn) const {
+#ifdef DEBUG
+        if (a > b || b > size()) {
+            std::cerr << "Invalid range [" << a << ", " << b << ") for "
+                      << size() << " element bit vector." << std::endl;
+            assert(a <= b && b <= size());
+        }
+#endif
+        if (a >= b) {
+            [[unlikely]] return;
+        }
+        if (root_is_leaf_) {
+            [[unlikely]] l_root_->for_each_one(a, b, 0, fn);
+        } else {
+            n_root_->for_each_one(a, b, 0, fn);
+        }
+    }
+
+    /**
+     * @brief Call `fn(start, length, value)` for each maximal run of equal
+     * elements in \f$[a, b)\f$.
+     *
+     * Runs are reported in order and clipped to the range. Traversal takes
+     * time proportional to the number of runs rather than the number of bits
+     * for run-length encoded leaves, and subtrees containing only one value
+     * are reported without being visited. Uncompressed leaves are split into
+     * runs a word at a time.
+     *
+     * @tparam F Callable taking `(uint64_t, uint64_t, bool)`.
+     *
+     * @param a  Start of range.
+     * @param b  End of range.
+     * @param fn Function to call.
+     */
+    template <class F>
+    void for_each_run(dtype a, dtype b, F fn) const {
+#ifdef DEBUG
+        if (a > b || b > size()) {
+            std::cerr << "Invalid range [" << a << ", " << b << ") for "
+                      << size() << " element bit vector." << std::endl;
+            assert(a <= b && b <= size());
+        }
+#endif
+        if (a >= b) {
+            [[unlikely]] return;
+        }
+        // Leaves and subtrees report runs independently, so adjacent runs
+        // with the same value are merged before reporting.
+        uint64_t r_start = a;
+        uint64_t r_len = 0;
+        bool r_val = false;
+        auto merge = [&](uint64_t start, uint64_t len, bool val) {
+            if (val == r_val) {
+                r_len += len;
+                return;
+            }
+            if (r_len > 0) {
+                fn(r_start, r_len, r_val);
+            }
+            r_start = start;
+            r_len = len;
+            r_val = val;
+        };
         if (root_is_leaf_) {
-            allocator_->deallocate_leaf(l_root_);
+            [[unlikely]] l_root_->for_each_run(a, b, 0, merge);
         } else {
-            n_root_->deallocate(allocator_);
-            allocator_->deallocate_node(n_root_);
-        }
-        if (owned_allocator_) {
-            delete (allocator_);
+            n_root_->for_each_run(a, b, 0, merge);
         }
+        fn(r_start, r_len, r_val);
     }
 
     /**
@@ -188,38 +1702,129 @@ class bit_vector : uncopyable {
      * Traverses the tree and ads encountered leaves to the query support
      * strucutre.
      *
+     * With multiple threads, the tree is split into at least
+     * `4 * threads` subtrees of known position, and contiguous ranges of
+     * subtrees are added to the support structure concurrently, if the
+     * support structure allows it. Select samples are then calculated
+     * concurrently as well.
+     *
+     * Restarts tracking of modified positions for `update_query_structure`,
+     * and is thus not const. Only the most recently generated or updated
+     * structure can be updated incrementally.
+     *
      * @tparam block_size Size of blocks used in the query support structure.
-     * @param qs Query support structure.
+     * @param qs      Query support structure.
+     * @param threads Number of threads to use.
      */
     template <class Q>
-    void generate_query_structure(Q* qs) const {
+    void generate_query_structure(Q* qs, uint32_t threads = 1) {
         if (root_is_leaf_) {
             [[unlikely]] qs->append(l_root_);
-        } else {
+        } else if (threads <= 1 || !Q::concurrent_placement) {
             n_root_->generate_query_structure(qs);
+        } else {
+            place_query_structure(qs, threads);
+        }
+        qs->finalize(threads);
+        qs->version(version_);
+        tracked_version_ = version_;
+        dirty_from_ = ~dtype(0);
+    }
+
+    /**
+     * @brief Bring a query support structure up to date with `this`.
+     *
+     * Modifications only ever reallocate or restructure the leaves containing
+     * modified positions and their immediate siblings, and flushing a bit
+     * vector shared with snapshots only copies leaves from the first buffered
+     * leaf onward. If no query support structure has been generated or
+     * updated since `qs`, only the blocks from the leaf preceding the lowest
+     * modified position onward are recalculated, followed by recalculation
+     * of the select samples. Otherwise the structure is fully rebuilt.
+     * Either way tracking restarts from the current version, so of several
+     * structures only the most recently generated or updated one gets
+     * incremental updates.
+     *
+     * Does nothing if `qs` is already up to date.
+     *
+     * @tparam Q Query support structure type.
+     * @param qs Query support structure previously populated from `this`.
+     */
+    template <class Q>
+    void update_query_structure(Q* qs) {
+        if (qs->version() == version_) return;
+        dtype from = 0;
+        dtype ones = 0;
+        if (!root_is_leaf_ && qs->version() == tracked_version_) {
+            dtype index = dirty_from_ < size() ? dirty_from_ : size();
+            index = index > 0 ? index - 1 : 0;
+            from = n_root_->leaf_start(index, ones);
+            if (from > 0) {
+                from = n_root_->leaf_start(from - 1, ones);
+            }
+        }
+        qs->truncate(from, ones, size());
+        if (root_is_leaf_) {
+            [[unlikely]] qs->append(l_root_);
+        } else {
+            n_root_->generate_query_structure(qs, from);
         }
         qs->finalize();
+        qs->version(version_);
+        tracked_version_ = version_;
+        dirty_from_ = ~dtype(0);
     }
 
+    /**
+     * @brief Number of modifications done to `this`.
+     *
+     * Can be used to check if query support structures or cached query
+     * results are out of date.
+     *
+     * @return Modification counter.
+     */
+    uint64_t version() const { return version_; }
+
     /**
      * @brief Create and Populate a query support structure using `this`
      *
      * Creates a new support structure and adds leaves in order.
      *
      * @tparam block_size Size of blocks used in the query support structure.
+     * @tparam flush      Should leaf buffers be flushed.
+     * @tparam packed     Use the cache line packed block layout.
+     * @param threads     Number of threads to use.
      * @return A new query support strucutre.
      */
-    template <uint32_t block_size = 2048, bool flush = false>
-    query_support<dtype, leaf, block_size, flush>* generate_query_structure()
-        const {
+    template <uint32_t block_size = 2048, bool flush = false,
+              bool packed = false>
+    query_support<dtype, leaf, block_size, flush, packed>*
+    generate_query_structure(uint32_t threads = 1) {
         static_assert(block_size * 3 <= leaf_size);
         static_assert(block_size >= 2 * 64);
-        query_support<dtype, leaf, block_size>* qs =
-            new query_support<dtype, leaf, block_size>(size());
-        generate_query_structure(qs);
+        auto* qs =
+            new query_support<dtype, leaf, block_size, flush, packed>(size());
+        generate_query_structure(qs, threads);
         return qs;
     }
 
+    /**
+     * @brief Create a static query support structure over a flat copy of
+     * `this`.
+     *
+     * The bits are dumped into a contiguous array that is indexed for rank
+     * and select. Queries are thus independent of the tree, and `this` can be
+     * modified freely while the copy is in use. Use `update(bv)` on the
+     * returned structure to refresh it after modifications.
+     *
+     * Dumping commits leaf buffers, hence non-const.
+     *
+     * @return A new flat query support structure.
+     */
+    flat_query_support<dtype>* generate_flat_query_structure() {
+        return new flat_query_support<dtype>(this);
+    }
+
     /**
      * @brief Insert "value" into position "index".
      *
@@ -244,6 +1849,8 @@ class bit_vector : uncopyable {
             assert(index <= size());
         }
 #endif
+        modified(index);
+        unshare_insert(index);
         if (root_is_leaf_) {
             if (l_root_->need_realloc()) {
                 dtype cap = l_root_->capacity();
@@ -289,6 +1896,115 @@ class bit_vector : uncopyable {
         }
     }
 
+    /**
+     * @brief Insert a sorted batch of elements.
+     *
+     * Equivalent to calling `insert(pos[i], vals[i])` for
+     * \f$i = 0, \ldots, n - 1\f$ in order, which with strictly increasing
+     * positions means that `pos[i]` is the position of `vals[i]` after the
+     * batch has been inserted.
+     *
+     * The batch is routed down the tree partitioned by child, instead of
+     * doing a separate root to leaf traversal for each element. Each leaf
+     * receives its share of the batch as a single merge pass over the leaf
+     * data, bypassing the leaf buffer. Leaves are split as needed.
+     *
+     * @param pos  Strictly increasing insertion positions.
+     * @param vals Values to insert.
+     * @param n    Number of elements in the batch.
+     */
+    void insert_batch(const dtype* pos, const bool* vals, size_t n) {
+#ifdef DEBUG
+        for (size_t i = 0; i < n; i++) {
+            if ((i > 0 && pos[i] <= pos[i - 1]) || pos[i] > size() + i) {
+                std::cerr << "Invalid batch insertion to index " << pos[i]
+                          << " at batch position " << i << " for " << size()
+                          << " element bit vector." << std::endl;
+                assert(i == 0 || pos[i] > pos[i - 1]);
+                assert(pos[i] <= size() + i);
+            }
+        }
+#endif
+        if (n > 0) {
+            modified(pos[0]);
+        }
+        if (shared()) {
+            // Element i goes between elements pos[i] - i - 1 and pos[i] - i
+            // of the current tree. Only the paths to the insertion points are
+            // copied, not everything between the first and last one.
+            for (size_t i = 0; i < n; i++) {
+                unshare_insert(pos[i] - i);
+            }
+        }
+        size_t done = 0;
+        while (root_is_leaf_ && done < n) {
+            size_t count = l_root_->size() < leaf_size
+                               ? leaf_size - l_root_->size()
+                               : 0;
+            count = count < n - done ? count : n - done;
+            if constexpr (compressed) {
+                if (l_root_->is_compressed()) count = 0;
+            }
+            if (count <= 1) {
+                insert(pos[done], vals[done]);
+                done++;
+                continue;
+            }
+            dtype n_size = l_root_->size() + count;
+            dtype cap = l_root_->capacity();
+            if (cap * WORD_BITS < n_size) {
+                dtype n_cap = build_capacity(n_size);
+                l_root_ = allocator_->reallocate_leaf(l_root_, cap, n_cap);
+            }
+            l_root_->insert_batch(pos + done, vals + done, count, dtype(0));
+            done += count;
+        }
+        while (done < n) {
+            if (n_root_->child_count() == branches) {
+                [[unlikely]] split_root();
+            }
+            done += n_root_->insert_batch(pos + done, vals + done, n - done,
+                                          dtype(0), allocator_);
+        }
+    }
+
+    /**
+     * @brief Insert "nbits" bits from a packed word array at "index".
+     *
+     * Equivalent to calling `insert(index + i, bit i of bits)` for
+     * \f$i = 0, \ldots, \mathrm{nbits} - 1\f$, with bits read in the same
+     * order as produced by `dump`.
+     *
+     * Bits are spliced into the target leaf a word at a time if they fit.
+     * Larger ranges are written to new full leaves that are added to the tree
+     * directly, so the cost is linear in the number of new words in addition
+     * to a root to leaf traversal per new leaf.
+     *
+     * For compressed bit vectors the bits are inserted one at a time.
+     *
+     * @param index Location of the first inserted bit.
+     * @param bits  Packed bits to insert.
+     * @param nbits Number of bits to insert.
+     */
+    void insert_range(dtype index, const uint64_t* bits, dtype nbits) {
+        splice(index, bits, false, nbits);
+    }
+
+    /**
+     * @brief Insert "len" copies of "v" at "index".
+     *
+     * Works like `insert_range`, with whole words written at a time. For
+     * compressed bit vectors, a run inserted into a run-length encoded leaf is
+     * merged into the encoding as a single run.
+     *
+     * @param index Location of the first inserted bit.
+     * @param v     Value to insert.
+     * @param len   Number of bits to insert.
+     */
+    void insert_run(dtype index, bool v, dtype len) {
+        splice(index, nullptr, v, len);
+    }
+
     /**
      * @brief Remove element at "index".
      *
@@ -312,6 +2028,8 @@ class bit_vector : uncopyable {
      * @return Value of the removed bit.
      */
     bool remove(dtype index) {
+        modified(index);
+        unshare(index, index);
         if (root_is_leaf_) {
             [[unlikely]] return l_root_->remove(index);
         } else {
@@ -332,6 +2050,118 @@ class bit_vector : uncopyable {
         }
     }
 
+    /**
+     * @brief Remove a sorted batch of elements.
+     *
+     * Positions refer to the bit vector before any of the removals, and need
+     * to be strictly increasing.
+     *
+     * The batch is routed down the tree partitioned by child. Each leaf
+     * compacts its share of the batch in a single pass, after which each
+     * affected node merges or rebalances its underfull children once. Tree
+     * height is decreased as appropriate.
+     *
+     * Run-length encoded leaves of hybrid compressed bit vectors remove their
+     * share of the batch one element at a time, since they do not support
+     * batch compaction.
+     *
+     * @param pos Strictly increasing removal positions.
+     * @param n   Number of elements in the batch.
+     */
+    void remove_batch(const dtype* pos, size_t n) {
+#ifdef DEBUG
+        for (size_t i = 0; i < n; i++) {
+            if ((i > 0 && pos[i] <= pos[i - 1]) || pos[i] >= size()) {
+                std::cerr << "Invalid batch removal from index " << pos[i]
+                          << " at batch position " << i << " for " << size()
+                          << " element bit vector." << std::endl;
+                assert(i == 0 || pos[i] > pos[i - 1]);
+                assert(pos[i] < size());
+            }
+        }
+#endif
+        if (n > 0) {
+            modified(pos[0]);
+        }
+        if (shared()) {
+            // Only the paths to the removed elements are copied, not
+            // everything between the first and last one.
+            for (size_t i = 0; i < n; i++) {
+                unshare(pos[i], pos[i]);
+            }
+        }
+        if (n == 0) return;
+        if (root_is_leaf_) {
+            [[unlikely]] l_root_->remove_batch(pos, n, dtype(0));
+            return;
+        }
+        n_root_->remove_batch(pos, n, dtype(0), allocator_);
+        while (n_root_->child_count() == 1) {
+            if (n_root_->has_leaves()) {
+                l_root_ = reinterpret_cast<leaf*>(n_root_->child(0));
+                root_is_leaf_ = true;
+                allocator_->deallocate_node(n_root_);
+                [[unlikely]] return;
+            }
+            node* new_root = reinterpret_cast<node*>(n_root_->child(0));
+            allocator_->deallocate_node(n_root_);
+            n_root_ = new_root;
+        }
+    }
+
+    /**
+     * @brief Remove the elements in the range \f$[a, b)\f$.
+     *
+     * Leaves and subtrees fully covered by the range are deallocated directly,
+     * and the at most two partially covered leaves are compacted with word
+     * shifts. Cumulative sizes and sums, as well as underfull nodes, are only
+     * fixed along the two boundary paths of the range. The runtime is thus
+     * \f$\mathcal{O}(\log n)\f$ in addition to the number of leaves freed.
+     *
+     * Run-length encoded boundary leaves of hybrid compressed bit vectors have
+     * the runs covering the range cut out of their encoding.
+     *
+     * @param a Start of range to remove.
+     * @param b End of range to remove.
+     */
+    void remove_range(dtype a, dtype b) {
+#ifdef DEBUG
+        if (a > b || b > size()) {
+            std::cerr << "Invalid range removal [" << a << ", " << b
+                      << ") for " << size() << " element bit vector."
+                      << std::endl;
+            assert(a <= b && b <= size());
+        }
+#endif
+        modified(a);
+        unshare(a, a);
+        unshare(b, b);
+        if (a >= b) return;
+        if (root_is_leaf_) {
+            [[unlikely]] l_root_->remove_range(a, b);
+            return;
+        }
+        if (a == 0 && b == size()) {
+            n_root_->deallocate(allocator_);
+            allocator_->deallocate_node(n_root_);
+            l_root_ = allocator_->template allocate_leaf<leaf>(2);
+            root_is_leaf_ = true;
+            [[unlikely]] return;
+        }
+        n_root_->remove_range(a, b, allocator_);
+        while (n_root_->child_count() == 1) {
+            if (n_root_->has_leaves()) {
+                l_root_ = reinterpret_cast<leaf*>(n_root_->child(0));
+                root_is_leaf_ = true;
+                allocator_->deallocate_node(n_root_);
+                [[unlikely]] return;
+            }
+            node* new_root = reinterpret_cast<node*>(n_root_->child(0));
+            allocator_->deallocate_node(n_root_);
+            n_root_ = new_root;
+        }
+    }
+
     /**
      * @brief Number of 1-bits in the data structure.
      *
@@ -396,6 +2226,81 @@ class bit_vector : uncopyable {
     dtype rank(dtype index) const {
         return !root_is_leaf_ ? n_root_->rank(index) : l_root_->rank(index);
     }
+
+    /**
+     * @brief Number of 1-bits in the \f$[a, b)\f$ range.
+     *
+     * Equivalent to `rank(b) - rank(a)`, but only descends once to the lowest
+     * node containing the whole range. Fully covered subtrees are summed using
+     * the cumulative sums in that node, and only the leaves at the range
+     * boundaries are population counted.
+     *
+     * @param a Start of range.
+     * @param b End of range.
+     *
+     * @return \f$\sum_{i = a}^{b - 1} \mathrm{bv}[i]\f$.
+     */
+    dtype count(dtype a, dtype b) const {
+#ifdef DEBUG
+        if (a > b || b > size()) {
+            std::cerr << "Invalid count range [" << a << ", " << b << ") for "
+                      << size() << " element bit vector." << std::endl;
+            assert(a <= b && b <= size());
+        }
+#endif
+        if (a >= b) {
+            [[unlikely]] return 0;
+        }
+        return !root_is_leaf_ ? n_root_->count(a, b) : l_root_->rank(b, a);
+    }
+
+    /**
+     * @brief Position of the first 1-bit at or after index `i`.
+     *
+     * Equivalent to `select(rank(i) + 1)`, but done with a single descent.
+     * The leaf containing `i` is scanned a word at a time from `i` onward and
+     * subtrees without 1-bits are skipped based on cumulative sums.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype next_one(dtype i) const { return next_bit<true>(i); }
+
+    /**
+     * @brief Position of the last 1-bit at or before index `i`.
+     *
+     * See `next_one`.
+     *
+     * @param i Start position of the search. Values past the end are treated
+     *          as `size() - 1`.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype prev_one(dtype i) const { return prev_bit<true>(i); }
+
+    /**
+     * @brief Position of the first 0-bit at or after index `i`.
+     *
+     * See `next_one`.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype next_zero(dtype i) const { return next_bit<false>(i); }
+
+    /**
+     * @brief Position of the last 0-bit at or before index `i`.
+     *
+     * See `next_one`.
+     *
+     * @param i Start position of the search. Values past the end are treated
+     *          as `size() - 1`.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype prev_zero(dtype i) const { return prev_bit<false>(i); }
     dtype rank0(dtype index) const {
         if (index == 0) {
             [[unlikely]] return 0;
@@ -445,6 +2350,51 @@ class bit_vector : uncopyable {
         return v ? select(count) : select0(count);
     }
 
+    /**
+     * @brief Batched access queries.
+     *
+     * Equivalent to `out[i] = at(idx[i])` for each \f$i \in [0..n)\f$, but
+     * descends the tree for several queries in lock-step to overlap cache
+     * misses. Queries do not need to be sorted.
+     *
+     * @param idx Indexes to access.
+     * @param out Array of at least `n` elements for storing results.
+     * @param n   Number of queries.
+     */
+    void at_batch(const dtype* idx, bool* out, size_t n) const {
+        query_batch<query_kind::access>(idx, out, n);
+    }
+
+    /**
+     * @brief Batched rank queries.
+     *
+     * Equivalent to `out[i] = rank(idx[i])` for each \f$i \in [0..n)\f$,
+     * but descends the tree for several queries in lock-step to overlap cache
+     * misses. Queries do not need to be sorted.
+     *
+     * @param idx Rank query arguments.
+     * @param out Array of at least `n` elements for storing results.
+     * @param n   Number of queries.
+     */
+    void rank_batch(const dtype* idx, dtype* out, size_t n) const {
+        query_batch<query_kind::rank>(idx, out, n);
+    }
+
+    /**
+     * @brief Batched select queries.
+     *
+     * Equivalent to `out[i] = select(counts[i])` for each \f$i \in
+     * [0..n)\f$, but descends the tree for several queries in lock-step to
+     * overlap cache misses. Queries do not need to be sorted.
+     *
+     * @param counts Select query arguments.
+     * @param out    Array of at least `n` elements for storing results.
+     * @param n      Number of queries.
+     */
+    void select_batch(const dtype* counts, dtype* out, size_t n) const {
+        query_batch<query_kind::select>(counts, out, n);
+    }
+
 
     /**
      * @brief Sets the bit at "index" to "value".
@@ -459,6 +2409,8 @@ class bit_vector : uncopyable {
      * @param value value to set the index<sup>th</sup> bit to.
      */
     void set(dtype index, bool value) {
+        modified(index);
+        unshare(index, index);
         if (root_is_leaf_) {
             if constexpr (compressed) {
                 if (l_root_->is_compressed() && l_root_->need_realloc()) {
@@ -490,14 +2442,104 @@ class bit_vector : uncopyable {
         }
     }
 
+    /**
+     * @brief Sets the elements in the range \f$[a, b)\f$ to "value".
+     *
+     * Leaves are modified a 64-bit word at a time, or a run at a time for
+     * run-length encoded leaves, and partial sums are updated once per
+     * touched leaf or node instead of once per element.
+     *
+     * @param a     Start of range.
+     * @param b     End of range.
+     * @param value Value to set elements to.
+     */
+    void set_range(dtype a, dtype b, bool value) {
+        update_range<false>(a, b, value);
+    }
+
+    /**
+     * @brief Inverts the elements in the range \f$[a, b)\f$.
+     *
+     * Works like `set_range`.
+     *
+     * @param a Start of range.
+     * @param b End of range.
+     */
+    void flip_range(dtype a, dtype b) { update_range<true>(a, b, false); }
+
     /**
      * @brief Recursively flushes all buffers in the data structure.
      *
      * If execution transitions to a phase where no insertions or removals are
      * expected, flushing all buffers should improve query time at the cost of a
      * fairly expensive flushing operations.
+     *
+     * Only leaves with buffered elements, and the nodes leading to them, are
+     * copied if shared with snapshots. Copying is recorded as a modification
+     * from the first copied leaf onward, since query support structures
+     * refer to leaves directly.
+     */
+    void flush() {
+        if (!shared()) {
+            root_is_leaf_ ? l_root_->flush() : n_root_->flush();
+            [[likely]] return;
+        }
+        if (root_is_leaf_ ? !l_root_->need_flush() : !n_root_->need_flush()) {
+            return;
+        }
+        unshare_root();
+        if (root_is_leaf_) {
+            l_root_->flush();
+            modified(0);
+            [[unlikely]] return;
+        }
+        modified(n_root_->flush(allocator_));
+    }
+
+    /**
+     * @brief Flushes the buffer of the leaf containing position `index`.
+     *
+     * Only the path to the leaf is visited, and copied if shared with
+     * snapshots, so the cost is proportional to the height of the tree. Out
+     * of bounds positions are ignored.
+     *
+     * @param index Position of an element in the leaf to flush.
+     */
+    void flush(dtype index) {
+        if (index >= size()) return;
+        if (root_is_leaf_) {
+            if (!l_root_->need_flush()) return;
+            if (shared()) {
+                unshare_root();
+                modified(0);
+            }
+            l_root_->flush();
+            [[unlikely]] return;
+        }
+        if (!n_root_->leaf_need_flush(index)) return;
+        if (shared()) {
+            unshare(index, index);
+            modified(index);
+        }
+        n_root_->flush_leaf(index);
+    }
+
+    /**
+     * @brief Commit all leaf buffers before a read-only phase.
+     *
+     * Const queries never modify the data structure, and are thus safe to
+     * run concurrently from multiple threads as long as there are no
+     * concurrent modifications. Queries on buffered leaves need to account
+     * for the buffer contents on every access however, so committing the
+     * buffers up front makes subsequent queries faster.
+     *
+     * Generating or updating query support structures records which
+     * positions have been modified, so those calls are not const and must
+     * not run concurrently with queries or with each other.
+     *
+     * Equivalent to `flush`.
      */
-    void flush() { root_is_leaf_ ? l_root_->flush() : n_root_->flush(); }
+    void freeze() { flush(); }
 
     /**
      * @brief Write raw bit data to the area provided.
@@ -505,9 +2547,12 @@ class bit_vector : uncopyable {
      * The are provided should have at least bv.size() allocated and zeroed
      * out bits.
      *
+     * Buffers are committed with `flush` first.
+     *
      * @param data Pointer to where raw data should be dumped.
      */
     void dump(uint64_t* data) {
+        flush();
         if (root_is_leaf_) {
             l_root_->dump(data, 0);
         } else {
@@ -515,6 +2560,158 @@ class bit_vector : uncopyable {
         }
     }
 
+    /**
+     * @brief Write the bit vector to `out` in binary form.
+     *
+     * A header with a format version and the template parameters is written,
+     * followed by the tree in pre-order in a single sequential pass. Leaf
+     * buffers are written as is, so `this` is not modified.
+     *
+     * @param out Stream to write to.
+     */
+    void serialize(std::ostream& out) const {
+        write_raw(out, SERIAL_MAGIC, sizeof(SERIAL_MAGIC));
+        uint32_t header[] = {SERIAL_FORMAT_VERSION, leaf_size, branches,
+                             sizeof(dtype), compressed, sizeof(leaf),
+                             sizeof(node)};
+        write_raw(out, header, sizeof(header) / sizeof(uint32_t));
+        write_raw(out, &root_is_leaf_);
+        if (root_is_leaf_) {
+            l_root_->serialize(out);
+        } else {
+            n_root_->serialize(out);
+        }
+    }
+
+    /**
+     * @brief Write the bit vector to the file at `path`.
+     *
+     * @return False if the file could not be written.
+     */
+    bool serialize(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        serialize(out);
+        out.close();
+        return bool(out);
+    }
+
+    /**
+     * @brief Write the bit vector to `out` in the layout read by
+     * bv::mapped_bit_vector.
+     *
+     * The tree is written bottom-up, so the header is rewritten at the end
+     * with the offset of the root, and `out` needs to be seekable. Leaf
+     * contents are written as plain bits, with buffers applied and run-length
+     * encoding decoded, without modifying `this`.
+     *
+     * @param out Seekable stream to write to.
+     */
+    void serialize_mapped(std::ostream& out) const {
+        mapped_header header = {};
+        memcpy(header.magic, mapped_header::MAGIC, sizeof(header.magic));
+        header.version = MAPPED_FORMAT_VERSION;
+        header.branches = branches;
+        header.dtype_bytes = sizeof(dtype);
+        header.root_is_leaf = root_is_leaf_;
+        header.size = size();
+        header.sum = sum();
+        std::streampos start = out.tellp();
+        write_raw(out, &header);
+        uint64_t pos = sizeof(header);
+        if (root_is_leaf_) {
+            header.root = write_mapped_leaf(out, pos, l_root_);
+        } else {
+            header.root = n_root_->serialize_mapped(out, pos);
+        }
+        out.seekp(start);
+        write_raw(out, &header);
+        out.seekp(0, std::ios::end);
+    }
+
+    /**
+     * @brief Write the bit vector to the file at `path` for use with
+     * bv::mapped_bit_vector.
+     *
+     * @return False if the file could not be written.
+     */
+    bool serialize_mapped(const std::string& path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        serialize_mapped(out);
+        out.close();
+        return bool(out);
+    }
+
+    /**
+     * @brief Replace the contents of `this` with a bit vector read from `in`.
+     *
+     * Reads a bit vector written by `serialize`. The header is checked before
+     * anything else is read, so a stream written with a different format
+     * version or different template parameters is rejected immediately.
+     *
+     * If loading fails `this` is left unchanged. Query support structures
+     * generated for `this` become outdated on success.
+     *
+     * @param in Stream to read from.
+     *
+     * @return False if the header did not match or the stream ended early.
+     */
+    bool load(std::istream& in) {
+        char magic[sizeof(SERIAL_MAGIC)];
+        uint32_t header[7];
+        uint32_t expected[] = {SERIAL_FORMAT_VERSION, leaf_size, branches,
+                               sizeof(dtype), compressed, sizeof(leaf),
+                               sizeof(node)};
+        if (!read_raw(in, magic, sizeof(magic)) ||
+            memcmp(magic, SERIAL_MAGIC, sizeof(magic)) != 0) {
+            std::cerr << "Not a serialized bit vector" << std::endl;
+            [[unlikely]] return false;
+        }
+        if (!read_raw(in, header, 7) ||
+            memcmp(header, expected, sizeof(header)) != 0) {
+            std::cerr << "Serialized bit vector format or template parameters "
+                         "do not match"
+                      << std::endl;
+            [[unlikely]] return false;
+        }
+        bool is_leaf;
+        if (!read_raw(in, &is_leaf)) {
+            [[unlikely]] return false;
+        }
+        leaf* l = nullptr;
+        node* n = nullptr;
+        if (is_leaf) {
+            l = leaf::load(in, allocator_);
+            if (l == nullptr) {
+                [[unlikely]] return false;
+            }
+        } else {
+            n = allocator_->template allocate_node<node>();
+            if (!n->load(in, allocator_)) {
+                n->deallocate(allocator_);
+                allocator_->deallocate_node(n);
+                [[unlikely]] return false;
+            }
+        }
+        release_root();
+        root_is_leaf_ = is_leaf;
+        l_root_ = l;
+        n_root_ = n;
+        modified(0);
+        return true;
+    }
+
+    /**
+     * @brief Replace the contents of `this` with the bit vector stored in
+     * the file at `path`.
+     *
+     * @return False if the file could not be read or did not contain a
+     * matching bit vector.
+     */
+    bool load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return in && load(in);
+    }
+
     /**
      * @brief Total size of data structure allocations in bits.
      *
@@ -548,7 +2745,7 @@ class bit_vector : uncopyable {
      */
     void validate() const {
 #ifndef NDEBUG
-        if (owned_allocator_) {
+        if (owned_allocator_ && !shared()) {
             uint64_t allocs = allocator_->live_allocations();
             if (root_is_leaf_) {
                 assert(allocs == l_root_->validate());
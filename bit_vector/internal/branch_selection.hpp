@@ -246,6 +246,19 @@ class branchless_scan : uncopyable {
         }
     }
 
+    /**
+     * @brief Issue prefetches for all cache lines of the cumulative sums.
+     *
+     * Used by `find` and by batched queries that want to start loading the
+     * sums of several nodes before any of them are searched.
+     */
+    void prefetch() const {
+        constexpr dtype lines = CACHE_LINE / sizeof(dtype);
+        for (dtype i = 0; i < branches; i += lines) {
+            __builtin_prefetch(elems_ + i);
+        }
+    }
+
     /**
      * @brief Find the lowest child index s.t. the cumulative sum at the index
      * is at least q.
@@ -278,10 +291,7 @@ class branchless_scan : uncopyable {
     uint8_t find(dtype q) const {
         constexpr dtype SIGN_BIT = ~((~dtype(0)) >> 1);
         constexpr dtype num_bits = sizeof(dtype) * 8;
-        constexpr dtype lines = CACHE_LINE / sizeof(dtype);
-        for (dtype i = 0; i < branches; i += lines) {
-            __builtin_prefetch(elems_ + i);
-        }
+        prefetch();
         uint8_t idx;
         if constexpr (branches == 128) {
             idx = (uint8_t(1) << 6) - 1;
@@ -27,11 +27,11 @@ class buffer {
     };
     class buffer_iter {
        private:
-        buffer* buf;
+        const buffer* buf;
         uint8_t offset;
 
        public:
-        buffer_iter(buffer* buf_ref, uint8_t pos) {
+        buffer_iter(const buffer* buf_ref, uint8_t pos) {
             buf = buf_ref;
             offset = pos;
         }
@@ -65,7 +65,13 @@ class buffer {
         std::memcpy(this, &other, sizeof(buffer));
     }
 
-    void sort() {
+    void sort() { sort(scratch); }
+
+    /**
+     * @brief Sort the buffer using `scratch_area` of `buffer_size` elements
+     * as temporary storage.
+     */
+    void sort(uint32_t* scratch_area) {
         if constexpr (sorted) {
             return;
         }
@@ -82,7 +88,22 @@ class buffer {
         if constexpr (buffer_size == 4) {
             return foursort(buffer_);
         }
-        sort<buffer_size>(scratch, buffer_);
+        sort<buffer_size>(scratch_area, buffer_);
+    }
+
+    /**
+     * @brief Copy of the buffer with elements in sorted order.
+     *
+     * Unlike `begin`, this does not modify the buffer, and is thus safe for
+     * concurrent readers.
+     */
+    buffer sorted_copy() const {
+        buffer ret(*this);
+        if constexpr (!sorted) {
+            uint32_t scratch_area[buffer_size];
+            ret.sort(scratch_area);
+        }
+        return ret;
     }
 
     bool is_full() const { return buffer_elems_ == buffer_size; }
@@ -215,7 +236,7 @@ class buffer {
                 assoc_val(buffer_[i])};
     }
 
-    uint8_t size() { return buffer_elems_; }
+    uint8_t size() const { return buffer_elems_; }
 
     buffer_iter begin() {
         if constexpr (!sorted) {
@@ -0,0 +1,275 @@
+#ifndef BV_CONCURRENT_BIT_VECTOR_HPP
+#define BV_CONCURRENT_BIT_VECTOR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "uncopyable.hpp"
+
+namespace bv {
+
+/**
+ * @brief Thread safe front end for a bv::bit_vector with any number of
+ * concurrent readers and batched writes.
+ *
+ * Modifications are queued by `insert`, `remove` and `set`, and applied to
+ * the underlying bit vector in batches by `apply`. After each batch, the
+ * buffers of the leaves touched by the batch are committed and a
+ * copy-on-write snapshot of the bit vector is published. Queries are
+ * answered from the most recently published snapshot and thus never block
+ * on, or observe partially applied, modifications.
+ *
+ * Published snapshots act as epochs: `reader` pins the current snapshot, so
+ * that a sequence of queries is answered from a consistent state, and a
+ * snapshot is reclaimed once the last reader holding it lets go. Since the
+ * snapshot shares all unmodified nodes and leaves with the live bit vector,
+ * applying a batch only copies the nodes and leaves on the root to leaf
+ * paths of the modified positions, along with their immediate siblings
+ * that rebalancing may touch.
+ *
+ * Runs of queued insertions at increasing positions, and of removals at
+ * non-decreasing positions, are applied with `insert_batch` and
+ * `remove_batch` respectively. Leaf buffers are committed before
+ * publishing, so that queries on published snapshots do not need to account
+ * for buffered elements. Only the leaves at the modified positions are
+ * visited, so applying a batch costs time proportional to the tree height
+ * times the batch size, independent of the number of leaves.
+ *
+ * Queued positions are interpreted in order, i.e. each operation sees the
+ * bit vector with all previously queued operations applied. Queued
+ * operations become visible to queries once `apply` returns.
+ *
+ * Usage example:
+ * ```
+ * bv::concurrent_bv cbv;
+ * // Writer thread
+ * cbv.insert(0, true);
+ * cbv.insert(1, false);
+ * cbv.apply();
+ * // Reader threads
+ * auto snapshot = cbv.reader();
+ * uint64_t ones = snapshot->rank(snapshot->size());
+ * ```
+ *
+ * @tparam bit_vector Type of the underlying bv::bit_vector.
+ * @tparam dtype      Integer type used for indexing by `bit_vector`.
+ */
+template <class bit_vector, class dtype>
+class concurrent_bit_vector : uncopyable {
+   private:
+    /** @brief Types of queued modifications. */
+    enum class op_type : uint8_t { insert, remove, set };
+
+    /** @brief Queued modification. */
+    struct op {
+        dtype index;
+        op_type type;
+        bool value;
+    };
+
+    bit_vector* bv_;  ///< Live bit vector. Only accessed by `apply`.
+    std::atomic<std::shared_ptr<const bit_vector>> published_;  ///< Latest
+                                                                ///< snapshot.
+    std::mutex queue_mutex_;  ///< Protects `queue_`.
+    std::vector<op> queue_;   ///< Modifications waiting for `apply`.
+    std::mutex write_mutex_;  ///< Serializes `apply` calls.
+    std::vector<op> batch_;   ///< Modifications being applied.
+    std::vector<dtype> pos_;  ///< Positions of the run being applied.
+    std::unique_ptr<bool[]> vals_;  ///< Values of the run being applied.
+    size_t vals_capacity_ = 0;      ///< Allocated length of `vals_`.
+
+    /**
+     * @brief End of the run of `batch_` starting at `i` that can be applied
+     * with a single batch operation.
+     *
+     * Insertions need strictly increasing positions. Removals need
+     * non-decreasing positions, since each removal shifts the later elements
+     * back by one. Other operations form runs of length one.
+     */
+    size_t run_end(size_t i) const {
+        op_type type = batch_[i].type;
+        size_t j = i + 1;
+        if (type == op_type::insert) {
+            while (j < batch_.size() && batch_[j].type == type &&
+                   batch_[j].index > batch_[j - 1].index) {
+                j++;
+            }
+        } else if (type == op_type::remove) {
+            while (j < batch_.size() && batch_[j].type == type &&
+                   batch_[j].index >= batch_[j - 1].index) {
+                j++;
+            }
+        }
+        return j;
+    }
+
+    /**
+     * @brief Apply the run `batch_[i, j)` and commit the buffers of the
+     * leaves it touched.
+     */
+    void apply_run(size_t i, size_t j) {
+        size_t n = j - i;
+        switch (batch_[i].type) {
+            case op_type::insert:
+                if (n > vals_capacity_) {
+                    vals_.reset(new bool[n]);
+                    vals_capacity_ = n;
+                }
+                pos_.clear();
+                for (size_t k = 0; k < n; k++) {
+                    pos_.push_back(batch_[i + k].index);
+                    vals_[k] = batch_[i + k].value;
+                }
+                bv_->insert_batch(pos_.data(), vals_.get(), n);
+                for (size_t k = 0; k < n; k++) {
+                    bv_->flush(pos_[k]);
+                }
+                break;
+            case op_type::remove:
+                // Removal k of the run is at position index + k before the
+                // run, and leaves a gap between index - 1 and index after.
+                pos_.clear();
+                for (size_t k = 0; k < n; k++) {
+                    pos_.push_back(batch_[i + k].index + k);
+                }
+                bv_->remove_batch(pos_.data(), n);
+                for (size_t k = 0; k < n; k++) {
+                    dtype index = batch_[i + k].index;
+                    if (index > 0) bv_->flush(index - 1);
+                    bv_->flush(index);
+                }
+                break;
+            default:
+                bv_->set(batch_[i].index, batch_[i].value);
+                bv_->flush(batch_[i].index);
+        }
+    }
+
+    /**
+     * @brief Publish a snapshot of the current state.
+     */
+    void publish() {
+        published_.store(std::shared_ptr<const bit_vector>(bv_->snapshot()),
+                         std::memory_order_release);
+    }
+
+   public:
+    /**
+     * @brief Wrap an existing bit vector.
+     *
+     * The wrapper takes ownership of `bv`, which should not be accessed
+     * directly afterwards.
+     */
+    concurrent_bit_vector(bit_vector* bv) : bv_(bv) {
+        bv_->flush();
+        publish();
+    }
+
+    /**
+     * @brief Create an empty bit vector with an owned allocator.
+     */
+    concurrent_bit_vector() : concurrent_bit_vector(new bit_vector()) {}
+
+    /**
+     * @brief Deallocates the live bit vector.
+     *
+     * Snapshots returned by `reader` remain valid until released.
+     */
+    ~concurrent_bit_vector() {
+        published_.store(nullptr);
+        delete (bv_);
+    }
+
+    /**
+     * @brief Queue insertion of `value` at position `index`.
+     */
+    void insert(dtype index, bool value) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queue_.push_back({index, op_type::insert, value});
+    }
+
+    /**
+     * @brief Queue removal of the element at position `index`.
+     */
+    void remove(dtype index) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queue_.push_back({index, op_type::remove, false});
+    }
+
+    /**
+     * @brief Queue setting the element at position `index` to `value`.
+     */
+    void set(dtype index, bool value) {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        queue_.push_back({index, op_type::set, value});
+    }
+
+    /**
+     * @brief Number of queued modifications not yet applied.
+     */
+    size_t pending() {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        return queue_.size();
+    }
+
+    /**
+     * @brief Apply all queued modifications and publish the result.
+     *
+     * Modifications queued concurrently with `apply` are left for the next
+     * call. Concurrent calls are serialized.
+     *
+     * @return Number of modifications applied.
+     */
+    size_t apply() {
+        std::lock_guard<std::mutex> write_lock(write_mutex_);
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex_);
+            batch_.swap(queue_);
+        }
+        if (batch_.size() == 0) {
+            [[unlikely]] return 0;
+        }
+        for (size_t i = 0; i < batch_.size();) {
+            size_t j = run_end(i);
+            apply_run(i, j);
+            i = j;
+        }
+        publish();
+        size_t n = batch_.size();
+        batch_.clear();
+        return n;
+    }
+
+    /**
+     * @brief Pin the most recently published snapshot.
+     *
+     * All queries on the returned snapshot are answered from the same state,
+     * regardless of batches applied in the meantime. Only the const query
+     * interface may be used.
+     */
+    std::shared_ptr<const bit_vector> reader() const {
+        return published_.load(std::memory_order_acquire);
+    }
+
+    /** @brief Number of bits in the latest published state. */
+    dtype size() const { return reader()->size(); }
+
+    /** @brief Number of 1-bits in the latest published state. */
+    dtype sum() const { return reader()->sum(); }
+
+    /** @brief Value of the bit at position `index`. */
+    bool at(dtype index) const { return reader()->at(index); }
+
+    /** @brief Number of 1-bits before position `index`. */
+    dtype rank(dtype index) const { return reader()->rank(index); }
+
+    /** @brief Position of the `count`<sup>th</sup> 1-bit. */
+    dtype select(dtype count) const { return reader()->select(count); }
+};
+
+}  // namespace bv
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef BV_FLAT_QUERY_SUPPORT_HPP
+#define BV_FLAT_QUERY_SUPPORT_HPP
+
+#include <immintrin.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "uncopyable.hpp"
+
+namespace bv {
+
+/**
+ * @brief Static query support over a flat copy of a bv::bit_vector.
+ *
+ * The bit vector is dumped into a contiguous word array, over which a rank9
+ * style index is built: for every 512-bit block an absolute 1-bit count and
+ * seven packed 9-bit counts relative to the block start. Select queries are
+ * sped up by storing the block index of every `SAMPLE_RATE`<sup>th</sup>
+ * 1-bit and 0-bit, followed by a binary search over the blocks between
+ * samples.
+ *
+ * Unlike bv::query_support, queries never touch the leaves of the bit vector,
+ * so query time does not depend on leaf buffers or leaf types, at the cost of
+ * an \f$\mathcal{O}(n)\f$ copy. The bit vector remains usable, and the
+ * structure can be brought back up to date with `update(bv)` after
+ * modifications. Querying an outdated structure gives results for the bit
+ * vector at the time of the latest update.
+ *
+ * @tparam dtype Integer type to use for indexing (uint32_t or uint64_t).
+ */
+template <class dtype>
+class flat_query_support : uncopyable {
+   private:
+    static const constexpr uint64_t WORD_BITS = 64;
+    static const constexpr uint64_t BLOCK_BITS = 512;
+    static const constexpr uint64_t BLOCK_WORDS = BLOCK_BITS / WORD_BITS;
+    /** @brief Number of 1-bits or 0-bits between select samples. */
+    static const constexpr dtype SAMPLE_RATE = 8192;
+
+    uint64_t* data_;     ///< Raw bits. Each block is zero padded to 512 bits.
+    uint64_t* counts_;   ///< Absolute and packed relative counts per block.
+    dtype* samples_[2];  ///< Block indexes for 0-bit and 1-bit samples.
+    dtype size_;
+    dtype sum_;
+    dtype n_blocks_;
+    uint64_t version_;  ///< Version of the bit vector at latest update.
+
+   public:
+    /**
+     * @brief Create an empty support structure.
+     *
+     * Needs to be populated with `update(bv)` before querying.
+     */
+    flat_query_support()
+        : data_(nullptr),
+          counts_(nullptr),
+          samples_{nullptr, nullptr},
+          size_(0),
+          sum_(0),
+          n_blocks_(0),
+          version_(~uint64_t(0)) {}
+
+    /**
+     * @brief Create a support structure populated from `bv`.
+     *
+     * @tparam bit_vector Some kind of bv::bit_vector.
+     * @param bv          Pointer to the bv::bit_vector source of the structure.
+     */
+    template <class bit_vector>
+    flat_query_support(bit_vector* bv) : flat_query_support() {
+        update(bv);
+    }
+
+    ~flat_query_support() {
+        free(data_);
+        free(counts_);
+        free(samples_[0]);
+        free(samples_[1]);
+    }
+
+    /**
+     * @brief Bring the structure up to date with `bv`.
+     *
+     * Does nothing if the structure is already up to date. Otherwise all bits
+     * are dumped from `bv` and the index is rebuilt. Dumping commits leaf
+     * buffers, but does not otherwise modify `bv`.
+     *
+     * @tparam bit_vector Some kind of bv::bit_vector.
+     * @param bv          Pointer to the bv::bit_vector source of the structure.
+     */
+    template <class bit_vector>
+    void update(bit_vector* bv) {
+        if (version_ == bv->version()) return;
+        dtype blocks = bv->size() / BLOCK_BITS + 1;
+        if (blocks != n_blocks_) {
+            n_blocks_ = blocks;
+            data_ = (uint64_t*)realloc(
+                data_, sizeof(uint64_t) * BLOCK_WORDS * n_blocks_);
+            counts_ =
+                (uint64_t*)realloc(counts_, sizeof(uint64_t) * 2 * n_blocks_);
+        }
+        memset(data_, 0, sizeof(uint64_t) * BLOCK_WORDS * n_blocks_);
+        bv->dump(data_);
+        size_ = bv->size();
+        finalize();
+        assert(sum_ == bv->sum());
+        version_ = bv->version();
+    }
+
+    /**
+     * @brief Version of the underlying bit vector at the latest update.
+     */
+    uint64_t version() const { return version_; }
+
+    /**
+     * @brief Number of bits stored in the bit vector.
+     */
+    dtype size() const { return size_; }
+
+    /**
+     * @brief Number of 1-bits stored in the bit vector.
+     */
+    dtype p_sum() const { return sum_; }
+
+    /**
+     * @brief Return value of bit at index \f$i\f$.
+     */
+    bool at(dtype i) const {
+        return (data_[i / WORD_BITS] >> (i % WORD_BITS)) & uint64_t(1);
+    }
+
+    /**
+     * @brief Number of 1-bits up to position \f$i\f$.
+     *
+     * Sum of the absolute block count, a packed relative count and the
+     * population count of a single partial word.
+     *
+     * @param i Number of elements to include in the "summation".
+     * @return \f$\sum_{i = 0}^{i - 1} \mathrm{bv}[i]\f$.
+     */
+    dtype rank(dtype i) const {
+        dtype b = i / BLOCK_BITS;
+        dtype w = i / WORD_BITS;
+        uint64_t word = data_[w] & ((uint64_t(1) << (i % WORD_BITS)) - 1);
+        return counts_[2 * b] + sub_count<true>(b, w % BLOCK_WORDS) +
+               __builtin_popcountll(word);
+    }
+
+    /**
+     * @brief Number of 0-bits up to position \f$i\f$.
+     */
+    dtype rank0(dtype i) const { return i - rank(i); }
+
+    /**
+     * @brief Index of the \f$i\f$<sup>th</sup> 1-bit.
+     *
+     * @param i Selection target.
+     * @return \f$\underset{j \in [0..n)}{\mathrm{arg min}}\left(\sum_{k = 0}^j
+     * \mathrm{bv}[k]\right) =  i\f$.
+     */
+    dtype select(dtype i) const { return v_select<true>(i); }
+
+    /**
+     * @brief Index of the \f$i\f$<sup>th</sup> 0-bit.
+     *
+     * @param i Selection target.
+     * @return \f$\underset{j \in [0..n)}{\mathrm{arg min}}\left(j + 1 -
+     * \sum_{k = 0}^j \mathrm{bv}[k]\right) =  i\f$.
+     */
+    dtype select0(dtype i) const { return v_select<false>(i); }
+
+    /**
+     * @brief Value-generic rank.
+     */
+    dtype rank(bool v, dtype i) const { return v ? rank(i) : rank0(i); }
+
+    /**
+     * @brief Value-generic select.
+     */
+    dtype select(bool v, dtype i) const { return v ? select(i) : select0(i); }
+
+    /**
+     * @brief Position of the first 1-bit at or after index \f$i\f$.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype next_one(dtype i) const { return next_bit<true>(i); }
+
+    /**
+     * @brief Position of the last 1-bit at or before index \f$i\f$.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype prev_one(dtype i) const { return prev_bit<true>(i); }
+
+    /**
+     * @brief Position of the first 0-bit at or after index \f$i\f$.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype next_zero(dtype i) const { return next_bit<false>(i); }
+
+    /**
+     * @brief Position of the last 0-bit at or before index \f$i\f$.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype prev_zero(dtype i) const { return prev_bit<false>(i); }
+
+    /**
+     * @brief Number of bits allocated for the support structure.
+     *
+     * Unlike bv::query_support, this includes the copy of the raw data.
+     */
+    uint64_t bit_size() const {
+        uint64_t bytes = sizeof(flat_query_support);
+        bytes += sizeof(uint64_t) * (BLOCK_WORDS + 2) * n_blocks_;
+        bytes += sizeof(dtype) * (sum_ / SAMPLE_RATE + 2);
+        bytes += sizeof(dtype) * ((size_ - sum_) / SAMPLE_RATE + 2);
+        return bytes * 8;
+    }
+
+   private:
+    /**
+     * @brief Calculate block counts and select samples for the current data.
+     */
+    void finalize() {
+        uint64_t ones = 0;
+        for (dtype b = 0; b < n_blocks_; b++) {
+            counts_[2 * b] = ones;
+            uint64_t sub = 0;
+            uint64_t b_ones = 0;
+            for (uint64_t w = 0; w < BLOCK_WORDS; w++) {
+                if (w > 0) {
+                    sub |= b_ones << (9 * (w - 1));
+                }
+                b_ones += __builtin_popcountll(data_[b * BLOCK_WORDS + w]);
+            }
+            counts_[2 * b + 1] = sub;
+            ones += b_ones;
+        }
+        sum_ = ones;
+        sample<true>();
+        sample<false>();
+    }
+
+    /**
+     * @brief Store the block index of every `SAMPLE_RATE`<sup>th</sup> `v`-bit.
+     *
+     * The last sample is followed by a sentinel pointing to the last block.
+     */
+    template <bool v>
+    void sample() {
+        dtype total = v ? sum_ : size_ - sum_;
+        dtype n = total / SAMPLE_RATE + 2;
+        samples_[v] = (dtype*)realloc(samples_[v], sizeof(dtype) * n);
+        dtype k = 0;
+        for (dtype b = 0; b < n_blocks_; b++) {
+            dtype c = b + 1 < n_blocks_ ? block_count<v>(b + 1) : total;
+            while (k * SAMPLE_RATE < c && k * SAMPLE_RATE < total) {
+                samples_[v][k++] = b;
+            }
+        }
+        samples_[v][k] = n_blocks_ - 1;
+    }
+
+    /**
+     * @brief Number of `v`-bits preceding block `b`.
+     */
+    template <bool v>
+    dtype block_count(dtype b) const {
+        return v ? counts_[2 * b] : b * BLOCK_BITS - counts_[2 * b];
+    }
+
+    /**
+     * @brief Number of `v`-bits in the first `w` words of block `b`.
+     *
+     * Branchless extraction of the packed 9-bit count. For `w == 0` the shift
+     * is 63 and the result is 0, since the top bit of the packed counts is
+     * never set.
+     */
+    template <bool v>
+    dtype sub_count(dtype b, uint64_t w) const {
+        int64_t t = int64_t(w) - 1;
+        uint64_t c = (counts_[2 * b + 1] >> ((t + (t >> 60 & 8)) * 9)) & 0x1FF;
+        return v ? c : w * WORD_BITS - c;
+    }
+
+    /**
+     * @brief Shared implementation of `select` and `select0`.
+     *
+     * The block is located with a binary search between the samples
+     * surrounding the target, the word with a linear scan over the relative
+     * counts, and the position in the word with `pdep`.
+     */
+    template <bool v>
+    dtype v_select(dtype i) const {
+        dtype s = (i - 1) / SAMPLE_RATE;
+        dtype lo = samples_[v][s];
+        dtype hi = samples_[v][s + 1];
+        while (lo < hi) {
+            dtype mid = (lo + hi + 1) / 2;
+            if (block_count<v>(mid) < i) {
+                lo = mid;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        i -= block_count<v>(lo);
+        uint64_t w = 0;
+        while (w < BLOCK_WORDS - 1 && sub_count<v>(lo, w + 1) < i) {
+            w++;
+        }
+        i -= sub_count<v>(lo, w);
+        uint64_t word = data_[lo * BLOCK_WORDS + w];
+        word = v ? word : ~word;
+        return lo * BLOCK_BITS + w * WORD_BITS +
+               __builtin_ctzll(_pdep_u64(uint64_t(1) << (i - 1), word));
+    }
+
+    /**
+     * @brief Shared implementation of `next_one` and `next_zero`.
+     */
+    template <bool v>
+    dtype next_bit(dtype i) const {
+        if (i >= size_) {
+            [[unlikely]] return size_;
+        }
+        uint64_t word = data_[i / WORD_BITS];
+        word = (v ? word : ~word) >> (i % WORD_BITS);
+        if (word) {
+            dtype res = i + __builtin_ctzll(word);
+            [[likely]] return res < size_ ? res : size_;
+        }
+        dtype r = v ? rank(i) : rank0(i);
+        if (r == (v ? sum_ : size_ - sum_)) {
+            [[unlikely]] return size_;
+        }
+        return v_select<v>(r + 1);
+    }
+
+    /**
+     * @brief Shared implementation of `prev_one` and `prev_zero`.
+     */
+    template <bool v>
+    dtype prev_bit(dtype i) const {
+        if (size_ == 0) {
+            [[unlikely]] return 0;
+        }
+        i = i < size_ ? i : size_ - 1;
+        uint64_t word = data_[i / WORD_BITS];
+        word = (v ? word : ~word) << (WORD_BITS - 1 - i % WORD_BITS);
+        if (word) {
+            [[likely]] return i - __builtin_clzll(word);
+        }
+        dtype r = v ? rank(i) : rank0(i);
+        if (r == 0) {
+            [[unlikely]] return size_;
+        }
+        return v_select<v>(r);
+    }
+};
+
+}  // namespace bv
+
+#endif
@@ -10,6 +10,7 @@
 
 #include "libpopcnt.h"
 #include "packed_array.hpp"
+#include "serialize.hpp"
 #include "uncopyable.hpp"
 
 namespace bv {
@@ -451,6 +452,59 @@ class gap_leaf : uncopyable {
 
     uint16_t desired_capacity() const { return init_capacity(size_); }
 
+    /**
+     * @brief Write the leaf to `out` in binary form.
+     *
+     * Writes the capacity, bookkeeping, block gaps and the data words of the
+     * blocks in use.
+     *
+     * @param out Stream to write to.
+     */
+    void serialize(std::ostream& out) const {
+        uint16_t words = (last_block_ + 1) * BLOCK_WORDS;
+        words = words < capacity_ ? words : capacity_;
+        write_raw(out, &capacity_);
+        write_raw(out, &words);
+        write_raw(out, &size_);
+        write_raw(out, &p_sum_);
+        write_raw(out, &last_block_);
+        write_raw(out, &last_block_space_);
+        write_raw(out, &gaps_);
+        write_raw(out, data_, words);
+    }
+
+    /**
+     * @brief Allocate a leaf and populate it from `in`.
+     *
+     * Reads a leaf written by `serialize`. The leaf is allocated with the
+     * serialized capacity.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param in    Stream to read from.
+     * @param alloc Allocator to use for allocating the leaf.
+     *
+     * @return The new leaf or `nullptr` if the stream ended or contained
+     * invalid data.
+     */
+    template <class allocator>
+    static gap_leaf* load(std::istream& in, allocator* alloc) {
+        uint16_t cap, words;
+        if (!read_raw(in, &cap) || !read_raw(in, &words) || words > cap ||
+            cap == 0) {
+            [[unlikely]] return nullptr;
+        }
+        gap_leaf* l = alloc->template allocate_leaf<gap_leaf>(cap);
+        bool ok = read_raw(in, &l->size_) && read_raw(in, &l->p_sum_) &&
+                  read_raw(in, &l->last_block_) &&
+                  read_raw(in, &l->last_block_space_) &&
+                  read_raw(in, &l->gaps_) && read_raw(in, l->data_, words);
+        if (!ok || l->last_block_ > blocks) {
+            alloc->deallocate_leaf(l);
+            [[unlikely]] return nullptr;
+        }
+        return l;
+    }
+
     /**
      * @brief Sets the pointer to the leaf-associated data storage.
      *
@@ -14,6 +14,7 @@
 
 //#include "deb.hpp"
 #include "libpopcnt.h"
+#include "serialize.hpp"
 #include "uncopyable.hpp"
 #include "deb.hpp"
 
@@ -65,7 +66,13 @@ class leaf : uncopyable {
     uint32_t buffer_[buffer_size];            ///< Insert/remove buffer.
 #pragma GCC diagnostic pop
     uint64_t* data_;  ///< Pointer to data storage.
-    inline static uint64_t data_scratch[leaf_size / 64];
+    /**
+     * @brief Work area for rewriting leaf data.
+     *
+     * Per thread, so that independent bit vectors can be modified from
+     * different threads.
+     */
+    inline static thread_local uint64_t data_scratch[leaf_size / 64];
 
     /** @brief 0x1 to be used in  bit operations. */
     static const constexpr uint64_t MASK = 1;
@@ -96,6 +103,9 @@ class leaf : uncopyable {
     // Hybrid compressed leaves should be buffered.
     static_assert(!compressed || buffer_size > 0);
 
+    // Run-length encoded buffer handling relies on sorted buffers.
+    static_assert(!compressed || sorted_buffers);
+
     // Larger leaf size would lead to undefined behaviour. due to buffer
     // overflow.
     static_assert(leaf_size < (uint32_t(1) << 22));
@@ -128,8 +138,10 @@ class leaf : uncopyable {
             // Maximum size for leaves is ~VALUE_MASK
             assert(elems <= ~VALUE_MASK);
         }
+        // Buffer count is read by serialization and flushing even when
+        // buffering is disabled.
+        buffer_count_ = 0;
         if constexpr (buffer_size > 0) {
-            buffer_count_ = 0;
             memset(buffer_, 0, sizeof(buffer_));
         }
         type_info_ = 0;
@@ -164,23 +176,22 @@ class leaf : uncopyable {
                 return c_at(i);
             }
         }
-        if constexpr (!sorted_buffers && buffer_size != 0) {
-            commit();
-        }
-        if constexpr (sorted_buffers && buffer_size != 0) {
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
+        if constexpr (buffer_size != 0) {
             uint64_t index = i;
             for (uint8_t idx = 0; idx < buffer_size; idx++) {
                 if (idx >= buffer_count_) [[unlikely]] {
                     break;
                 }
-                uint64_t b = buffer_index(buffer_[idx]);
+                uint64_t b = buffer_index(buf[idx]);
                 if (b == i) {
-                    if (buffer_is_insertion(buffer_[idx])) [[unlikely]] {
-                        return buffer_value(buffer_[idx]);
+                    if (buffer_is_insertion(buf[idx])) [[unlikely]] {
+                        return buffer_value(buf[idx]);
                     }
                     index++;
                 } else if (b < i) [[likely]] {
-                    index -= buffer_is_insertion(buffer_[idx]) * 2 - 1;
+                    index -= buffer_is_insertion(buf[idx]) * 2 - 1;
                 } else [[unlikely]] {
                     break;
                 }
@@ -253,8 +264,8 @@ class leaf : uncopyable {
 #endif
         if constexpr (!sorted_buffers && buffer_size != 0) {
             buffer_[buffer_count_++] = create_buffer(i, 1, x);
-            p_sum += x ? 1 : 0;
-            size++;
+            p_sum_ += x ? 1 : 0;
+            size_++;
             if (buffer_count_ >= buffer_size) [[unlikely]] {
                 commit();
             }
@@ -458,24 +469,23 @@ class leaf : uncopyable {
                 return c_rank(n);
             }
         }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
         uint32_t count = 0;
         uint32_t idx = n;
-        if constexpr (!sorted_buffers && buffer_size >= 0) {
-            commit();
-        }
-        if constexpr (sorted_buffers && buffer_size != 0) {
+        if constexpr (buffer_size != 0) {
             for (uint8_t i = 0; i < buffer_count_; i++) {
-                if (buffer_index(buffer_[i]) >= n) {
+                if (buffer_index(buf[i]) >= n) {
                     [[unlikely]] break;
                 }
                 // Location of the n<sup>th</sup> element needs to be amended
                 // base on buffer contents.
-                if (buffer_is_insertion(buffer_[i])) {
+                if (buffer_is_insertion(buf[i])) {
                     idx--;
-                    count += buffer_value(buffer_[i]);
+                    count += buffer_value(buf[i]);
                 } else {
                     idx++;
-                    count -= buffer_value(buffer_[i]);
+                    count -= buffer_value(buf[i]);
                 }
             }
         }
@@ -512,33 +522,32 @@ class leaf : uncopyable {
     uint32_t rank(uint32_t n, uint32_t offset) const {
         if constexpr (compressed) {
             if (is_compressed()) {
-                return c_rank(n);
+                return c_rank(n) - c_rank(offset);
             }
         }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
         uint32_t count = 0;
         uint32_t idx = n;
         uint32_t o_idx = offset;
-        if constexpr (!sorted_buffers && buffer_size != 0) {
-            commit();
-        }
-        if constexpr (sorted_buffers && buffer_size != 0) {
+        if constexpr (buffer_size != 0) {
             for (uint8_t i = 0; i < buffer_count_; i++) {
-                uint32_t b = buffer_index(buffer_[i]);
+                uint32_t b = buffer_index(buf[i]);
                 if (b >= n) {
                     [[unlikely]] break;
                 }
                 // Location of the n<sup>th</sup> element needs to be amended
                 // base on buffer contents.
-                if (buffer_is_insertion(buffer_[i])) {
+                if (buffer_is_insertion(buf[i])) {
                     if (b >= offset) {
-                        count += buffer_value(buffer_[i]);
+                        count += buffer_value(buf[i]);
                     } else {
                         o_idx--;
                     }
                     idx--;
                 } else {
                     if (b >= offset) {
-                        count -= buffer_value(buffer_[i]);
+                        count -= buffer_value(buf[i]);
                     } else {
                         o_idx++;
                     }
@@ -594,13 +603,11 @@ class leaf : uncopyable {
                 return c_select(x);
             }
         }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
         if constexpr (buffer_size == 0) {
             return unb_select(x);
         }
-        if constexpr (!sorted_buffers) {
-            commit();
-            return unb_select(x);
-        }
         if (buffer_count_ == 0) {
             return unb_select(x);
         }
@@ -615,10 +622,10 @@ class leaf : uncopyable {
             pop += __builtin_popcountll(data_[j]);
             pos += WORD_BITS;
             for (uint8_t b = current_buffer; b < buffer_count_; b++) {
-                b_index = buffer_index(buffer_[b]);
+                b_index = buffer_index(buf[b]);
                 if (b_index < int32_t(pos)) {
-                    if (buffer_is_insertion(buffer_[b])) {
-                        pop += buffer_value(buffer_[b]);
+                    if (buffer_is_insertion(buf[b])) {
+                        pop += buffer_value(buf[b]);
                         pos++;
                         a_pos_offset--;
                     } else {
@@ -641,15 +648,15 @@ class leaf : uncopyable {
 
         current_buffer -= 1;
         b_index = current_buffer < buffer_count_
-                      ? buffer_index(buffer_[current_buffer])
+                      ? buffer_index(buf[current_buffer])
                       : -100;
         if ((b_index - 1 >= int32_t(pos) &&
-             !buffer_is_insertion(buffer_[current_buffer])) ||
+             !buffer_is_insertion(buf[current_buffer])) ||
             (b_index >= int32_t(pos) &&
-             buffer_is_insertion(buffer_[current_buffer]))) {
+             buffer_is_insertion(buf[current_buffer]))) {
             current_buffer--;
             b_index = current_buffer < buffer_count_
-                          ? buffer_index(buffer_[current_buffer])
+                          ? buffer_index(buf[current_buffer])
                           : -100;
         }
 
@@ -661,22 +668,22 @@ class leaf : uncopyable {
         pos--;
         while (pop >= x && pos < capacity_ * WORD_BITS) {
             while (b_index - 1 == int32_t(pos) &&
-                   !buffer_is_insertion(buffer_[current_buffer])) {
+                   !buffer_is_insertion(buf[current_buffer])) {
                 a_pos_offset--;
                 current_buffer--;
                 b_index = current_buffer < buffer_count_
-                              ? buffer_index(buffer_[current_buffer])
+                              ? buffer_index(buf[current_buffer])
                               : -100;
                 [[unlikely]] (void(0));
             }
             if (b_index == int32_t(pos) &&
-                buffer_is_insertion(buffer_[current_buffer])) {
-                pop -= buffer_value(buffer_[current_buffer]);
+                buffer_is_insertion(buf[current_buffer])) {
+                pop -= buffer_value(buf[current_buffer]);
                 a_pos_offset++;
                 pos--;
                 current_buffer--;
                 b_index = current_buffer < buffer_count_
-                              ? buffer_index(buffer_[current_buffer])
+                              ? buffer_index(buf[current_buffer])
                               : -100;
                 [[unlikely]] continue;
             }
@@ -704,17 +711,16 @@ class leaf : uncopyable {
                 return c_select(x);
             }
         }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
         uint8_t current_buffer = 0;
         int8_t a_pos_offset = 0;
-        if constexpr (!sorted_buffers && buffer_size != 0) {
-            commit();
-        }
         // Scroll the buffer to the start position and calculate offset.
-        if constexpr (sorted_buffers && buffer_size != 0) {
+        if constexpr (buffer_size != 0) {
             while (current_buffer < buffer_count_) {
-                uint32_t b_index = buffer_index(buffer_[current_buffer]);
+                uint32_t b_index = buffer_index(buf[current_buffer]);
                 if (b_index < pos) {
-                    if (buffer_is_insertion(buffer_[current_buffer])) {
+                    if (buffer_is_insertion(buf[current_buffer])) {
                         a_pos_offset--;
                     } else {
                         a_pos_offset++;
@@ -743,12 +749,12 @@ class leaf : uncopyable {
             if (offset != 0) {
                 pop += __builtin_popcountll(data_[pop_idx++] >> offset);
                 pos += WORD_BITS - offset;
-                if constexpr (sorted_buffers && buffer_size != 0) {
+                if constexpr (buffer_size != 0) {
                     for (uint8_t b = current_buffer; b < buffer_count_; b++) {
-                        uint32_t b_index = buffer_index(buffer_[b]);
+                        uint32_t b_index = buffer_index(buf[b]);
                         if (b_index < pos) {
-                            if (buffer_is_insertion(buffer_[b])) {
-                                pop += buffer_value(buffer_[b]);
+                            if (buffer_is_insertion(buf[b])) {
+                                pop += buffer_value(buf[b]);
                                 pos++;
                                 a_pos_offset--;
                             } else {
@@ -774,12 +780,12 @@ class leaf : uncopyable {
         for (uint32_t j = pop_idx; j < capacity_; j++) {
             pop += __builtin_popcountll(data_[j]);
             pos += WORD_BITS;
-            if constexpr (sorted_buffers && buffer_size != 0) {
+            if constexpr (buffer_size != 0) {
                 for (uint8_t b = current_buffer; b < buffer_count_; b++) {
-                    uint32_t b_index = buffer_index(buffer_[b]);
+                    uint32_t b_index = buffer_index(buf[b]);
                     if (b_index < pos) {
-                        if (buffer_is_insertion(buffer_[b])) {
-                            pop += buffer_value(buffer_[b]);
+                        if (buffer_is_insertion(buf[b])) {
+                            pop += buffer_value(buf[b]);
                             pos++;
                             a_pos_offset--;
                         } else {
@@ -955,7 +961,71 @@ class leaf : uncopyable {
      *
      * @return Pointer to raw leaf data.
      */
-    const uint64_t* data() { return data_; }
+    const uint64_t* data() const { return data_; }
+
+    /**
+     * @brief Write the leaf to `out` in binary form.
+     *
+     * Writes the capacity, bookkeeping, buffer contents and the used words of
+     * data. Buffers are written as is, so serialization does not modify the
+     * leaf.
+     *
+     * @param out Stream to write to.
+     */
+    void serialize(std::ostream& out) const {
+        uint16_t words = used_words();
+        write_raw(out, &capacity_);
+        write_raw(out, &words);
+        write_raw(out, &buffer_count_);
+        write_raw(out, &type_info_);
+        write_raw(out, &size_);
+        write_raw(out, &p_sum_);
+        if constexpr (compressed) {
+            write_raw(out, run_index_);
+        }
+        if constexpr (buffer_size != 0) {
+            write_raw(out, buffer_, buffer_count_);
+        }
+        write_raw(out, data_, words);
+    }
+
+    /**
+     * @brief Allocate a leaf and populate it from `in`.
+     *
+     * Reads a leaf written by `serialize`. The leaf is allocated with the
+     * serialized capacity.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param in    Stream to read from.
+     * @param alloc Allocator to use for allocating the leaf.
+     *
+     * @return The new leaf or `nullptr` if the stream ended or contained
+     * invalid data.
+     */
+    template <class allocator>
+    static leaf* load(std::istream& in, allocator* alloc) {
+        uint16_t cap, words;
+        if (!read_raw(in, &cap) || !read_raw(in, &words) || words > cap ||
+            cap == 0) {
+            [[unlikely]] return nullptr;
+        }
+        leaf* l = alloc->template allocate_leaf<leaf>(cap);
+        bool ok = read_raw(in, &l->buffer_count_) &&
+                  read_raw(in, &l->type_info_) && read_raw(in, &l->size_) &&
+                  read_raw(in, &l->p_sum_) && l->buffer_count_ <= buffer_size;
+        if constexpr (compressed) {
+            ok = ok && read_raw(in, l->run_index_);
+        }
+        if constexpr (buffer_size != 0) {
+            ok = ok && read_raw(in, l->buffer_, l->buffer_count_);
+        }
+        ok = ok && read_raw(in, l->data_, words);
+        if (!ok) {
+            alloc->deallocate_leaf(l);
+            [[unlikely]] return nullptr;
+        }
+        return l;
+    }
 
     /**
      * @brief Remove the fist "elems" elements from the leaf.
@@ -1117,8 +1187,14 @@ class leaf : uncopyable {
                 rl |= o_data[d_idx + 2];
                 r_bytes = 3;
             }
-            if ((other->size() - size_ - rl >= leaf_size / 3) &&
+            // Runs are copied until half of the encoding is copied, but at
+            // least until both leaves have leaf_size / 3 elements. Buffered
+            // elements not yet copied may follow the copied runs, so they are
+            // reserved on top of the minimum size of "other".
+            uint32_t keep = leaf_size / 3 + o_buf_count - ob_idx;
+            if ((other->size() - size_ - rl >= keep) &&
                 ((d_idx + r_bytes < o_bytes / 2 ||
+                  size_ + rl < leaf_size / 3 ||
                   buffer_count_ < (buffer_size >> 1)))) {
                 d_idx += r_bytes;
                 assert(rl != 0);
@@ -1134,15 +1210,15 @@ class leaf : uncopyable {
                         [[likely]] break;
                     }
                 }
-            } else if (other->size() - size_ > leaf_size / 3 &&
-                       d_idx < o_bytes / 2) {
+            } else if (other->size() - size_ > keep &&
+                       (d_idx < o_bytes / 2 || size_ < leaf_size / 3)) {
                 uint32_t to_copy = rl - rl / 2;
                 if (size_ + to_copy < (leaf_size / 3)) {
                     to_copy = (leaf_size / 3) - size_;
                     [[unlikely]] to_copy = to_copy > rl ? rl : to_copy;
                 }
-                if (other->size() - size_ - to_copy < (leaf_size / 3)) {
-                    to_copy = other->size() - size_ - (leaf_size / 3);
+                if (other->size() - size_ - to_copy < keep) {
+                    to_copy = other->size() - size_ - keep;
                     [[unlikely]] to_copy = to_copy > rl ? rl : to_copy;
                 }
                 assert(rl >= to_copy);
@@ -1531,6 +1607,294 @@ class leaf : uncopyable {
         p_sum_ += o_p_sum;
     }
 
+    /**
+     * @brief Append "elems" bits from a packed word array to the end of "this".
+     *
+     * Intended for bulk construction, where leaves are populated directly from
+     * raw data instead of with repeated insertions. Bits are read starting
+     * from bit position "offset" in "source", using the same bit order as
+     * `dump`. The partial sum is updated one 64-bit word at a time.
+     *
+     * **Will not** ensure sufficient capacity for the appended bits.
+     *
+     * The buffer will be committed before appending.
+     *
+     * @param source Pointer to packed source data.
+     * @param offset Bit position in "source" to start reading from.
+     * @param elems  Number of bits to append.
+     */
+    void append_bits(const uint64_t* source, uint64_t offset, uint32_t elems) {
+        if constexpr (compressed) {
+            assert(!is_compressed());
+        }
+        commit<false>();
+        assert(size_ + elems <= capacity_ * WORD_BITS);
+        p_sum_ += write_bits(data_, size_, source, offset, elems);
+        size_ += elems;
+    }
+
+    /**
+     * @brief Append a run of "elems" copies of "v" to the end of "this".
+     *
+     * Counterpart of `append_bits` for constant data. Whole words are written
+     * at a time.
+     *
+     * **Will not** ensure sufficient capacity for the appended bits.
+     *
+     * @param v     Value of the appended bits.
+     * @param elems Number of bits to append.
+     */
+    void append_run(bool v, uint32_t elems) {
+        if constexpr (compressed) {
+            assert(!is_compressed());
+        }
+        commit<false>();
+        assert(size_ + elems <= capacity_ * WORD_BITS);
+        if (v) {
+            set_bits(data_, size_, elems);
+            p_sum_ += elems;
+        }
+        size_ += elems;
+    }
+
+    /**
+     * @brief Insert "elems" bits from a packed word array at position "i".
+     *
+     * Bits are read starting from bit position "offset" in "source", using the
+     * same bit order as `dump`. The buffer is committed, after which the
+     * prefix, the new bits and the suffix are copied to the scratch space one
+     * 64-bit word at a time.
+     *
+     * **Will not** ensure sufficient capacity for the insertion.
+     *
+     * @param i      Insertion position.
+     * @param source Pointer to packed source data.
+     * @param offset Bit position in "source" to start reading from.
+     * @param elems  Number of bits to insert.
+     */
+    void insert_bits(uint32_t i, const uint64_t* source, uint64_t offset,
+                     uint32_t elems) {
+        if constexpr (compressed) {
+            assert(!is_compressed());
+        }
+        commit<false>();
+        uint32_t n_size = size_ + elems;
+        assert(i <= size_ && n_size <= capacity_ * WORD_BITS);
+        uint32_t words = n_size / WORD_BITS + (n_size % WORD_BITS ? 1 : 0);
+        memset(data_scratch, 0, words * sizeof(uint64_t));
+        write_bits(data_scratch, 0, data_, 0, i);
+        p_sum_ += write_bits(data_scratch, i, source, offset, elems);
+        write_bits(data_scratch, i + elems, data_, i, size_ - i);
+        memcpy(data_, data_scratch, words * sizeof(uint64_t));
+        size_ = n_size;
+    }
+
+    /**
+     * @brief Insert a run of "elems" copies of "v" at position "i".
+     *
+     * For uncompressed leaves this works like `insert_bits`. For run-length
+     * encoded leaves the run is merged into the encoding as a single run,
+     * splitting the run containing "i" if necessary.
+     *
+     * **Will not** ensure sufficient capacity for the insertion. Encoded
+     * leaves need room for 8 additional bytes in addition to the space
+     * normally reserved for the buffer.
+     *
+     * @param i     Insertion position.
+     * @param v     Value of the inserted bits.
+     * @param elems Number of bits to insert.
+     */
+    void insert_run(uint32_t i, bool v, uint32_t elems) {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return c_insert_run(i, v, elems);
+            }
+        }
+        commit<false>();
+        uint32_t n_size = size_ + elems;
+        assert(i <= size_ && n_size <= capacity_ * WORD_BITS);
+        uint32_t words = n_size / WORD_BITS + (n_size % WORD_BITS ? 1 : 0);
+        memset(data_scratch, 0, words * sizeof(uint64_t));
+        write_bits(data_scratch, 0, data_, 0, i);
+        if (v) {
+            set_bits(data_scratch, i, elems);
+            p_sum_ += elems;
+        }
+        write_bits(data_scratch, i + elems, data_, i, size_ - i);
+        memcpy(data_, data_scratch, words * sizeof(uint64_t));
+        size_ = n_size;
+    }
+
+    /**
+     * @brief Insert a sorted batch of elements into the leaf in a single pass.
+     *
+     * Equivalent to calling `insert(pos[i] - offset, vals[i])` for
+     * \f$i = 0, \ldots, n - 1\f$ in order. Positions need to be strictly
+     * increasing, in which case `pos[i] - offset` is also the final position
+     * of the i<sup>th</sup> inserted element.
+     *
+     * The buffer is committed, after which the existing data and new elements
+     * are merged into the scratch space one run of existing bits at a time.
+     *
+     * **Will not** ensure sufficient capacity for the insertions.
+     *
+     * @tparam dtype Integer type of positions.
+     *
+     * @param pos    Strictly increasing insertion positions.
+     * @param vals   Values to insert.
+     * @param n      Number of elements to insert.
+     * @param offset Value to subtract from positions to get leaf positions.
+     */
+    template <class dtype>
+    void insert_batch(const dtype* pos, const bool* vals, uint32_t n,
+                      dtype offset) {
+        if constexpr (compressed) {
+            assert(!is_compressed());
+        }
+        commit<false>();
+        uint32_t n_size = size_ + n;
+        assert(n_size <= capacity_ * WORD_BITS);
+        uint32_t words = n_size / WORD_BITS + (n_size % WORD_BITS ? 1 : 0);
+        memset(data_scratch, 0, words * sizeof(uint64_t));
+        uint32_t source = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t target = pos[i] - offset;
+            assert(target >= source + i);
+            uint32_t elems = target - i - source;
+            write_bits(data_scratch, source + i, data_, source, elems);
+            source += elems;
+            if (vals[i]) {
+                data_scratch[target / WORD_BITS] |= MASK
+                                                    << (target % WORD_BITS);
+                p_sum_++;
+            }
+        }
+        write_bits(data_scratch, source + n, data_, source, size_ - source);
+        memcpy(data_, data_scratch, words * sizeof(uint64_t));
+        size_ = n_size;
+    }
+
+    /**
+     * @brief Remove a sorted batch of elements from the leaf in a single pass.
+     *
+     * Positions refer to the leaf before any of the removals, and need to be
+     * strictly increasing. The buffer is committed, after which the retained
+     * runs of bits are compacted into the scratch space.
+     *
+     * Run-length encoded leaves remove the elements one at a time in reverse
+     * order.
+     *
+     * @tparam dtype Integer type of positions.
+     *
+     * @param pos    Strictly increasing removal positions.
+     * @param n      Number of elements to remove.
+     * @param offset Value to subtract from positions to get leaf positions.
+     *
+     * @return Number of 1-bits removed.
+     */
+    template <class dtype>
+    uint32_t remove_batch(const dtype* pos, uint32_t n, dtype offset) {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                uint32_t removed = 0;
+                for (uint32_t i = n; i > 0; i--) {
+                    removed += c_remove(pos[i - 1] - offset);
+                }
+                return removed;
+            }
+        }
+        commit<false>();
+        uint32_t words = size_ / WORD_BITS + (size_ % WORD_BITS ? 1 : 0);
+        memset(data_scratch, 0, words * sizeof(uint64_t));
+        uint32_t source = 0;
+        uint32_t removed = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t target = pos[i] - offset;
+            assert(target >= source && target < size_);
+            write_bits(data_scratch, source - i, data_, source,
+                       target - source);
+            removed += MASK & (data_[target / WORD_BITS] >>
+                               (target % WORD_BITS));
+            source = target + 1;
+        }
+        write_bits(data_scratch, source - n, data_, source, size_ - source);
+        memcpy(data_, data_scratch, words * sizeof(uint64_t));
+        size_ -= n;
+        p_sum_ -= removed;
+        return removed;
+    }
+
+    /**
+     * @brief Remove the elements in the range \f$[a, b)\f$ from the leaf.
+     *
+     * The buffer is committed, after which the bits following the range are
+     * moved to position "a" one 64-bit word at a time. For run-length encoded
+     * leaves the runs covering the range are cut out of the encoding instead.
+     *
+     * @param a Start of range to remove.
+     * @param b End of range to remove.
+     *
+     * @return Number of 1-bits removed.
+     */
+    uint32_t remove_range(uint32_t a, uint32_t b) {
+        assert(a <= b && b <= size_);
+        if (a == b) return 0;
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                c_commit();
+                if (is_compressed()) {
+                    return -c_rewrite(a, b, 0, false, false);
+                }
+            }
+        }
+        commit<false>();
+        uint32_t words = size_ / WORD_BITS + (size_ % WORD_BITS ? 1 : 0);
+        memset(data_scratch, 0, words * sizeof(uint64_t));
+        uint32_t ones = write_bits(data_scratch, 0, data_, 0, a);
+        ones += write_bits(data_scratch, a, data_, b, size_ - b);
+        memcpy(data_, data_scratch, words * sizeof(uint64_t));
+        uint32_t removed = p_sum_ - ones;
+        size_ -= b - a;
+        p_sum_ = ones;
+        return removed;
+    }
+
+    /**
+     * @brief Set the elements in the range \f$[a, b)\f$ to "v".
+     *
+     * The buffer is committed, after which uncompressed leaves are modified
+     * one 64-bit word at a time. For run-length encoded leaves, the range is
+     * replaced with a single run.
+     *
+     * **Will not** ensure sufficient capacity. Encoded leaves need room for 16
+     * additional bytes in addition to the space normally reserved for the
+     * buffer.
+     *
+     * @param a Start of range.
+     * @param b End of range.
+     * @param v Value to set elements to.
+     *
+     * @return Change in the number of 1-bits.
+     */
+    int32_t set_range(uint32_t a, uint32_t b, bool v) {
+        return update_range<false>(a, b, v);
+    }
+
+    /**
+     * @brief Invert the elements in the range \f$[a, b)\f$.
+     *
+     * Works like `set_range`, with run-length encoded leaves inverting one
+     * run at a time.
+     *
+     * @param a Start of range.
+     * @param b End of range.
+     *
+     * @return Change in the number of 1-bits.
+     */
+    int32_t flip_range(uint32_t a, uint32_t b) {
+        return update_range<true>(a, b, false);
+    }
+
     void flush() {
         if constexpr (compressed) {
             if (is_compressed()) {
@@ -1540,6 +1904,18 @@ class leaf : uncopyable {
         commit();
     }
 
+    /**
+     * @brief True if `flush` would modify the leaf.
+     */
+    bool need_flush() const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return false;
+            }
+        }
+        return buffer_count_ > 0;
+    }
+
     uint64_t dump(uint64_t* target, uint64_t start) {
         if constexpr (compressed) {
             if (is_compressed()) {
@@ -1574,103 +1950,453 @@ class leaf : uncopyable {
         return start + size_;
     }
 
-    bool is_compressed() const {
-        if constexpr (compressed) {
-            return (type_info_ & C_TYPE_MASK) == C_TYPE_MASK;
-        }
-        return false;
-    }
-
     /**
-     * @brief Ensure that the leaf is in a valid state.
-     *
-     * Will use assertions to check that the actual stored data agrees with
-     * stored metadata. Will not in any way that the leaf is in the correct
-     * state given the preceding sequence of operations, just that the leaf is
-     * in a state that is valid for a leaf.
+     * @brief Copy the logical contents of the leaf to `target`.
      *
-     * If the compiler flag `-DNDEBUG` is given, this function will do nothing
-     * and may be completely optimized out by an optimizing compiler.
+     * Works like `dump`, but without committing buffered operations, so the
+     * leaf is not modified. Buffer contents are merged into the output and
+     * run-length encoded leaves are decoded.
      *
-     * @return 1 for calculating the number of nodes in the tree.
+     * @param target Zero initialized array with room for at least
+     *               \f$\lfloor\mathrm{size} / 64\rfloor + 1\f$ words.
      */
-    uint32_t validate() const {
-        if (is_compressed()) {
-            assert(size_ <= (~uint32_t(0) >> 1));
-        } else {
-            assert(size_ <= capacity_ * WORD_BITS);
-        }
-        assert(p_sum_ <= size_);
-        assert(p_sum_ == rank(size_));
-        if (is_compressed()) {
-            bool rem = type_info_ & C_RUN_REMOVAL_MASK;
-            uint8_t* data = reinterpret_cast<uint8_t*>(data_);
-            for (size_t i = run_index_[0]; i < 8 * capacity_; i++) {
-                assert(data[i] == 0);
-            }
-            uint32_t d_idx = 0;
-            uint32_t c_size = buffer_count_;
-            uint32_t c_sum = 0;
-            for (size_t i = 0; i < buffer_count_; i++) {
-                c_sum += buffer_[i] >> 31;
+    void copy_bits(uint64_t* target) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                c_dump(target, 0);
+                return;
             }
-            bool val = type_info_ & C_ONE_MASK;
-            while (d_idx < run_index_[0]) {
-                uint32_t rl = 0;
-                if ((data[d_idx] & 0b11000000) == 0b11000000) {
-                    rl = data[d_idx++] & 0b00111111;
-                } else if ((data[d_idx] >> 7) == 0) {
-                    rl = data[d_idx++] << 24;
-                    rl |= data[d_idx++] << 16;
-                    rl |= data[d_idx++] << 8;
-                    rl |= data[d_idx++];
-                } else if ((data[d_idx] & 0b10100000) == 0b10100000) {
-                    rl = (data[d_idx++] & 0b00011111) << 16;
-                    rl |= data[d_idx++] << 8;
-                    rl |= data[d_idx++];
-                } else {
-                    rl = (data[d_idx++] & 0b00011111) << 8;
-                    rl |= data[d_idx++];
+        }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
+        uint32_t t_pos = 0;
+        uint64_t s_pos = 0;
+        if constexpr (buffer_size != 0) {
+            for (uint8_t i = 0; i < buffer_count_; i++) {
+                uint32_t b = buffer_index(buf[i]);
+                if (b > t_pos) {
+                    write_bits(target, t_pos, data_, s_pos, b - t_pos);
+                    s_pos += b - t_pos;
+                    t_pos = b;
                 }
-                if (!rem) {
-                    assert(rl > 0);
+                if (buffer_is_insertion(buf[i])) {
+                    target[t_pos / WORD_BITS] |=
+                        uint64_t(buffer_value(buf[i]))
+                        << (t_pos % WORD_BITS);
+                    t_pos++;
+                } else {
+                    s_pos++;
                 }
-                c_size += rl;
-                c_sum += val * rl;
-                val = !val;
-            }
-            assert(c_size == size_);
-            return 1;
-        }
-        uint32_t u_loc = size_;
-        for (uint8_t i = 0; i < buffer_count_; i++) {
-            if (buffer_is_insertion(buffer_[i])) {
-                u_loc--;
-            } else {
-                u_loc++;
             }
         }
-        uint32_t last_word = u_loc / WORD_BITS;
-        uint32_t overflow = u_loc % WORD_BITS;
-        if (overflow != 0) {
-            uint64_t val = (MASK << overflow) - 1;
-            val = (~val) & data_[last_word];
-            assert(val == 0u);
-            last_word++;
-        }
-        for (uint32_t i = last_word; i < capacity_; i++) {
-            assert(data_[i] == 0);
-        }
-        return 1;
+        write_bits(target, t_pos, data_, s_pos, size_ - t_pos);
     }
 
     /**
-     * @brief Output data stored in the leaf as json.
+     * @brief Call `fn` with the position of each 1-bit in \f$[a, b)\f$.
      *
-     * Will output valid json, but will not output a trailing newline since the
-     * call is expected to be part of a recursive tree traversal.
+     * Positions are reported in increasing order, shifted by `offset`.
+     * Uncompressed data is scanned a word at a time with count trailing
+     * zeros. Run-length encoded leaves report positions directly from runs.
      *
-     * @param internal_only Will not output raw data if true to save space.
+     * @tparam F Callable taking a `uint64_t` position.
+     *
+     * @param a      Start of range.
+     * @param b      End of range.
+     * @param offset Value to add to reported positions.
+     * @param fn     Function to call.
+     */
+    template <class F>
+    void for_each_one(uint32_t a, uint32_t b, uint64_t offset, F& fn) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                c_for_each_one(a, b, offset, fn);
+                return;
+            }
+        }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
+        // Logical elements in [t_pos, e) are stored starting from data index
+        // s_pos. Buffer elements only cause shifts between segments.
+        uint32_t t_pos = 0;
+        uint32_t s_pos = 0;
+        auto segment = [&](uint32_t e) {
+            uint32_t lo = a > t_pos ? a : t_pos;
+            uint32_t hi = b < e ? b : e;
+            if (lo < hi) {
+                scan_ones(data_, s_pos + lo - t_pos, s_pos + hi - t_pos,
+                          offset + lo, fn);
+            }
+            s_pos += e - t_pos;
+            t_pos = e;
+        };
+        if constexpr (buffer_size != 0) {
+            for (uint8_t i = 0; i < buffer_count_; i++) {
+                uint32_t e = buffer_index(buf[i]);
+                if (e >= b) {
+                    [[unlikely]] break;
+                }
+                segment(e);
+                if (buffer_is_insertion(buf[i])) {
+                    if (buffer_value(buf[i]) && e >= a) {
+                        fn(offset + e);
+                    }
+                    t_pos++;
+                } else {
+                    s_pos++;
+                }
+            }
+        }
+        segment(b);
+    }
+
+    /**
+     * @brief Call `fn(start, length, value)` for runs of equal elements in
+     * \f$[a, b)\f$.
+     *
+     * Runs are reported in order, clipped to the range and shifted by
+     * `offset`. Run-length encoded leaves report their stored runs.
+     * Uncompressed data is split into runs a word at a time. Runs are not
+     * guaranteed to be maximal, as buffered elements are reported separately.
+     *
+     * @tparam F Callable taking `(uint64_t, uint64_t, bool)`.
+     *
+     * @param a      Start of range.
+     * @param b      End of range.
+     * @param offset Value to add to reported positions.
+     * @param fn     Function to call.
+     */
+    template <class F>
+    void for_each_run(uint32_t a, uint32_t b, uint64_t offset, F& fn) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                c_runs([&](uint32_t start, uint32_t rl, bool val) {
+                    if (start >= b) return false;
+                    uint32_t lo = a > start ? a : start;
+                    uint32_t hi = b < start + rl ? b : start + rl;
+                    if (lo < hi) {
+                        fn(offset + lo, uint64_t(hi - lo), val);
+                    }
+                    return true;
+                });
+                return;
+            }
+        }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
+        uint32_t t_pos = 0;
+        uint32_t s_pos = 0;
+        // Logical elements in [t_pos, e) are stored starting from data index
+        // s_pos.
+        auto segment = [&](uint32_t e) {
+            uint32_t lo = a > t_pos ? a : t_pos;
+            uint32_t hi = b < e ? b : e;
+            uint32_t pos = s_pos + lo - t_pos;
+            uint32_t end = s_pos + hi - t_pos;
+            while (pos < end) {
+                bool val = (data_[pos / WORD_BITS] >> (pos % WORD_BITS)) & 1;
+                uint32_t r_end = val ? find_next<false>(data_, pos, end)
+                                     : find_next<true>(data_, pos, end);
+                fn(offset + t_pos + (pos - s_pos), uint64_t(r_end - pos), val);
+                pos = r_end;
+            }
+            s_pos += e - t_pos;
+            t_pos = e;
+        };
+        if constexpr (buffer_size != 0) {
+            for (uint8_t i = 0; i < buffer_count_; i++) {
+                uint32_t e = buffer_index(buf[i]);
+                if (e >= b) {
+                    [[unlikely]] break;
+                }
+                segment(e);
+                if (buffer_is_insertion(buf[i])) {
+                    if (e >= a) {
+                        fn(offset + e, uint64_t(1), buffer_value(buf[i]));
+                    }
+                    t_pos++;
+                } else {
+                    s_pos++;
+                }
+            }
+        }
+        segment(b);
+    }
+
+    /**
+     * @brief Position of the first element with value `v` at or after `i`.
+     *
+     * Uncompressed data is scanned a word at a time, taking buffered
+     * operations into account without committing them. Run-length encoded
+     * leaves are scanned a run at a time.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    template <bool v>
+    uint32_t next_bit(uint32_t i) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return c_next_bit<v>(i);
+            }
+        }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
+        uint32_t t_pos = 0;
+        uint32_t s_pos = 0;
+        // Search logical positions [i, e) among those stored from s_pos.
+        auto segment = [&](uint32_t e) {
+            uint32_t lo = i > t_pos ? i : t_pos;
+            if (lo >= e) return size_;
+            uint32_t end = s_pos + e - t_pos;
+            uint32_t r = find_next<v>(data_, s_pos + lo - t_pos, end);
+            return r < end ? r - s_pos + t_pos : size_;
+        };
+        if constexpr (buffer_size != 0) {
+            for (uint8_t b = 0; b < buffer_count_; b++) {
+                uint32_t e = buffer_index(buf[b]);
+                uint32_t r = segment(e);
+                if (r < size_) {
+                    return r;
+                }
+                s_pos += e - t_pos;
+                t_pos = e;
+                if (buffer_is_insertion(buf[b])) {
+                    if (e >= i && buffer_value(buf[b]) == v) {
+                        return e;
+                    }
+                    t_pos++;
+                } else {
+                    s_pos++;
+                }
+            }
+        }
+        return segment(size_);
+    }
+
+    /**
+     * @brief Position of the last element with value `v` at or before `i`.
+     *
+     * Works like `next_bit`.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param i Start position of the search. Requires \f$i < \f$ `size()`.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    template <bool v>
+    uint32_t prev_bit(uint32_t i) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return c_prev_bit<v>(i);
+            }
+        }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
+        uint32_t res = size_;
+        uint32_t t_pos = 0;
+        uint32_t s_pos = 0;
+        // Search logical positions [t_pos, min(e, i + 1)).
+        auto segment = [&](uint32_t e) {
+            uint32_t hi = e < i + 1 ? e : i + 1;
+            if (t_pos >= hi) return;
+            uint32_t end = s_pos + hi - t_pos;
+            uint32_t r = find_prev<v>(data_, s_pos, end);
+            if (r < end) {
+                res = r - s_pos + t_pos;
+            }
+        };
+        if constexpr (buffer_size != 0) {
+            for (uint8_t b = 0; b < buffer_count_; b++) {
+                uint32_t e = buffer_index(buf[b]);
+                if (e > i) {
+                    [[unlikely]] break;
+                }
+                segment(e);
+                s_pos += e - t_pos;
+                t_pos = e;
+                if (buffer_is_insertion(buf[b])) {
+                    if (buffer_value(buf[b]) == v) {
+                        res = e;
+                    }
+                    t_pos++;
+                } else {
+                    s_pos++;
+                }
+            }
+        }
+        segment(size_);
+        return res;
+    }
+
+    /**
+     * @brief Index of the x<sup>th</sup> 0-bit at or after position `pos`.
+     *
+     * Works like `next_bit`, counting 0-bits a word at a time and taking
+     * buffered operations into account without committing them. Run-length
+     * encoded leaves are scanned a run at a time.
+     *
+     * @param x   Selection target. Requires at least x 0-bits in
+     *            \f$[\mathrm{pos}, \mathrm{size()})\f$.
+     * @param pos Start position of the search.
+     *
+     * @return Position of the x<sup>th</sup> 0-bit counting from `pos`.
+     */
+    uint32_t select0(uint32_t x, uint32_t pos = 0) const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return c_select0(x, pos);
+            }
+        }
+        uint32_t scratch[buffer_size ? buffer_size : 1];
+        const uint32_t* buf = query_buffer(scratch);
+        uint32_t t_pos = 0;
+        uint32_t s_pos = 0;
+        // Search logical positions [pos, e) among those stored from s_pos.
+        auto segment = [&](uint32_t e) {
+            uint32_t lo = pos > t_pos ? pos : t_pos;
+            if (lo >= e) return size_;
+            uint32_t end = s_pos + e - t_pos;
+            uint32_t r = find_nth<false>(data_, s_pos + lo - t_pos, end, x);
+            return r < end ? r - s_pos + t_pos : size_;
+        };
+        if constexpr (buffer_size != 0) {
+            for (uint8_t b = 0; b < buffer_count_; b++) {
+                uint32_t e = buffer_index(buf[b]);
+                uint32_t r = segment(e);
+                if (r < size_) {
+                    return r;
+                }
+                s_pos += e - t_pos;
+                t_pos = e;
+                if (buffer_is_insertion(buf[b])) {
+                    if (e >= pos && !buffer_value(buf[b]) && --x == 0) {
+                        return e;
+                    }
+                    t_pos++;
+                } else {
+                    s_pos++;
+                }
+            }
+        }
+        return segment(size_);
+    }
+
+    bool is_compressed() const {
+        if constexpr (compressed) {
+            return (type_info_ & C_TYPE_MASK) == C_TYPE_MASK;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Convert a run-length encoded leaf to a plain bit leaf.
+     *
+     * **Will not** ensure sufficient capacity. The leaf needs room for
+     * `size()` bits.
+     */
+    void uncompress() {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                flatten();
+            }
+        }
+    }
+
+    /**
+     * @brief Ensure that the leaf is in a valid state.
+     *
+     * Will use assertions to check that the actual stored data agrees with
+     * stored metadata. Will not in any way that the leaf is in the correct
+     * state given the preceding sequence of operations, just that the leaf is
+     * in a state that is valid for a leaf.
+     *
+     * If the compiler flag `-DNDEBUG` is given, this function will do nothing
+     * and may be completely optimized out by an optimizing compiler.
+     *
+     * @return 1 for calculating the number of nodes in the tree.
+     */
+    uint32_t validate() const {
+        if (is_compressed()) {
+            assert(size_ <= (~uint32_t(0) >> 1));
+        } else {
+            assert(size_ <= capacity_ * WORD_BITS);
+        }
+        assert(p_sum_ <= size_);
+        assert(p_sum_ == rank(size_));
+        if (is_compressed()) {
+            bool rem = type_info_ & C_RUN_REMOVAL_MASK;
+            uint8_t* data = reinterpret_cast<uint8_t*>(data_);
+            for (size_t i = run_index_[0]; i < 8 * capacity_; i++) {
+                assert(data[i] == 0);
+            }
+            uint32_t d_idx = 0;
+            uint32_t c_size = buffer_count_;
+            uint32_t c_sum = 0;
+            for (size_t i = 0; i < buffer_count_; i++) {
+                c_sum += buffer_[i] >> 31;
+            }
+            bool val = type_info_ & C_ONE_MASK;
+            while (d_idx < run_index_[0]) {
+                uint32_t rl = 0;
+                if ((data[d_idx] & 0b11000000) == 0b11000000) {
+                    rl = data[d_idx++] & 0b00111111;
+                } else if ((data[d_idx] >> 7) == 0) {
+                    rl = data[d_idx++] << 24;
+                    rl |= data[d_idx++] << 16;
+                    rl |= data[d_idx++] << 8;
+                    rl |= data[d_idx++];
+                } else if ((data[d_idx] & 0b10100000) == 0b10100000) {
+                    rl = (data[d_idx++] & 0b00011111) << 16;
+                    rl |= data[d_idx++] << 8;
+                    rl |= data[d_idx++];
+                } else {
+                    rl = (data[d_idx++] & 0b00011111) << 8;
+                    rl |= data[d_idx++];
+                }
+                if (!rem) {
+                    assert(rl > 0);
+                }
+                c_size += rl;
+                c_sum += val * rl;
+                val = !val;
+            }
+            assert(c_size == size_);
+            return 1;
+        }
+        uint32_t u_loc = size_;
+        for (uint8_t i = 0; i < buffer_count_; i++) {
+            if (buffer_is_insertion(buffer_[i])) {
+                u_loc--;
+            } else {
+                u_loc++;
+            }
+        }
+        uint32_t last_word = u_loc / WORD_BITS;
+        uint32_t overflow = u_loc % WORD_BITS;
+        if (overflow != 0) {
+            uint64_t val = (MASK << overflow) - 1;
+            val = (~val) & data_[last_word];
+            assert(val == 0u);
+            last_word++;
+        }
+        for (uint32_t i = last_word; i < capacity_; i++) {
+            assert(data_[i] == 0);
+        }
+        return 1;
+    }
+
+    /**
+     * @brief Output data stored in the leaf as json.
+     *
+     * Will output valid json, but will not output a trailing newline since the
+     * call is expected to be part of a recursive tree traversal.
+     *
+     * @param internal_only Will not output raw data if true to save space.
      */
     void print(bool internal_only = true) const {
         if (is_compressed()) {
@@ -1725,6 +2451,298 @@ class leaf : uncopyable {
     }
 
    private:
+    /**
+     * @brief Number of words of `data_` that may contain content.
+     *
+     * For run-length encoded leaves this covers the run bytes. Otherwise
+     * buffered removals may leave up to `buffer_count_` committed bits past
+     * `size_`.
+     */
+    uint16_t used_words() const {
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                return (run_index_[0] + 7) / 8;
+            }
+        }
+        uint32_t words = (size_ + buffer_count_ + WORD_BITS - 1) / WORD_BITS;
+        return words < capacity_ ? words : capacity_;
+    }
+
+    /**
+     * @brief Copy "elems" bits from "source" to "target".
+     *
+     * Bits are read starting from bit position "offset" in "source" and
+     * written starting from bit position "t_pos" in "target". The target bits
+     * are expected to be zero before writing.
+     *
+     * @param target Target array.
+     * @param t_pos  Bit position in "target" to start writing to.
+     * @param source Source array.
+     * @param offset Bit position in "source" to start reading from.
+     * @param elems  Number of bits to copy.
+     *
+     * @return Number of 1-bits copied.
+     */
+    static uint32_t write_bits(uint64_t* target, uint32_t t_pos,
+                               const uint64_t* source, uint64_t offset,
+                               uint32_t elems) {
+        uint32_t ret = 0;
+        source += offset / WORD_BITS;
+        uint32_t s_offset = offset % WORD_BITS;
+        uint32_t t_word = t_pos / WORD_BITS;
+        uint32_t t_offset = t_pos % WORD_BITS;
+        while (elems > 0) {
+            uint32_t bits = elems < WORD_BITS ? elems : WORD_BITS;
+            uint64_t w = *source >> s_offset;
+            if (s_offset != 0 && s_offset + bits > WORD_BITS) {
+                w |= source[1] << (WORD_BITS - s_offset);
+            }
+            if (bits < WORD_BITS) {
+                [[unlikely]] w &= (MASK << bits) - 1;
+            }
+            ret += __builtin_popcountll(w);
+            if (t_offset == 0) {
+                [[unlikely]] target[t_word] = w;
+            } else {
+                target[t_word] |= w << t_offset;
+                if (t_offset + bits > WORD_BITS) {
+                    target[t_word + 1] |= w >> (WORD_BITS - t_offset);
+                }
+            }
+            t_word++;
+            source++;
+            elems -= bits;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Call `fn` for each 1-bit in the \f$[\mathrm{from},
+     * \mathrm{to})\f$ range of `source`.
+     *
+     * The 1-bit at `from` is reported as `base`, the bit following that as
+     * `base + 1` and so on.
+     *
+     * @tparam F Callable taking a `uint64_t` position.
+     *
+     * @param source Bits to scan.
+     * @param from   Start of range.
+     * @param to     End of range. Requires \f$\mathrm{from} <
+     *               \mathrm{to}\f$.
+     * @param base   Reported position for `from`.
+     * @param fn     Function to call.
+     */
+    template <class F>
+    static void scan_ones(const uint64_t* source, uint32_t from, uint32_t to,
+                          uint64_t base, F& fn) {
+        uint32_t first = from / WORD_BITS;
+        uint32_t last = (to - 1) / WORD_BITS;
+        // Unsigned wrap around is fine here, since only the sum is used.
+        uint64_t shift = base - from;
+        for (uint32_t i = first; i <= last; i++) {
+            uint64_t w = source[i];
+            if (i == first) {
+                w &= (~uint64_t(0)) << (from % WORD_BITS);
+            }
+            if (i == last && to % WORD_BITS != 0) {
+                w &= (MASK << (to % WORD_BITS)) - 1;
+            }
+            while (w) {
+                fn(shift + i * WORD_BITS + __builtin_ctzll(w));
+                w &= w - 1;
+            }
+        }
+    }
+
+    /**
+     * @brief Position of the first element with value `v` in the
+     * \f$[\mathrm{from}, \mathrm{to})\f$ range of `source`.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param source Bits to scan.
+     * @param from   Start of range.
+     * @param to     End of range. Requires \f$\mathrm{from} <
+     *               \mathrm{to}\f$.
+     *
+     * @return Found position or `to` if there is none.
+     */
+    template <bool v>
+    static uint32_t find_next(const uint64_t* source, uint32_t from,
+                              uint32_t to) {
+        uint32_t i = from / WORD_BITS;
+        uint32_t last = (to - 1) / WORD_BITS;
+        uint64_t w = (v ? source[i] : ~source[i]) &
+                     ((~uint64_t(0)) << (from % WORD_BITS));
+        while (w == 0) {
+            if (++i > last) {
+                return to;
+            }
+            w = v ? source[i] : ~source[i];
+        }
+        uint32_t pos = i * WORD_BITS + __builtin_ctzll(w);
+        return pos < to ? pos : to;
+    }
+
+    /**
+     * @brief Position of the k<sup>th</sup> element with value `v` in the
+     * \f$[\mathrm{from}, \mathrm{to})\f$ range of `source`.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param source Bits to scan.
+     * @param from   Start of range.
+     * @param to     End of range.
+     * @param k      Selection target. Decreased by the number of elements
+     *               with value `v` in the range if there are fewer than k.
+     *
+     * @return Found position or `to` if there is none.
+     */
+    template <bool v>
+    static uint32_t find_nth(const uint64_t* source, uint32_t from,
+                             uint32_t to, uint32_t& k) {
+        if (from >= to) {
+            return to;
+        }
+        uint32_t i = from / WORD_BITS;
+        uint32_t pos = i * WORD_BITS;
+        uint64_t w = (v ? source[i] : ~source[i]) &
+                     ((~uint64_t(0)) << (from % WORD_BITS));
+        while (true) {
+            if (to - pos < WORD_BITS) {
+                w &= (MASK << (to - pos)) - 1;
+            }
+            uint32_t p = __builtin_popcountll(w);
+            if (p >= k) {
+                return pos + __builtin_ctzll(_pdep_u64(MASK << (k - 1), w));
+            }
+            k -= p;
+            pos += WORD_BITS;
+            if (pos >= to) {
+                return to;
+            }
+            i++;
+            w = v ? source[i] : ~source[i];
+        }
+    }
+
+    /**
+     * @brief Position of the last element with value `v` in the
+     * \f$[\mathrm{from}, \mathrm{to})\f$ range of `source`.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param source Bits to scan.
+     * @param from   Start of range.
+     * @param to     End of range. Requires \f$\mathrm{from} <
+     *               \mathrm{to}\f$.
+     *
+     * @return Found position or `to` if there is none.
+     */
+    template <bool v>
+    static uint32_t find_prev(const uint64_t* source, uint32_t from,
+                              uint32_t to) {
+        uint32_t i = (to - 1) / WORD_BITS;
+        uint32_t first = from / WORD_BITS;
+        uint64_t w = v ? source[i] : ~source[i];
+        if (to % WORD_BITS != 0) {
+            w &= (MASK << (to % WORD_BITS)) - 1;
+        }
+        while (w == 0) {
+            if (i == first) {
+                return to;
+            }
+            i--;
+            w = v ? source[i] : ~source[i];
+        }
+        uint32_t pos = i * WORD_BITS + WORD_BITS - 1 - __builtin_clzll(w);
+        return pos >= from ? pos : to;
+    }
+
+    /**
+     * @brief Shared implementation of `set_range` and `flip_range`.
+     *
+     * @tparam flip Invert elements instead of setting them to "v".
+     *
+     * @param a Start of range.
+     * @param b End of range.
+     * @param v Value to set elements to.
+     *
+     * @return Change in the number of 1-bits.
+     */
+    template <bool flip>
+    int32_t update_range(uint32_t a, uint32_t b, bool v) {
+        assert(a <= b && b <= size_);
+        if (a == b) return 0;
+        if constexpr (compressed) {
+            if (is_compressed()) {
+                c_commit();
+                if (is_compressed()) {
+                    if constexpr (flip) {
+                        return c_rewrite(a, b, 0, v, true);
+                    } else {
+                        return c_rewrite(a, b, b - a, v, false);
+                    }
+                }
+            }
+        }
+        commit<false>();
+        int32_t change = 0;
+        uint32_t w_idx = a / WORD_BITS;
+        uint32_t l_idx = (b - 1) / WORD_BITS;
+        for (; w_idx <= l_idx; w_idx++) {
+            uint64_t mask = ~uint64_t(0);
+            if (w_idx == a / WORD_BITS) mask <<= a % WORD_BITS;
+            if (w_idx == l_idx && b % WORD_BITS) {
+                mask &= (MASK << (b % WORD_BITS)) - 1;
+            }
+            int32_t old = __builtin_popcountll(data_[w_idx] & mask);
+            if constexpr (flip) {
+                data_[w_idx] ^= mask;
+                change += __builtin_popcountll(mask) - 2 * old;
+            } else if (v) {
+                data_[w_idx] |= mask;
+                change += __builtin_popcountll(mask) - old;
+            } else {
+                data_[w_idx] &= ~mask;
+                change -= old;
+            }
+        }
+        p_sum_ += change;
+        return change;
+    }
+
+    /**
+     * @brief Set "elems" bits of "target" starting from "t_pos".
+     *
+     * Counterpart of `write_bits` for runs of 1-bits. Whole words are written
+     * at a time.
+     *
+     * @param target Pointer to target data.
+     * @param t_pos  Bit position in "target" to start writing to.
+     * @param elems  Number of bits to set.
+     */
+    static void set_bits(uint64_t* target, uint32_t t_pos, uint32_t elems) {
+        uint32_t t_word = t_pos / WORD_BITS;
+        uint32_t t_offset = t_pos % WORD_BITS;
+        if (t_offset != 0) {
+            uint32_t bits = WORD_BITS - t_offset;
+            if (elems < bits) {
+                target[t_word] |= ((MASK << elems) - 1) << t_offset;
+                [[unlikely]] return;
+            }
+            target[t_word++] |= (~uint64_t(0)) << t_offset;
+            elems -= bits;
+        }
+        while (elems >= WORD_BITS) {
+            target[t_word++] = ~uint64_t(0);
+            elems -= WORD_BITS;
+        }
+        if (elems > 0) {
+            target[t_word] |= (MASK << elems) - 1;
+        }
+    }
+
     /**
      * @brief Extract the value of a buffer element
      *
@@ -1781,6 +2799,38 @@ class leaf : uncopyable {
         buffer_[i] = (v << 8) | (buffer_[i] & INDEX_MASK);
     }
 
+    /**
+     * @brief Buffer elements in the sorted form expected by queries.
+     *
+     * Sorted buffers are returned as is. Unsorted buffers only contain
+     * insertions in arrival order, indexed by the position at the time of
+     * insertion. These are converted into sorted elements indexed by current
+     * position in `scratch`, without modifying the leaf, so that const
+     * queries are safe to run concurrently.
+     *
+     * @param scratch Room for `buffer_count_` elements.
+     *
+     * @return Pointer to `buffer_count_` sorted buffer elements.
+     */
+    const uint32_t* query_buffer(uint32_t* scratch) const {
+        if constexpr (sorted_buffers) {
+            return buffer_;
+        }
+        for (uint8_t j = 0; j < buffer_count_; j++) {
+            // Later insertions at or before the element shift it right.
+            uint32_t idx = buffer_index(buffer_[j]);
+            for (uint8_t k = j + 1; k < buffer_count_; k++) {
+                idx += buffer_index(buffer_[k]) <= idx;
+            }
+            uint8_t k = j;
+            for (; k > 0 && buffer_index(scratch[k - 1]) > idx; k--) {
+                scratch[k] = scratch[k - 1];
+            }
+            scratch[k] = (idx << 8) | (buffer_[j] & INDEX_MASK);
+        }
+        return scratch;
+    }
+
     /**
      * @brief Creates a new 32-bit buffer element with the given parameters.
      *
@@ -1909,6 +2959,11 @@ class leaf : uncopyable {
         if (buffer_count_ == 0) [[unlikely]] {
             return;
         }
+        if constexpr (!sorted_buffers) {
+            uint32_t scratch[buffer_size];
+            memcpy(buffer_, query_buffer(scratch),
+                   buffer_count_ * sizeof(uint32_t));
+        }
             
         uint32_t overflow = 0;
         uint8_t overflow_length = 0;
@@ -2078,6 +3133,132 @@ class leaf : uncopyable {
         }
     }
 
+    void c_insert_run(uint32_t i, bool v, uint32_t elems) {
+        // Buffered insertions refer to final positions, so only the position
+        // in the run encoding needs to account for preceding buffer elements.
+        uint32_t q_i = i;
+        for (uint8_t b_idx = 0; b_idx < buffer_count_; b_idx++) {
+            uint32_t e_index = buffer_[b_idx] & C_INDEX;
+            if (e_index < i) {
+                q_i--;
+            } else {
+                buffer_[b_idx] += elems;
+            }
+        }
+        c_rewrite(q_i, q_i, elems, v, false);
+    }
+
+    /**
+     * @brief Rewrite the run encoding with a modified range.
+     *
+     * Elements in \f$[a, b)\f$ of the run encoding are either removed or,
+     * if "flip" is set, inverted. A run of "ins" copies of "v" is inserted at
+     * "a". Output runs are merged with the preceding run if values match,
+     * which also drops any empty runs left behind by removals.
+     *
+     * Positions refer to the run encoding only, so buffered elements need to
+     * be accounted for by the caller.
+     *
+     * @param a    Start of modified range.
+     * @param b    End of modified range.
+     * @param ins  Length of run to insert at "a".
+     * @param v    Value of run to insert.
+     * @param flip Invert instead of removing elements in the range.
+     *
+     * @return Change in the number of 1-bits.
+     */
+    int32_t c_rewrite(uint32_t a, uint32_t b, uint32_t ins, bool v,
+                      bool flip) {
+        bool val = type_info_ & C_ONE_MASK;
+        type_info_ &= 0b00011111;
+        uint8_t* data = reinterpret_cast<uint8_t*>(data_);
+        uint32_t d_idx = 0;
+        uint32_t c_i = 0;
+        uint32_t elem_count = 0;
+        uint32_t r_len = 0;
+        uint32_t r_ones = 0;
+        bool done = false;
+        bool first = v;
+        bool p_val = v;
+        uint32_t p_len = 0;
+        auto emit = [&](bool r_val, uint32_t rl) {
+            if (rl == 0) return;
+            if (p_len == 0) {
+                first = elem_count == 0 ? r_val : first;
+            } else if (p_val != r_val) {
+                elem_count = write_scratch(p_len, elem_count);
+                p_len = 0;
+            }
+            p_val = r_val;
+            p_len += rl;
+        };
+#pragma GCC diagnostic ignored "-Warray-bounds"
+        while (d_idx < run_index_[0]) {
+#pragma GCC diagnostic pop
+            uint32_t rl = 0;
+            if ((data[d_idx] & 0b10000000) == 0) {
+                rl = data[d_idx++] << 24;
+                rl |= data[d_idx++] << 16;
+                rl |= data[d_idx++] << 8;
+                rl |= data[d_idx++];
+            } else if ((data[d_idx] & 0b11000000) == 0b11000000) {
+                rl = data[d_idx++] & 0b00111111;
+            } else if ((data[d_idx] & 0b10100000) == 0b10100000) {
+                rl = (data[d_idx++] & 0b00011111) << 16;
+                rl |= data[d_idx++] << 8;
+                rl |= data[d_idx++];
+            } else {
+                rl = (data[d_idx++] & 0b00011111) << 8;
+                rl |= data[d_idx++];
+            }
+            uint32_t r_end = c_i + rl;
+            if (c_i < a) {
+                emit(val, (r_end < a ? r_end : a) - c_i);
+            }
+            if (!done && a <= r_end) {
+                emit(v, ins);
+                [[unlikely]] done = true;
+            }
+            uint32_t i_start = c_i > a ? c_i : a;
+            uint32_t i_end = r_end < b ? r_end : b;
+            if (i_start < i_end) {
+                r_len += i_end - i_start;
+                r_ones += val ? i_end - i_start : 0;
+                if (flip) emit(!val, i_end - i_start);
+            }
+            if (c_i < b) c_i = b;
+            if (c_i < r_end) {
+                emit(val, r_end - c_i);
+            }
+            c_i = r_end;
+            val = !val;
+        }
+        if (!done) {
+            emit(v, ins);
+        }
+        if (p_len > 0) {
+            elem_count = write_scratch(p_len, elem_count);
+        }
+        type_info_ &= ~(C_ONE_MASK | C_RUN_REMOVAL_MASK);
+        type_info_ |= first ? C_ONE_MASK : 0;
+        assert(capacity_ * 8 >= elem_count);
+        memcpy(data_, data_scratch, elem_count);
+        memset(data + elem_count, 0, 8 * capacity_ - elem_count);
+#pragma GCC diagnostic ignored "-Warray-bounds"
+        run_index_[0] = elem_count;
+#pragma GCC diagnostic pop
+        int32_t change = v ? ins : 0;
+        if (flip) {
+            change += r_len - 2 * r_ones;
+        } else {
+            size_ -= r_len;
+            change -= r_ones;
+        }
+        size_ += ins;
+        p_sum_ += change;
+        return change;
+    }
+
     bool c_remove(uint32_t i) {
         uint32_t q_i = i;
         bool done = false;
@@ -2247,6 +3428,115 @@ class leaf : uncopyable {
         return count;
     }
 
+    /**
+     * @brief Call `fn(start, length, value)` for each run of the compressed
+     * leaf in order.
+     *
+     * Buffered insertions are merged in and reported as runs of length 1, so
+     * consecutive calls may have the same value. Iteration stops early if
+     * `fn` returns false.
+     *
+     * @tparam F Callable taking `(uint32_t, uint32_t, bool)` returning bool.
+     *
+     * @param fn Function to call.
+     */
+    template <class F>
+    void c_runs(F fn) const {
+        uint8_t b_idx = 0;
+        uint32_t loc = 0;
+        bool val = type_info_ & C_ONE_MASK;
+        uint8_t* data = reinterpret_cast<uint8_t*>(data_);
+        uint32_t d_idx = 0;
+        while (d_idx < run_index_[0]) {
+            uint32_t rl = 0;
+            if ((data[d_idx] & 0b11000000) == 0b11000000) {
+                rl = data[d_idx++] & 0b00111111;
+            } else if ((data[d_idx] & 0b10000000) == 0) {
+                rl = data[d_idx++] << 24;
+                rl |= data[d_idx++] << 16;
+                rl |= data[d_idx++] << 8;
+                rl |= data[d_idx++];
+            } else if ((data[d_idx] & 0b10100000) == 0b10100000) {
+                rl = (data[d_idx++] & 0b00011111) << 16;
+                rl |= data[d_idx++] << 8;
+                rl |= data[d_idx++];
+            } else {
+                rl = (data[d_idx++] & 0b00011111) << 8;
+                rl |= data[d_idx++];
+            }
+            // Buffered insertions split the run.
+            while (b_idx < buffer_count_ &&
+                   (buffer_[b_idx] & C_INDEX) < loc + rl) {
+                uint32_t part = (buffer_[b_idx] & C_INDEX) - loc;
+                if (part > 0 && !fn(loc, part, val)) return;
+                loc += part;
+                rl -= part;
+                if (!fn(loc++, 1, buffer_[b_idx++] >> 31)) return;
+            }
+            if (rl > 0 && !fn(loc, rl, val)) return;
+            loc += rl;
+            val = !val;
+        }
+        for (; b_idx < buffer_count_; b_idx++) {
+            if (!fn(loc++, 1, buffer_[b_idx] >> 31)) return;
+        }
+    }
+
+    template <class F>
+    void c_for_each_one(uint32_t a, uint32_t b, uint64_t offset,
+                        F& fn) const {
+        c_runs([&](uint32_t start, uint32_t rl, bool val) {
+            if (start >= b) return false;
+            if (val) {
+                uint32_t lo = a > start ? a : start;
+                uint32_t hi = b < start + rl ? b : start + rl;
+                for (uint32_t i = lo; i < hi; i++) {
+                    fn(offset + i);
+                }
+            }
+            return true;
+        });
+    }
+
+    template <bool v>
+    uint32_t c_next_bit(uint32_t i) const {
+        uint32_t res = size_;
+        c_runs([&](uint32_t start, uint32_t rl, bool val) {
+            if (val != v || start + rl <= i) return true;
+            res = start > i ? start : i;
+            return false;
+        });
+        return res;
+    }
+
+    template <bool v>
+    uint32_t c_prev_bit(uint32_t i) const {
+        uint32_t res = size_;
+        c_runs([&](uint32_t start, uint32_t rl, bool val) {
+            if (start > i) return false;
+            if (val == v) {
+                res = start + rl - 1 < i ? start + rl - 1 : i;
+            }
+            return true;
+        });
+        return res;
+    }
+
+    uint32_t c_select0(uint32_t x, uint32_t pos) const {
+        uint32_t res = size_;
+        c_runs([&](uint32_t start, uint32_t rl, bool val) {
+            if (val || start + rl <= pos) return true;
+            uint32_t lo = start > pos ? start : pos;
+            if (start + rl - lo >= x) {
+                res = lo + x - 1;
+                return false;
+            }
+            x -= start + rl - lo;
+            return true;
+        });
+        return res;
+    }
+
     uint32_t c_select(uint32_t x) const {
         // std::cout << "c_select(" << x << ") called" << std::endl;
         bool val = type_info_ & C_ONE_MASK;
@@ -2785,7 +4075,7 @@ class leaf : uncopyable {
         return elem_count;
     }
 
-    uint64_t c_dump(uint64_t* target, uint64_t start) {
+    uint64_t c_dump(uint64_t* target, uint64_t start) const {
         uint8_t b_idx = 0;
         uint32_t e_idx = buffer_[b_idx] & C_INDEX;
         bool val = type_info_ & C_ONE_MASK;
@@ -2804,11 +4094,11 @@ class leaf : uncopyable {
                 rl |= data[d_idx++] << 8;
                 rl |= data[d_idx++];
             } else if ((data[d_idx] & 0b10100000) == 0b10100000) {
-                rl = data[d_idx++] << 16;
+                rl = (data[d_idx++] & 0b00011111) << 16;
                 rl |= data[d_idx++] << 8;
                 rl |= data[d_idx++];
             } else {
-                rl = data[d_idx++] << 8;
+                rl = (data[d_idx++] & 0b00011111) << 8;
                 rl |= data[d_idx++];
             }
             while (b_idx < buffer_count_ && loc + rl > e_idx) {
@@ -2834,8 +4124,10 @@ class leaf : uncopyable {
                         target[w_idx] = (MASK << write) - 1;
                     }
                 }
-                target[loc / WORD_BITS] |= uint64_t(buffer_[b_idx++] >> 31)
-                                           << (loc++ % WORD_BITS);
+                target[start / WORD_BITS] |= uint64_t(buffer_[b_idx++] >> 31)
+                                             << (start % WORD_BITS);
+                loc++;
+                start++;
                 e_idx = b_idx < buffer_count_ ? buffer_[b_idx] & C_INDEX : 0;
                 w_idx = start / WORD_BITS;
                 offset = start % WORD_BITS;
@@ -2864,6 +4156,12 @@ class leaf : uncopyable {
             offset = start % WORD_BITS;
             val = !val;
         }
+        // Insertions after the last run.
+        while (b_idx < buffer_count_) {
+            target[start / WORD_BITS] |= uint64_t(buffer_[b_idx++] >> 31)
+                                         << (start % WORD_BITS);
+            start++;
+        }
         return start;
     }
 
@@ -0,0 +1,347 @@
+#ifndef BV_MAPPED_BIT_VECTOR_HPP
+#define BV_MAPPED_BIT_VECTOR_HPP
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "branch_selection.hpp"
+#include "libpopcnt.h"
+#include "serialize.hpp"
+#include "uncopyable.hpp"
+
+namespace bv {
+
+/**
+ * @brief Current version of the layout written by
+ * `bit_vector::serialize_mapped`.
+ */
+static const constexpr uint32_t MAPPED_FORMAT_VERSION = 1;
+
+/**
+ * @brief File header of a mapped bit vector.
+ *
+ * `root` is the file offset of the root record, which is either a
+ * bv::mapped_node or a bv::mapped_leaf.
+ */
+struct mapped_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t branches;
+    uint32_t dtype_bytes;
+    uint32_t root_is_leaf;
+    uint64_t size;
+    uint64_t sum;
+    uint64_t root;
+
+    /** @brief Identifies mapped bit vector files. */
+    static const constexpr char MAGIC[8] = {'b', 'v', 'm', 'a',
+                                            'p', 0,   0,   0};
+};
+
+/**
+ * @brief Internal node record of a mapped bit vector.
+ *
+ * Mirrors bv::node, with file offsets in place of child pointers. The
+ * cumulative sizes and sums are stored as complete bv::branchless_scan
+ * instances, so that branching can be done directly on the mapping.
+ */
+template <class dtype, uint8_t branches>
+struct mapped_node : uncopyable {
+    branchless_scan<dtype, branches> sizes;
+    branchless_scan<dtype, branches> sums;
+    uint64_t children[branches];  ///< File offsets of children.
+    uint8_t child_count;
+    bool has_leaves;
+
+    mapped_node() : sizes(), sums(), children(), child_count(0), has_leaves() {}
+};
+
+/**
+ * @brief Leaf record of a mapped bit vector.
+ *
+ * The logical contents of the leaf are stored as plain bits directly
+ * following the record, with leaf buffers applied and run-length encoding
+ * decoded.
+ */
+struct mapped_leaf : uncopyable {
+    uint32_t size;
+    uint32_t p_sum;
+
+    /** @brief Bits of the leaf. */
+    const uint64_t* data() const {
+        return reinterpret_cast<const uint64_t*>(this + 1);
+    }
+
+    bool at(uint32_t i) const { return (data()[i / 64] >> (i % 64)) & 1; }
+
+    uint32_t rank(uint32_t i) const {
+        const uint64_t* d = data();
+        uint32_t words = i / 64;
+        uint32_t count = words ? pop::popcnt(d, words * 8) : 0;
+        if (i % 64) {
+            count += __builtin_popcountll(d[words] &
+                                          ((uint64_t(1) << (i % 64)) - 1));
+        }
+        return count;
+    }
+
+    uint32_t select(uint32_t count) const {
+        const uint64_t* d = data();
+        uint32_t w = 0;
+        uint32_t pop = __builtin_popcountll(d[w]);
+        while (pop < count) {
+            count -= pop;
+            pop = __builtin_popcountll(d[++w]);
+        }
+        return w * 64 +
+               __builtin_ctzll(_pdep_u64(uint64_t(1) << (count - 1), d[w]));
+    }
+};
+
+/**
+ * @brief Pad `out` to the next cache line boundary.
+ *
+ * @param out Stream being written.
+ * @param pos Current position in the stream. Updated to the padded position.
+ */
+inline void mapped_align(std::ostream& out, uint64_t& pos) {
+    static const constexpr char zeros[CACHE_LINE] = {};
+    uint64_t pad = (CACHE_LINE - pos % CACHE_LINE) % CACHE_LINE;
+    write_raw(out, zeros, pad);
+    pos += pad;
+}
+
+/**
+ * @brief Write a bv::mapped_leaf record for `leaf` at the next cache line
+ * boundary.
+ *
+ * @tparam leaf_type Leaf type supporting `copy_bits`.
+ * @param out  Stream to write to.
+ * @param pos  Current position in the stream. Updated past the record.
+ * @param leaf Leaf to write.
+ *
+ * @return File offset of the record.
+ */
+template <class leaf_type>
+uint64_t write_mapped_leaf(std::ostream& out, uint64_t& pos,
+                           const leaf_type* leaf) {
+    mapped_align(out, pos);
+    uint64_t offset = pos;
+    uint32_t header[] = {leaf->size(), leaf->p_sum()};
+    std::vector<uint64_t> bits(leaf->size() / 64 + 1);
+    leaf->copy_bits(bits.data());
+    write_raw(out, header, 2);
+    write_raw(out, bits.data(), bits.size());
+    pos += sizeof(header) + bits.size() * sizeof(uint64_t);
+    return offset;
+}
+
+/**
+ * @brief Write a bv::mapped_node record at the next cache line boundary.
+ *
+ * @return File offset of the record.
+ */
+template <class dtype, uint8_t branches>
+uint64_t write_mapped_node(std::ostream& out, uint64_t& pos,
+                           const mapped_node<dtype, branches>* node) {
+    mapped_align(out, pos);
+    uint64_t offset = pos;
+    write_raw(out, node);
+    pos += sizeof(*node);
+    return offset;
+}
+
+/**
+ * @brief Read-only bit vector answering queries directly from a memory
+ * mapped file.
+ *
+ * The file is written by `bit_vector::serialize_mapped` and mirrors the
+ * b-tree of the source bv::bit_vector, with file offsets in place of child
+ * pointers. Opening the file only maps it and checks the header, so opening
+ * is instant regardless of size, and pages are loaded on demand by queries.
+ *
+ * Queries descend the mapped tree with bv::branchless_scan::find over the
+ * mapped cumulative sizes and sums, and finish on plain leaf bits.
+ *
+ * The file contents beyond the header are trusted. Querying a corrupted file
+ * is undefined behaviour.
+ *
+ * @tparam dtype    Integer type used for indexing by the source bit vector.
+ * @tparam branches Branching factor of the source bit vector.
+ */
+template <class dtype, uint8_t branches>
+class mapped_bit_vector : uncopyable {
+   private:
+    typedef mapped_node<dtype, branches> node_type;
+
+    const uint8_t* base_;
+    size_t bytes_;
+    const mapped_header* header_;
+
+    const node_type* node_at(uint64_t offset) const {
+        return reinterpret_cast<const node_type*>(base_ + offset);
+    }
+
+    const mapped_leaf* leaf_at(uint64_t offset) const {
+        return reinterpret_cast<const mapped_leaf*>(base_ + offset);
+    }
+
+   public:
+    /**
+     * @brief Create a closed instance. Needs to be opened before querying.
+     */
+    mapped_bit_vector() : base_(nullptr), bytes_(0), header_(nullptr) {}
+
+    /**
+     * @brief Map the file at `path`.
+     *
+     * Check `is_open()` to see if mapping succeeded.
+     */
+    mapped_bit_vector(const std::string& path) : mapped_bit_vector() {
+        open(path);
+    }
+
+    ~mapped_bit_vector() { close(); }
+
+    /**
+     * @brief Map the file at `path` read-only.
+     *
+     * Any previously mapped file is unmapped first.
+     *
+     * @return False if the file could not be mapped, or was not written for
+     * a bit vector with matching `dtype` and `branches`.
+     */
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            [[unlikely]] return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(mapped_header)) {
+            ::close(fd);
+            [[unlikely]] return false;
+        }
+        void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            [[unlikely]] return false;
+        }
+        base_ = reinterpret_cast<const uint8_t*>(m);
+        bytes_ = st.st_size;
+        header_ = reinterpret_cast<const mapped_header*>(base_);
+        if (memcmp(header_->magic, mapped_header::MAGIC, 8) != 0 ||
+            header_->version != MAPPED_FORMAT_VERSION ||
+            header_->branches != branches ||
+            header_->dtype_bytes != sizeof(dtype) || header_->root >= bytes_) {
+            std::cerr << "Mapped file format or template parameters do not "
+                         "match"
+                      << std::endl;
+            close();
+            [[unlikely]] return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Unmap the file if one is mapped.
+     */
+    void close() {
+        if (base_ != nullptr) {
+            munmap(const_cast<uint8_t*>(base_), bytes_);
+        }
+        base_ = nullptr;
+        bytes_ = 0;
+        header_ = nullptr;
+    }
+
+    /** @brief True if a file is mapped. */
+    bool is_open() const { return base_ != nullptr; }
+
+    /** @brief Number of bits stored. */
+    dtype size() const { return header_->size; }
+
+    /** @brief Number of 1-bits stored. */
+    dtype sum() const { return header_->sum; }
+
+    /**
+     * @brief Value of the bit at position \f$i\f$.
+     */
+    bool at(dtype i) const {
+        uint64_t offset = header_->root;
+        if (!header_->root_is_leaf) {
+            const node_type* n = node_at(offset);
+            while (true) {
+                uint8_t c = n->sizes.find(i + 1);
+                i -= c != 0 ? n->sizes.get(c - 1) : 0;
+                offset = n->children[c];
+                if (n->has_leaves) break;
+                n = node_at(offset);
+            }
+        }
+        return leaf_at(offset)->at(i);
+    }
+
+    /**
+     * @brief Number of 1-bits before position \f$i\f$.
+     */
+    dtype rank(dtype i) const {
+        uint64_t offset = header_->root;
+        dtype res = 0;
+        if (!header_->root_is_leaf) {
+            const node_type* n = node_at(offset);
+            while (true) {
+                uint8_t c = n->sizes.find(i);
+                if (c != 0) {
+                    res += n->sums.get(c - 1);
+                    [[likely]] i -= n->sizes.get(c - 1);
+                }
+                offset = n->children[c];
+                if (n->has_leaves) break;
+                n = node_at(offset);
+            }
+        }
+        return res + leaf_at(offset)->rank(i);
+    }
+
+    /**
+     * @brief Position of the \f$i\f$<sup>th</sup> 1-bit.
+     */
+    dtype select(dtype i) const {
+        uint64_t offset = header_->root;
+        dtype res = 0;
+        if (!header_->root_is_leaf) {
+            const node_type* n = node_at(offset);
+            while (true) {
+                uint8_t c = n->sums.find(i);
+                if (c != 0) {
+                    res += n->sizes.get(c - 1);
+                    [[likely]] i -= n->sums.get(c - 1);
+                }
+                offset = n->children[c];
+                if (n->has_leaves) break;
+                n = node_at(offset);
+            }
+        }
+        return res + leaf_at(offset)->select(i);
+    }
+
+    /**
+     * @brief Size of the mapping in bits.
+     */
+    uint64_t bit_size() const { return bytes_ * 8; }
+};
+
+}  // namespace bv
+
+#endif
@@ -91,11 +91,14 @@ class leaf : uncopyable {
     /**
      * @brief Get the value of the i<sup>th</sup> element in the leaf.
      *
+     * Buffered elements are read from a sorted copy of the buffer, so the
+     * leaf is not modified and concurrent calls are safe.
+     *
      * @param i Index to check
      *
      * @return Value of bit at index i.
      */
-    bool at(uint32_t i) {
+    bool at(uint32_t i) const {
         if constexpr (compressed) {
             if (is_compressed()) {
                 return c_at(i);
@@ -104,7 +107,9 @@ class leaf : uncopyable {
         if constexpr (buffer_size != 0) {
             uint64_t index = i;
             typedef buffer<buffer_size, false, sorted_buffers> buf_t;
-            for (auto be : *reinterpret_cast<buf_t*>(buf_ptr_())) {
+            buf_t view =
+                reinterpret_cast<const buf_t*>(buf_ptr_())->sorted_copy();
+            for (auto be : view) {
                 if (be.index == i) {
                     if constexpr (!sorted_buffers) {
                         return be.value;
@@ -180,18 +185,18 @@ class leaf : uncopyable {
     }
 
     /** @brief Getter for p_sum_ */
-    uint32_t p_sum() { return p_sum_(); }
+    uint32_t p_sum() const { return p_sum_(); }
     /** @brief Getter for size_ */
-    uint32_t size() { return size_(); }
+    uint32_t size() const { return size_(); }
     /** @brief Getter for number of buffer elements */
-    uint8_t buffer_count() { 
+    uint8_t buffer_count() const {
         typedef buffer<buffer_size, compressed, sorted_buffers> buf_t;
-        return reinterpret_cast<buf_t*>(buf_ptr_())->size(); 
+        return reinterpret_cast<const buf_t*>(buf_ptr_())->size();
     }
     ///** @brief Get pointer to the buffer */
     //uint32_t* buffer() { return buffer_; }
     /** @brief Get the values for the first run */
-    bool first_value() {
+    bool first_value() const {
         if constexpr (compressed) {
             if (is_compressed()) {
                 return type_info_() & C_ONE_MASK;
@@ -200,7 +205,7 @@ class leaf : uncopyable {
         return at(0);
     }
     /** @brief Number of bytes used to encode content */
-    uint32_t used_bytes() {
+    uint32_t used_bytes() const {
         if constexpr (compressed) {
             if (is_compressed()) {
                 return run_index_();
@@ -249,7 +254,7 @@ class leaf : uncopyable {
     }
 
    private:
-    bool is_compressed() {
+    bool is_compressed() const {
         if constexpr (compressed) {
             return (type_info_() & C_TYPE_MASK) == C_TYPE_MASK;
         }
@@ -383,10 +388,11 @@ class leaf : uncopyable {
         }
     }
 
-    bool c_at(uint32_t i) {
+    bool c_at(uint32_t i) const {
         uint32_t i_q = i;
         typedef buffer<buffer_size, true, sorted_buffers> buf_t;
-        for (auto be : *reinterpret_cast<buf_t*>(buf_ptr_())) {
+        buf_t view = reinterpret_cast<const buf_t*>(buf_ptr_())->sorted_copy();
+        for (auto be : view) {
             if (be.index < i) [[likely]] {
                 i_q--;
             } else if (be.index == i) {
@@ -522,9 +528,9 @@ class leaf : uncopyable {
 #pragma GCC diagnostic pop
     }
 
-    uint32_t read_run(uint32_t& r_idx) {
+    uint32_t read_run(uint32_t& r_idx) const {
         uint32_t rl;
-        uint8_t* byte_data = reinterpret_cast<uint8_t*>(data_());
+        const uint8_t* byte_data = reinterpret_cast<const uint8_t*>(data_());
         if ((byte_data[r_idx] & 0b11000000) == 0b11000000) {
             rl = byte_data[r_idx++] & 0b00111111;
             // std::cout << "\t1 byte" << std::endl;
@@ -599,6 +605,25 @@ class leaf : uncopyable {
         const constexpr uint32_t offset = LEAF_BYTES / 8 + (LEAF_BYTES % 8 ? 1 : 0);
         return reinterpret_cast<uint64_t*>(members_) + offset;
     }
+
+    // Const accessors for the read path.
+    uint32_t size_() const {
+        return reinterpret_cast<const uint32_t*>(members_)[0];
+    }
+    uint32_t p_sum_() const {
+        return reinterpret_cast<const uint32_t*>(members_)[1];
+    }
+    uint32_t run_index_() const {
+        const constexpr uint32_t offset = compressed ? 3 : 0;
+        return reinterpret_cast<const uint32_t*>(members_)[offset];
+    }
+    const uint8_t* buf_ptr_() const {
+        return const_cast<leaf*>(this)->buf_ptr_();
+    }
+    uint8_t type_info_() const { return const_cast<leaf*>(this)->type_info_(); }
+    const uint64_t* data_() const {
+        return const_cast<leaf*>(this)->data_();
+    }
 };
 }  // namespace bv
 #endif
\ No newline at end of file
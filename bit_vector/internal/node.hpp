@@ -12,6 +12,8 @@
 #endif
 
 #include "branch_selection.hpp"
+#include "mapped_bit_vector.hpp"
+#include "serialize.hpp"
 #include "uncopyable.hpp"
 
 //#include "deb.hpp"
@@ -135,6 +137,86 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Adds leaves in this subtree to the given query support structure
+     * at known positions.
+     *
+     * Blocks are written based on the given position of the subtree, so
+     * disjoint subtrees may be added concurrently.
+     *
+     * @tparam qds  Type of query support structure.
+     * @param qs    Pointer to query support structure.
+     * @param p_size Number of elements preceding the subtree.
+     * @param p_sum  Number of 1-bits preceding the subtree.
+     */
+    template <class qds>
+    void place_query_structure(qds* qs, dtype p_size, dtype p_sum) {
+        for (uint8_t i = 0; i < child_count_; i++) {
+            dtype c_size = p_size + (i != 0 ? child_sizes_.get(i - 1) : 0);
+            dtype c_sum = p_sum + (i != 0 ? child_sums_.get(i - 1) : 0);
+            if (has_leaves()) {
+                qs->place(reinterpret_cast<leaf_type*>(children_[i]), c_size,
+                          c_sum);
+            } else {
+                reinterpret_cast<node*>(children_[i])
+                    ->place_query_structure(qs, c_size, c_sum);
+            }
+        }
+    }
+
+    /**
+     * @brief Adds leaves in this subtree starting from position `from` to the
+     * given query support structure.
+     *
+     * Used for partially rebuilding a query support structure. `from` is
+     * expected to be the first position of some leaf in the subtree.
+     *
+     * @tparam qds Type of query support structure.
+     * @param qs   Pointer to query support structure.
+     * @param from Position of the first leaf to add.
+     */
+    template <class qds>
+    void generate_query_structure(qds* qs, dtype from) {
+        if (from >= size()) return;
+        uint8_t i = child_sizes_.find(from + 1);
+        dtype offset = i != 0 ? child_sizes_.get(i - 1) : 0;
+        if (has_leaves()) {
+            leaf_type** children = reinterpret_cast<leaf_type**>(children_);
+            for (; i < child_count_; i++) {
+                qs->append(children[i]);
+            }
+        } else {
+            node** children = reinterpret_cast<node**>(children_);
+            children[i]->generate_query_structure(qs, from - offset);
+            for (i++; i < child_count_; i++) {
+                children[i]->generate_query_structure(qs);
+            }
+        }
+    }
+
+    /**
+     * @brief Locate the start of the leaf containing the index<sup>th</sup>
+     * element.
+     *
+     * @param index Index to locate.
+     * @param ones  Set to the number of 1-bits preceding the leaf.
+     *
+     * @return Position of the first element of the leaf.
+     */
+    dtype leaf_start(dtype index, dtype& ones) const {
+        uint8_t i = child_sizes_.find(index + 1);
+        dtype start = i != 0 ? child_sizes_.get(i - 1) : 0;
+        ones = i != 0 ? child_sums_.get(i - 1) : 0;
+        if (has_leaves()) {
+            return start;
+        }
+        dtype c_ones;
+        start += reinterpret_cast<node*>(children_[i])
+                     ->leaf_start(index - start, c_ones);
+        ones += c_ones;
+        return start;
+    }
+
     /**
      * @brief Set whether the children of the node are leaves or internal nodes
      *
@@ -199,7 +281,11 @@ class node : uncopyable {
                     dtype cap = child->capacity();
                     dtype n_cap = child->desired_capacity();
                     if (cap * WORD_BITS >= leaf_size || n_cap * WORD_BITS >= leaf_size) {
-                        rebalance_leaf(child_index, child, alloc);
+                        if (child->size() <= leaf_size) {
+                            flatten_leaf(child_index, alloc);
+                        } else {
+                            rebalance_leaf(child_index, child, alloc);
+                        }
                     } else {
                         children_[child_index] = alloc->reallocate_leaf(
                             child, cap, n_cap);
@@ -230,6 +316,93 @@ class node : uncopyable {
         return change;
     }
 
+    /**
+     * @brief Set or invert the elements in the range \f$[a, b)\f$.
+     *
+     * Only children overlapping the range are visited, and the cumulative
+     * sums are updated once per visited child. Leaves modify their share of
+     * the range a word or a run at a time.
+     *
+     * Run-length encoded leaves are reallocated with room for the extra runs
+     * created at the range boundaries. Encoded leaves that would exceed the
+     * maximum leaf capacity are flattened, or split if they contain more
+     * than `leaf_size` elements. If a leaf needs to be split but there is no
+     * room for an additional child, the update stops at the leaf and "b" is
+     * set to the end of the updated part, so that the caller can make room
+     * and continue from there.
+     *
+     * @tparam flip      Invert elements instead of setting them to "v".
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param a     Start of range.
+     * @param b     End of range. Set to the end of the updated part.
+     * @param v     Value to set elements to.
+     * @param alloc Allocator instance to use for reallocation.
+     *
+     * @return Change to data structure sum triggered by the operation.
+     */
+    template <bool flip, class allocator>
+    int64_t update_range(dtype a, dtype& b, bool v, allocator* alloc) {
+        uint8_t child_index = child_sizes_.find(a + 1);
+        int64_t total = 0;
+        int64_t change = 0;
+        while (child_index < child_count_) {
+            dtype start =
+                child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
+            if (start >= b) break;
+            dtype from = a > start ? a - start : 0;
+            if (has_leaves()) {
+                if constexpr (compressed) {
+                    if (!prepare_range_update(child_index, alloc)) {
+                        b = start + from;
+                        [[unlikely]] break;
+                    }
+                }
+                leaf_type* child =
+                    reinterpret_cast<leaf_type*>(children_[child_index]);
+                dtype end = child_sizes_.get(child_index);
+                dtype to = (b < end ? b : end) - start;
+                if constexpr (flip) {
+                    change += child->flip_range(from, to);
+                } else {
+                    change += child->set_range(from, to, v);
+                }
+            } else {
+                node* child = reinterpret_cast<node*>(children_[child_index]);
+                dtype end = child_sizes_.get(child_index);
+                dtype to = (b < end ? b : end) - start;
+                dtype reached = to;
+                change += child->template update_range<flip>(from, reached, v,
+                                                             alloc);
+                if constexpr (compressed) {
+                    if (reached < to) {
+                        // The child had no room for splitting a leaf. Sums
+                        // are brought up to date before rebalancing.
+                        child_sums_.set(child_index, child_sums_.get(child_index) +
+                                                         dtype(change));
+                        child_sums_.increment(child_index + 1, child_count_,
+                                              dtype(change));
+                        total += change;
+                        change = 0;
+                        a = start + reached;
+                        if (child_count_ == branches) {
+                            b = a;
+                            [[unlikely]] return total;
+                        }
+                        rebalance_node(child_index, alloc);
+                        child_index = child_sizes_.find(a + 1);
+                        [[unlikely]] continue;
+                    }
+                }
+            }
+            child_sums_.set(child_index,
+                            child_sums_.get(child_index) + dtype(change));
+            child_index++;
+        }
+        child_sums_.increment(child_index, child_count_, dtype(change));
+        return total + change;
+    }
+
     /**
      * @brief Counts number of one bits up to the index<sup>th</sup> logical
      * element.
@@ -258,6 +431,228 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Counts number of one bits in the \f$[a, b)\f$ range.
+     *
+     * Descends to the lowest node containing the whole range. From there, the
+     * boundary children are queried for the partially covered parts and
+     * cumulative sums are used for the fully covered children in between.
+     *
+     * @param a Start of range.
+     * @param b End of range. Requires \f$a < b\f$.
+     *
+     * @return \f$\sum_{i = a}^{b - 1} \mathrm{bv}[i]\f$.
+     */
+    dtype count(dtype a, dtype b) const {
+        uint8_t a_index = child_sizes_.find(a + 1);
+        uint8_t b_index = child_sizes_.find(b);
+        dtype a_start = a_index != 0 ? child_sizes_.get(a_index - 1) : 0;
+        if (a_index == b_index) {
+            if (has_leaves()) {
+                leaf_type* child =
+                    reinterpret_cast<leaf_type*>(children_[a_index]);
+                [[unlikely]] return child->rank(b - a_start, a - a_start);
+            } else {
+                node* child = reinterpret_cast<node*>(children_[a_index]);
+                return child->count(a - a_start, b - a_start);
+            }
+        }
+        dtype b_start = child_sizes_.get(b_index - 1);
+        dtype res = child_sums_.get(b_index - 1) - child_sums_.get(a_index);
+        if (has_leaves()) {
+            leaf_type* a_child =
+                reinterpret_cast<leaf_type*>(children_[a_index]);
+            leaf_type* b_child =
+                reinterpret_cast<leaf_type*>(children_[b_index]);
+            res += a_child->rank(a_child->size(), a - a_start);
+            [[unlikely]] return res + b_child->rank(b - b_start);
+        } else {
+            node* a_child = reinterpret_cast<node*>(children_[a_index]);
+            node* b_child = reinterpret_cast<node*>(children_[b_index]);
+            res += a_child->p_sum() - a_child->rank(a - a_start);
+            return res + b_child->rank(b - b_start);
+        }
+    }
+
+    /**
+     * @brief Call `fn` with the position of each 1-bit in \f$[a, b)\f$.
+     *
+     * Children that overlap the range but contain no 1-bits, as indicated by
+     * the cumulative sums, are skipped without being visited.
+     *
+     * @tparam F Callable taking a `uint64_t` position.
+     *
+     * @param a      Start of range.
+     * @param b      End of range.
+     * @param offset Value to add to reported positions.
+     * @param fn     Function to call.
+     */
+    template <class F>
+    void for_each_one(dtype a, dtype b, dtype offset, F& fn) const {
+        uint8_t child_index = child_sizes_.find(a + 1);
+        dtype start = 0;
+        dtype s_start = 0;
+        if (child_index != 0) {
+            start = child_sizes_.get(child_index - 1);
+            s_start = child_sums_.get(child_index - 1);
+        }
+        for (; child_index < child_count_ && start < b; child_index++) {
+            dtype end = child_sizes_.get(child_index);
+            dtype s_end = child_sums_.get(child_index);
+            if (s_end != s_start) {
+                dtype from = a > start ? a - start : 0;
+                dtype to = (b < end ? b : end) - start;
+                if (has_leaves()) {
+                    reinterpret_cast<leaf_type*>(children_[child_index])
+                        ->for_each_one(from, to, offset + start, fn);
+                } else {
+                    reinterpret_cast<node*>(children_[child_index])
+                        ->for_each_one(from, to, offset + start, fn);
+                }
+            }
+            start = end;
+            s_start = s_end;
+        }
+    }
+
+    /**
+     * @brief Call `fn(start, length, value)` for runs of equal elements in
+     * \f$[a, b)\f$.
+     *
+     * Children containing only 0-bits or only 1-bits, as indicated by the
+     * cumulative sums, are reported as single runs without being visited.
+     * Runs are not guaranteed to be maximal.
+     *
+     * @tparam F Callable taking `(uint64_t, uint64_t, bool)`.
+     *
+     * @param a      Start of range.
+     * @param b      End of range.
+     * @param offset Value to add to reported positions.
+     * @param fn     Function to call.
+     */
+    template <class F>
+    void for_each_run(dtype a, dtype b, dtype offset, F& fn) const {
+        uint8_t child_index = child_sizes_.find(a + 1);
+        dtype start = 0;
+        dtype s_start = 0;
+        if (child_index != 0) {
+            start = child_sizes_.get(child_index - 1);
+            s_start = child_sums_.get(child_index - 1);
+        }
+        for (; child_index < child_count_ && start < b; child_index++) {
+            dtype end = child_sizes_.get(child_index);
+            dtype s_end = child_sums_.get(child_index);
+            dtype from = a > start ? a - start : 0;
+            dtype to = (b < end ? b : end) - start;
+            if (s_end == s_start || s_end - s_start == end - start) {
+                fn(offset + start + from, uint64_t(to - from), s_end != s_start);
+            } else if (has_leaves()) {
+                reinterpret_cast<leaf_type*>(children_[child_index])
+                    ->for_each_run(from, to, offset + start, fn);
+            } else {
+                reinterpret_cast<node*>(children_[child_index])
+                    ->for_each_run(from, to, offset + start, fn);
+            }
+            start = end;
+            s_start = s_end;
+        }
+    }
+
+    /**
+     * @brief Position of the first element with value `v` at or after `i`.
+     *
+     * Children without elements of value `v`, as indicated by the cumulative
+     * sums, are skipped without being visited. At most one child per level is
+     * searched unsuccessfully.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    template <bool v>
+    dtype next_bit(dtype i) const {
+        uint8_t child_index = child_sizes_.find(i + 1);
+        dtype start = 0;
+        dtype s_start = 0;
+        if (child_index != 0) {
+            start = child_sizes_.get(child_index - 1);
+            s_start = child_sums_.get(child_index - 1);
+        }
+        for (; child_index < child_count_; child_index++) {
+            dtype end = child_sizes_.get(child_index);
+            dtype s_end = child_sums_.get(child_index);
+            dtype count = v ? s_end - s_start : end - start - (s_end - s_start);
+            if (count > 0) {
+                dtype from = i > start ? i - start : 0;
+                dtype res;
+                if (has_leaves()) {
+                    res = reinterpret_cast<leaf_type*>(children_[child_index])
+                              ->template next_bit<v>(from);
+                } else {
+                    res = reinterpret_cast<node*>(children_[child_index])
+                              ->template next_bit<v>(from);
+                }
+                if (res < end - start) {
+                    return start + res;
+                }
+            }
+            start = end;
+            s_start = s_end;
+        }
+        return size();
+    }
+
+    /**
+     * @brief Position of the last element with value `v` at or before `i`.
+     *
+     * Works like `next_bit`.
+     *
+     * @tparam v Value to search for.
+     *
+     * @param i Start position of the search. Requires \f$i < \f$ `size()`.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    template <bool v>
+    dtype prev_bit(dtype i) const {
+        uint8_t child_index = child_sizes_.find(i + 1);
+        dtype end = child_sizes_.get(child_index);
+        dtype s_end = child_sums_.get(child_index);
+        dtype from = i;
+        while (true) {
+            dtype start = 0;
+            dtype s_start = 0;
+            if (child_index != 0) {
+                start = child_sizes_.get(child_index - 1);
+                s_start = child_sums_.get(child_index - 1);
+            }
+            dtype count = v ? s_end - s_start : end - start - (s_end - s_start);
+            if (count > 0) {
+                from = from < end ? from - start : end - start - 1;
+                dtype res;
+                if (has_leaves()) {
+                    res = reinterpret_cast<leaf_type*>(children_[child_index])
+                              ->template prev_bit<v>(from);
+                } else {
+                    res = reinterpret_cast<node*>(children_[child_index])
+                              ->template prev_bit<v>(from);
+                }
+                if (res < end - start) {
+                    return start + res;
+                }
+            }
+            if (child_index == 0) {
+                [[unlikely]] return size();
+            }
+            child_index--;
+            from = start;
+            end = start;
+            s_end = s_start;
+        }
+    }
+
     /**
      * @brief Calculates the index of the count<sup>tu</sup> 1-bit
      *
@@ -286,6 +681,72 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Issue prefetches for the data needed to branch on this node.
+     *
+     * Used by batched queries to start loading several nodes on the same level
+     * before any of them are searched.
+     *
+     * @param sums Whether cumulative sums should be fetched in addition to
+     *             cumulative sizes.
+     */
+    void prefetch(bool sums) const {
+        child_sizes_.prefetch();
+        if (sums) child_sums_.prefetch();
+        __builtin_prefetch(children_);
+    }
+
+    /**
+     * @brief Single level of access descent for batched queries.
+     *
+     * @param index Index to access. Will be updated to the index in the child.
+     *
+     * @return Pointer to the child containing the index<sup>th</sup> element.
+     */
+    void* at_step(dtype& index) const {
+        uint8_t child_index = child_sizes_.find(index + 1);
+        index -= child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
+        return children_[child_index];
+    }
+
+    /**
+     * @brief Single level of rank descent for batched queries.
+     *
+     * @param index Number of elements to sum. Will be updated to the number of
+     *              elements to sum in the child.
+     * @param res   Rank accumulator to be incremented by the number of 1-bits
+     *              in preceding children.
+     *
+     * @return Pointer to the child containing the index<sup>th</sup> element.
+     */
+    void* rank_step(dtype& index, dtype& res) const {
+        uint8_t child_index = child_sizes_.find(index);
+        if (child_index != 0) {
+            res += child_sums_.get(child_index - 1);
+            [[likely]] index -= child_sizes_.get(child_index - 1);
+        }
+        return children_[child_index];
+    }
+
+    /**
+     * @brief Single level of select descent for batched queries.
+     *
+     * @param count Number of 1-bits to find. Will be updated to the number of
+     *              1-bits to find in the child.
+     * @param res   Select accumulator to be incremented by the number of
+     *              elements in preceding children.
+     *
+     * @return Pointer to the child containing the count<sup>th</sup> 1-bit.
+     */
+    void* select_step(dtype& count, dtype& res) const {
+        uint8_t child_index = child_sums_.find(count);
+        if (child_index != 0) {
+            res += child_sizes_.get(child_index - 1);
+            [[likely]] count -= child_sums_.get(child_index - 1);
+        }
+        return children_[child_index];
+    }
+
     /**
      * @brief Recursively deallocates all children.
      *
@@ -293,23 +754,69 @@ class node : uncopyable {
      * deallocation of children to the default destructor could lead to
      * deallocation of nodes that are still in use with other nodes.
      *
+     * Children shared with snapshots only lose a reference, and are
+     * deallocated once the last reference is released.
+     *
      * @tparam allocator Type of `alloc`.
      * @param alloc Allocator instance to use for deallocation.
      */
     template <class allocator>
     void deallocate(allocator* alloc) {
-        if (has_leaves()) {
-            leaf_type** children = reinterpret_cast<leaf_type**>(children_);
-            for (uint8_t i = 0; i < child_count_; i++) {
-                leaf_type* l = children[i];
-                alloc->deallocate_leaf(l);
+        for (uint8_t i = 0; i < child_count_; i++) {
+            release_child(i, alloc);
+        }
+    }
+
+    /**
+     * @brief Add a reference to each child.
+     *
+     * Used after duplicating a node, so that the duplicate and the original
+     * both own the children.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param alloc Allocator instance used for reference counting.
+     */
+    template <class allocator>
+    void retain_children(allocator* alloc) {
+        for (uint8_t i = 0; i < child_count_; i++) {
+            if (has_leaves()) {
+                alloc->retain(reinterpret_cast<leaf_type*>(children_[i]));
+            } else {
+                alloc->retain(reinterpret_cast<node*>(children_[i]));
             }
-        } else {
-            node** children = reinterpret_cast<node**>(children_);
-            for (uint8_t i = 0; i < child_count_; i++) {
-                node* n = children[i];
-                n->deallocate(alloc);
-                alloc->deallocate_node(n);
+        }
+    }
+
+    /**
+     * @brief Ensure that the subtree can be modified in the \f$[a, b]\f$
+     * range without affecting snapshots.
+     *
+     * Shared children overlapping the range, along with their immediate
+     * siblings, are replaced by unshared duplicates. Only children
+     * overlapping the range are recursed into, so a single position costs
+     * at most three duplicates per level.
+     *
+     * Expects `this` to be unshared.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param a     First position that may be modified.
+     * @param b     Last position that may be modified.
+     * @param alloc Allocator instance to use for duplication.
+     */
+    template <class allocator>
+    void unshare(dtype a, dtype b, allocator* alloc) {
+        uint8_t first = child_sizes_.find(a + 1);
+        uint8_t last = child_sizes_.find(b + 1);
+        first = first < child_count_ ? first : child_count_ - 1;
+        last = last < child_count_ ? last : child_count_ - 1;
+        uint8_t from = first > 0 ? first - 1 : 0;
+        uint8_t to = last + 1 < child_count_ ? last + 1 : last;
+        for (uint8_t i = from; i <= to; i++) {
+            unshare_child(i, alloc);
+            if (!has_leaves() && i >= first && i <= last) {
+                node* n = reinterpret_cast<node*>(children_[i]);
+                dtype offset = i != 0 ? child_sizes_.get(i - 1) : 0;
+                n->unshare(a > offset ? a - offset : 0, b - offset, alloc);
             }
         }
     }
@@ -321,6 +828,28 @@ class node : uncopyable {
      */
     uint8_t child_count() const { return child_count_; }
 
+    /**
+     * @brief Get pointer to the i<sup>th</sup> child of this node.
+     *
+     * @param i Index of child.
+     *
+     * @return Pointer to bv::leaf or bv::node.
+     */
+    void* child(uint8_t i) const { return children_[i]; }
+
+    /**
+     * @brief Find the child containing the index<sup>th</sup> element.
+     *
+     * @param index Index to locate. Will be updated to the index in the child.
+     *
+     * @return Index of the child containing the element.
+     */
+    uint8_t child_index(dtype& index) const {
+        uint8_t child_index = child_sizes_.find(index + 1);
+        index -= child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
+        return child_index;
+    }
+
     /**
      * @brief Get pointer to the children of this node.
      *
@@ -416,6 +945,80 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Insert a sorted batch of elements.
+     *
+     * Equivalent to calling `insert(pos[i] - offset, vals[i], alloc)` for a
+     * prefix of the batch in order. Consecutive elements targeting the same
+     * child are routed to the child as a group, and leaves receive their
+     * group with a single merge pass over the leaf data.
+     *
+     * Processing stops if this node becomes full, since further rebalancing
+     * could require splitting this node. The caller needs to ensure that the
+     * node is not full before calling and continue with the remaining
+     * elements.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param pos    Strictly increasing insertion positions.
+     * @param vals   Values to insert.
+     * @param n      Number of elements in the batch.
+     * @param offset Value to subtract from positions to get subtree positions.
+     * @param alloc  Instance of allocator to use for allocation and
+     * reallocation.
+     *
+     * @return Number of elements inserted.
+     */
+    template <class allocator>
+    size_t insert_batch(const dtype* pos, const bool* vals, size_t n,
+                        dtype offset, allocator* alloc) {
+        if (has_leaves()) {
+            return leaf_insert_batch(pos, vals, n, offset, alloc);
+        } else {
+            [[likely]] return node_insert_batch(pos, vals, n, offset, alloc);
+        }
+    }
+
+    /**
+     * @brief Insert a contiguous range of elements starting at "index".
+     *
+     * Inserts either bits read from a packed word array, or a run of identical
+     * bits if "source" is `nullptr`. Ranges that fit in the target leaf are
+     * spliced into the leaf directly. Larger ranges are written into new
+     * leaves, together with the contents of the target leaf, and the leaves
+     * are added as children of the parent node.
+     *
+     * Processing stops once the parent of the leaves runs out of room for new
+     * children. The caller needs to ensure that this node is not full before
+     * calling, and continue with the remaining elements.
+     *
+     * For compressed leaves, runs are merged into run-length encoded leaves as
+     * a single run. Other insertions into compressed trees are done one
+     * element at a time.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param index  Location of insertion.
+     * @param source Pointer to packed source data or `nullptr` for a run.
+     * @param offset Bit position in "source" to start reading from.
+     * @param v      Value of the inserted run if "source" is `nullptr`.
+     * @param elems  Number of elements to insert.
+     * @param alloc  Instance of allocator to use for allocation and
+     * reallocation.
+     *
+     * @return Number of elements inserted.
+     */
+    template <class allocator>
+    dtype insert_range(dtype index, const uint64_t* source, uint64_t offset,
+                       bool v, dtype elems, allocator* alloc) {
+        if (has_leaves()) {
+            return leaf_insert_range(index, source, offset, v, elems, alloc);
+        } else {
+            [[likely]] return node_insert_range(index, source, offset, v,
+                                                elems, alloc);
+        }
+    }
+
     /**
      * @brief Remove the index<sup>th</sup> element.
      *
@@ -436,6 +1039,151 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief Remove a sorted batch of elements.
+     *
+     * Positions refer to the subtree before any of the removals, and need to
+     * be strictly increasing. The batch is partitioned by child and each
+     * child receives its share with a single call, leaves compacting their
+     * share in a single pass. Once all removals are done, underfull children
+     * are merged or rebalanced with their siblings.
+     *
+     * After the call this node may have too few children. The caller is
+     * responsible for rebalancing this node.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param pos    Strictly increasing removal positions.
+     * @param n      Number of elements to remove.
+     * @param offset Value to subtract from positions to get subtree positions.
+     * @param alloc  Allocator instance to use for reallocation and
+     * deallocation.
+     *
+     * @return Number of 1-bits removed.
+     */
+    template <class allocator>
+    dtype remove_batch(const dtype* pos, size_t n, dtype offset,
+                       allocator* alloc) {
+        dtype removed = 0;
+        size_t done = 0;
+        while (done < n) {
+            uint8_t child_index = child_sizes_.find(pos[done] - offset + 1);
+            dtype start = child_index ? child_sizes_.get(child_index - 1) : 0;
+            dtype end = child_sizes_.get(child_index);
+            size_t count = 1;
+            while (done + count < n && pos[done + count] - offset < end) {
+                count++;
+            }
+            dtype ones;
+            if (has_leaves()) {
+                leaf_type* child =
+                    reinterpret_cast<leaf_type*>(children_[child_index]);
+                ones = child->remove_batch(pos + done, count, offset + start);
+                if constexpr (aggressive_realloc) {
+                    dtype cap = child->capacity();
+                    dtype n_cap = child->desired_capacity();
+                    if (cap > n_cap) {
+                        child = alloc->reallocate_leaf(child, cap, n_cap);
+                        children_[child_index] = child;
+                    }
+                }
+            } else {
+                node* child = reinterpret_cast<node*>(children_[child_index]);
+                ones = child->remove_batch(pos + done, count, offset + start,
+                                           alloc);
+            }
+            child_sizes_.increment(child_index, child_count_, -dtype(count));
+            child_sums_.increment(child_index, child_count_, -ones);
+            offset += count;
+            removed += ones;
+            done += count;
+        }
+        repair(alloc);
+        return removed;
+    }
+
+    /**
+     * @brief Remove the elements in the range \f$[a, b)\f$.
+     *
+     * Children that are fully covered by the range are deallocated without
+     * being visited. At most two children are partially covered, and only
+     * those are recursed into, so only the boundary paths of the range are
+     * visited. Once removals are done, underfull children are merged or
+     * rebalanced with their siblings.
+     *
+     * After the call this node may have too few children. The caller is
+     * responsible for rebalancing this node. The range may not cover all
+     * elements of the subtree.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param a     Start of range to remove.
+     * @param b     End of range to remove.
+     * @param alloc Allocator instance to use for reallocation and
+     * deallocation.
+     *
+     * @return Number of 1-bits removed.
+     */
+    template <class allocator>
+    dtype remove_range(dtype a, dtype b, allocator* alloc) {
+        dtype sizes[branches];
+        dtype sums[branches];
+        dtype removed = 0;
+        dtype start = 0;
+        uint8_t n_count = 0;
+        for (uint8_t i = 0; i < child_count_; i++) {
+            dtype end = child_sizes_.get(i);
+            dtype size = end - start;
+            dtype sum = child_sums_.get(i) - (i ? child_sums_.get(i - 1) : 0);
+            if (end > a && start < b) {
+                if (a <= start && end <= b) {
+                    release_child(i, alloc);
+                    removed += sum;
+                    start = end;
+                    continue;
+                }
+                dtype from = a > start ? a - start : 0;
+                dtype to = b < end ? b - start : size;
+                dtype ones;
+                if (has_leaves()) {
+                    leaf_type* child =
+                        reinterpret_cast<leaf_type*>(children_[i]);
+                    ones = child->remove_range(from, to);
+                    if constexpr (aggressive_realloc) {
+                        dtype cap = child->capacity();
+                        dtype n_cap = child->desired_capacity();
+                        if (cap > n_cap) {
+                            child = alloc->reallocate_leaf(child, cap, n_cap);
+                            children_[i] = child;
+                        }
+                    }
+                } else {
+                    node* child = reinterpret_cast<node*>(children_[i]);
+                    ones = child->remove_range(from, to, alloc);
+                }
+                size -= to - from;
+                sum -= ones;
+                removed += ones;
+            }
+            children_[n_count] = children_[i];
+            sizes[n_count] = size;
+            sums[n_count++] = sum;
+            start = end;
+        }
+        for (uint8_t i = 0; i < child_count_; i++) {
+            if (i < n_count) {
+                child_sizes_.set(i, sizes[i] + (i ? child_sizes_.get(i - 1) : 0));
+                child_sums_.set(i, sums[i] + (i ? child_sums_.get(i - 1) : 0));
+            } else {
+                child_sizes_.set(i, (~dtype(0)) >> 1);
+                child_sums_.set(i, (~dtype(0)) >> 1);
+            }
+        }
+        child_count_ = n_count;
+        repair(alloc);
+        return removed;
+    }
+
     /**
      * @brief Remove the first "elems" elements form this node.
      *
@@ -565,21 +1313,202 @@ class node : uncopyable {
                 ret += children[i]->bits_size();
             }
         }
-        return ret;
+        return ret;
+    }
+
+    void flush() {
+        if (has_leaves()) {
+            leaf_type** children = reinterpret_cast<leaf_type**>(children_);
+            for (uint8_t i = 0; i < child_count_; i++) {
+                children[i]->flush();
+            }
+        } else {
+            node** children = reinterpret_cast<node**>(children_);
+            for (uint8_t i = 0; i < child_count_; i++) {
+                children[i]->flush();
+            }
+        }
+    }
+
+    /**
+     * @brief Flush buffers in a subtree that may be shared with snapshots.
+     *
+     * Only subtrees containing leaves with buffered elements are visited and
+     * duplicated if shared, so the cost is proportional to the number of
+     * buffered leaves rather than to the size of the tree.
+     *
+     * Expects `this` to be unshared.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param alloc Allocator instance to use for duplication.
+     *
+     * @return Start position of the first flushed leaf, or the size of the
+     * subtree if no leaf was flushed.
+     */
+    template <class allocator>
+    dtype flush(allocator* alloc) {
+        dtype first = size();
+        for (uint8_t i = 0; i < child_count_; i++) {
+            if (!child_need_flush(i)) continue;
+            unshare_child(i, alloc);
+            dtype start = i != 0 ? child_sizes_.get(i - 1) : 0;
+            if (has_leaves()) {
+                reinterpret_cast<leaf_type*>(children_[i])->flush();
+            } else {
+                start += reinterpret_cast<node*>(children_[i])->flush(alloc);
+            }
+            first = start < first ? start : first;
+        }
+        return first;
+    }
+
+    /**
+     * @brief True if any leaf in the subtree has buffered elements.
+     */
+    bool need_flush() const {
+        for (uint8_t i = 0; i < child_count_; i++) {
+            if (child_need_flush(i)) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief True if the leaf containing the index<sup>th</sup> element has
+     * buffered elements.
+     *
+     * Only the path to the leaf is visited.
+     *
+     * @param index Position of an element in the leaf.
+     */
+    bool leaf_need_flush(dtype index) const {
+        uint8_t i = child_sizes_.find(index + 1);
+        if (has_leaves()) {
+            return reinterpret_cast<leaf_type*>(children_[i])->need_flush();
+        }
+        index -= i != 0 ? child_sizes_.get(i - 1) : 0;
+        return reinterpret_cast<node*>(children_[i])->leaf_need_flush(index);
+    }
+
+    /**
+     * @brief Flush the buffer of the leaf containing the index<sup>th</sup>
+     * element.
+     *
+     * Expects the path to the leaf to be unshared.
+     *
+     * @param index Position of an element in the leaf.
+     */
+    void flush_leaf(dtype index) {
+        uint8_t i = child_sizes_.find(index + 1);
+        if (has_leaves()) {
+            reinterpret_cast<leaf_type*>(children_[i])->flush();
+            return;
+        }
+        index -= i != 0 ? child_sizes_.get(i - 1) : 0;
+        reinterpret_cast<node*>(children_[i])->flush_leaf(index);
+    }
+
+    /**
+     * @brief Write the subtree rooted at `this` to `out` in binary form.
+     *
+     * The node metadata and cumulative sizes and sums of the active children
+     * are written, followed by the children in order.
+     *
+     * @param out Stream to write to.
+     */
+    void serialize(std::ostream& out) const {
+        write_raw(out, &meta_data_);
+        write_raw(out, &child_count_);
+        for (uint8_t i = 0; i < child_count_; i++) {
+            dtype v = child_sizes_.get(i);
+            write_raw(out, &v);
+        }
+        for (uint8_t i = 0; i < child_count_; i++) {
+            dtype v = child_sums_.get(i);
+            write_raw(out, &v);
+        }
+        for (uint8_t i = 0; i < child_count_; i++) {
+            if (has_leaves()) {
+                reinterpret_cast<leaf_type*>(children_[i])->serialize(out);
+            } else {
+                reinterpret_cast<node*>(children_[i])->serialize(out);
+            }
+        }
     }
 
-    void flush() {
-        if (has_leaves()) {
-            leaf_type** children = reinterpret_cast<leaf_type**>(children_);
-            for (uint8_t i = 0; i < child_count_; i++) {
-                children[i]->flush();
+    /**
+     * @brief Write the subtree rooted at `this` as mapped records.
+     *
+     * Children are written first, so that the record for `this` can contain
+     * their file offsets. See bv::mapped_bit_vector.
+     *
+     * @param out Stream to write to.
+     * @param pos Current position in the stream. Updated past the subtree.
+     *
+     * @return File offset of the record for `this`.
+     */
+    uint64_t serialize_mapped(std::ostream& out, uint64_t& pos) const {
+        mapped_node<dtype, branches> rec;
+        for (uint8_t i = 0; i < child_count_; i++) {
+            rec.sizes.set(i, child_sizes_.get(i));
+            rec.sums.set(i, child_sums_.get(i));
+            if (has_leaves()) {
+                rec.children[i] = write_mapped_leaf(
+                    out, pos, reinterpret_cast<leaf_type*>(children_[i]));
+            } else {
+                rec.children[i] = reinterpret_cast<node*>(children_[i])
+                                      ->serialize_mapped(out, pos);
             }
-        } else {
-            node** children = reinterpret_cast<node**>(children_);
-            for (uint8_t i = 0; i < child_count_; i++) {
-                children[i]->flush();
+        }
+        rec.child_count = child_count_;
+        rec.has_leaves = has_leaves();
+        return write_mapped_node(out, pos, &rec);
+    }
+
+    /**
+     * @brief Populate the empty node `this` with a subtree read from `in`.
+     *
+     * Reads a subtree written by `serialize`, allocating children with
+     * `alloc`. If reading fails, `this` contains the children that were
+     * successfully read, so the partial subtree can be deallocated with
+     * `deallocate(alloc)`.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param in    Stream to read from.
+     * @param alloc Allocator to use for allocating children.
+     *
+     * @return False if the stream ended or contained invalid data.
+     */
+    template <class allocator>
+    bool load(std::istream& in, allocator* alloc) {
+        uint8_t meta, count;
+        dtype sizes[branches];
+        dtype sums[branches];
+        if (!read_raw(in, &meta) || !read_raw(in, &count) || count == 0 ||
+            count > branches || !read_raw(in, sizes, count) ||
+            !read_raw(in, sums, count)) {
+            [[unlikely]] return false;
+        }
+        meta_data_ = meta;
+        for (uint8_t i = 0; i < count; i++) {
+            child_sizes_.set(i, sizes[i]);
+            child_sums_.set(i, sums[i]);
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            if (has_leaves()) {
+                leaf_type* l = leaf_type::load(in, alloc);
+                if (l == nullptr) {
+                    [[unlikely]] return false;
+                }
+                children_[child_count_++] = l;
+            } else {
+                node* n = alloc->template allocate_node<node>();
+                children_[child_count_++] = n;
+                if (!n->load(in, alloc)) {
+                    [[unlikely]] return false;
+                }
             }
         }
+        return true;
     }
 
     uint64_t dump(uint64_t* data, uint64_t offset) {
@@ -732,6 +1661,135 @@ class node : uncopyable {
     }
 
    private:
+    /** @brief True if child `i` has buffered elements in its subtree. */
+    bool child_need_flush(uint8_t i) const {
+        if (has_leaves()) {
+            return reinterpret_cast<leaf_type*>(children_[i])->need_flush();
+        }
+        return reinterpret_cast<node*>(children_[i])->need_flush();
+    }
+
+    /**
+     * @brief Replace child `i` with an unshared duplicate if it is shared with
+     * a snapshot.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param i     Index of child to unshare.
+     * @param alloc Allocator instance to use for duplication.
+     */
+    template <class allocator>
+    void unshare_child(uint8_t i, allocator* alloc) {
+        if (has_leaves()) {
+            leaf_type* l = reinterpret_cast<leaf_type*>(children_[i]);
+            if (alloc->shared(l)) {
+                children_[i] = alloc->duplicate_leaf(l);
+                if (alloc->release(l)) {
+                    [[unlikely]] alloc->deallocate_leaf(l);
+                }
+            }
+            return;
+        }
+        node* n = reinterpret_cast<node*>(children_[i]);
+        if (alloc->shared(n)) {
+            node* c = alloc->duplicate_node(n);
+            c->retain_children(alloc);
+            children_[i] = c;
+            if (alloc->release(n)) {
+                n->deallocate(alloc);
+                [[unlikely]] alloc->deallocate_node(n);
+            }
+        }
+    }
+
+    /**
+     * @brief Release the reference to child `i`, deallocating the child if it
+     * is not shared with a snapshot.
+     *
+     * @tparam allocator Type of `alloc`.
+     * @param i     Index of child to release.
+     * @param alloc Allocator instance to use for deallocation.
+     */
+    template <class allocator>
+    void release_child(uint8_t i, allocator* alloc) {
+        if (has_leaves()) {
+            leaf_type* l = reinterpret_cast<leaf_type*>(children_[i]);
+            if (alloc->release(l)) {
+                [[likely]] alloc->deallocate_leaf(l);
+            }
+        } else {
+            node* n = reinterpret_cast<node*>(children_[i]);
+            if (alloc->release(n)) {
+                n->deallocate(alloc);
+                [[likely]] alloc->deallocate_node(n);
+            }
+        }
+    }
+
+    /**
+     * @brief Ensure that a run-length encoded child leaf has room for a range
+     * update.
+     *
+     * Encoded leaves get room for the 2 runs that may be created at the range
+     * boundaries. Leaves that would exceed the maximum leaf capacity are
+     * flattened if they contain at most `leaf_size` elements, and split
+     * otherwise.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param index Index of the child leaf.
+     * @param alloc Allocator instance to use for reallocation.
+     *
+     * @return False if the leaf needs to be split but the node is full.
+     */
+    template <class allocator>
+    bool prepare_range_update(uint8_t index, allocator* alloc) {
+        while (true) {
+            leaf_type* child = reinterpret_cast<leaf_type*>(children_[index]);
+            if (!child->is_compressed()) return true;
+            dtype cap = child->capacity();
+            dtype n_cap = child->desired_capacity() + 2;
+            if (n_cap * WORD_BITS <= leaf_size) {
+                if (n_cap > cap) {
+                    children_[index] = alloc->reallocate_leaf(child, cap, n_cap);
+                }
+                return true;
+            }
+            if (child->size() <= leaf_size) {
+                flatten_leaf(index, alloc);
+                return true;
+            }
+            if (child_count_ == branches) {
+                [[unlikely]] return false;
+            }
+            split_leaf(index, child, alloc);
+        }
+    }
+
+    /**
+     * @brief Convert a run-length encoded child leaf to a plain bit leaf.
+     *
+     * Used when the encoding would exceed the maximum leaf capacity, while
+     * the leaf has at most `leaf_size` elements.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param index Index of the child leaf.
+     * @param alloc Allocator instance to use for reallocation.
+     */
+    template <class allocator>
+    void flatten_leaf(uint8_t index, allocator* alloc) {
+        leaf_type* child = reinterpret_cast<leaf_type*>(children_[index]);
+        dtype cap = child->capacity();
+        dtype n_cap = 2 + child->size() / WORD_BITS;
+        n_cap += n_cap % 2;
+        n_cap = n_cap * WORD_BITS <= leaf_size ? n_cap : leaf_size / WORD_BITS;
+        if (n_cap > cap) {
+            child = alloc->reallocate_leaf(child, cap, n_cap);
+            children_[index] = child;
+        }
+        child->uncompress();
+    }
+
     /**
      * @brief Splits a leaf with `n > leaf_size` elements into 2 leaves with
      * part of the encoded content each.
@@ -1068,7 +2126,13 @@ class node : uncopyable {
                 if (child->is_compressed()) {
                     if ((child->size() >= (~uint32_t(0) >> 1)) ||
                         (n_cap * WORD_BITS > leaf_size)) {
-                        rebalance_leaf(child_index, child, alloc);
+                        if (child->size() < leaf_size) {
+                            // The plain encoding is smaller, and splitting
+                            // could leave the leaf underfull.
+                            flatten_leaf(child_index, alloc);
+                        } else {
+                            rebalance_leaf(child_index, child, alloc);
+                        }
                     } else {
                         children_[child_index] =
                             alloc->reallocate_leaf(child, cap, n_cap);
@@ -1228,6 +2292,467 @@ class node : uncopyable {
         child->insert(index, value, alloc);
     }
 
+    /**
+     * @brief Insert a sorted batch of elements into the leaf children.
+     *
+     * Elements are grouped by target leaf. A group is merged into the leaf in
+     * one pass if the leaf has room for the whole group, after reallocating
+     * the leaf if necessary. Otherwise a single element is inserted with
+     * `leaf_insert`, which rebalances as needed.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param pos    Strictly increasing insertion positions.
+     * @param vals   Values to insert.
+     * @param n      Number of elements in the batch.
+     * @param offset Value to subtract from positions to get subtree positions.
+     * @param alloc  Instance of allocator to use for allocation and
+     * reallocation.
+     *
+     * @return Number of elements inserted.
+     */
+    template <class allocator>
+    size_t leaf_insert_batch(const dtype* pos, const bool* vals, size_t n,
+                             dtype offset, allocator* alloc) {
+        size_t done = 0;
+        while (done < n) {
+            dtype index = pos[done] - offset;
+            uint8_t child_index = child_sizes_.find(index);
+            leaf_type* child =
+                reinterpret_cast<leaf_type*>(children_[child_index]);
+            dtype start = child_index ? child_sizes_.get(child_index - 1) : 0;
+            dtype end = child_sizes_.get(child_index);
+            dtype room = child->size() < leaf_size ? leaf_size - child->size()
+                                                   : 0;
+            if constexpr (compressed) {
+                if (child->is_compressed()) room = 0;
+            }
+            size_t count = 0;
+            while (done + count < n && count < room &&
+                   pos[done + count] - offset <= end + count) {
+                count++;
+            }
+            if (count <= 1) {
+                leaf_insert(index, vals[done], alloc);
+                done++;
+                if (child_count_ == branches) [[unlikely]] break;
+                continue;
+            }
+            dtype n_size = child->size() + count;
+            dtype cap = child->capacity();
+            if (cap * WORD_BITS < n_size) {
+                dtype n_cap = 2 + n_size / WORD_BITS;
+                n_cap += n_cap % 2;
+                n_cap = n_cap * WORD_BITS <= leaf_size ? n_cap
+                                                       : leaf_size / WORD_BITS;
+                child = alloc->reallocate_leaf(child, cap, n_cap);
+                children_[child_index] = child;
+            }
+            child->insert_batch(pos + done, vals + done, count, offset + start);
+            dtype ones = 0;
+            for (size_t i = done; i < done + count; i++) {
+                ones += vals[i];
+            }
+            child_sizes_.increment(child_index, child_count_, count);
+            child_sums_.increment(child_index, child_count_, ones);
+            done += count;
+        }
+        return done;
+    }
+
+    /**
+     * @brief Insert a sorted batch of elements into the internal node
+     * children.
+     *
+     * Elements are grouped by target child, and each group is passed on to
+     * the child with a single call. Full children are rebalanced before
+     * descending, and groups are resumed if the child became full before
+     * processing the whole group.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param pos    Strictly increasing insertion positions.
+     * @param vals   Values to insert.
+     * @param n      Number of elements in the batch.
+     * @param offset Value to subtract from positions to get subtree positions.
+     * @param alloc  Instance of allocator to use for allocation and
+     * reallocation.
+     *
+     * @return Number of elements inserted.
+     */
+    template <class allocator>
+    size_t node_insert_batch(const dtype* pos, const bool* vals, size_t n,
+                             dtype offset, allocator* alloc) {
+        size_t done = 0;
+        while (done < n) {
+            dtype index = pos[done] - offset;
+            uint8_t child_index = child_sizes_.find(index);
+            node* child = reinterpret_cast<node*>(children_[child_index]);
+            if (child->child_count() == branches) {
+                rebalance_node(child_index, alloc);
+                child_index = child_sizes_.find(index);
+                [[unlikely]] child =
+                    reinterpret_cast<node*>(children_[child_index]);
+            }
+            dtype start = child_index ? child_sizes_.get(child_index - 1) : 0;
+            dtype end = child_sizes_.get(child_index);
+            size_t count = 1;
+            while (done + count < n &&
+                   pos[done + count] - offset <= end + count) {
+                count++;
+            }
+            count = child->insert_batch(pos + done, vals + done, count,
+                                        offset + start, alloc);
+            dtype ones = 0;
+            for (size_t i = done; i < done + count; i++) {
+                ones += vals[i];
+            }
+            child_sizes_.increment(child_index, child_count_, count);
+            child_sums_.increment(child_index, child_count_, ones);
+            done += count;
+            if (child_count_ == branches) [[unlikely]] break;
+        }
+        return done;
+    }
+
+    /**
+     * @brief Range insertion if the children are leaves.
+     *
+     * If the target leaf can hold the range, the range is spliced into the
+     * leaf. Otherwise the contents of the target leaf and the new elements are
+     * written to \f$m\f$ new leaves of near-equal size, with \f$m\f$ as small
+     * as possible but limited by the number of free child slots.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param index  Location of insertion.
+     * @param source Pointer to packed source data or `nullptr` for a run.
+     * @param offset Bit position in "source" to start reading from.
+     * @param v      Value of the inserted run if "source" is `nullptr`.
+     * @param elems  Number of elements to insert.
+     * @param alloc  Instance of allocator to use for allocation and
+     * reallocation.
+     *
+     * @return Number of elements inserted.
+     */
+    template <class allocator>
+    dtype leaf_insert_range(dtype index, const uint64_t* source,
+                            uint64_t offset, bool v, dtype elems,
+                            allocator* alloc) {
+        uint8_t child_index = child_sizes_.find(index);
+        leaf_type* child = reinterpret_cast<leaf_type*>(children_[child_index]);
+        dtype l_index =
+            index - (child_index != 0 ? child_sizes_.get(child_index - 1) : 0);
+        if constexpr (compressed) {
+            constexpr dtype max_size = ((~uint32_t(0)) >> 1) - 1;
+            if (source == nullptr && child->is_compressed() &&
+                child->size() < max_size) {
+                dtype cap = child->capacity();
+                dtype n_cap = child->desired_capacity() + 2;
+                if (n_cap * WORD_BITS <= leaf_size) {
+                    if (n_cap > cap) {
+                        child = alloc->reallocate_leaf(child, cap, n_cap);
+                        children_[child_index] = child;
+                    }
+                    if (elems > max_size - child->size()) {
+                        elems = max_size - child->size();
+                    }
+                    child->insert_run(l_index, v, elems);
+                    child_sizes_.increment(child_index, child_count_, elems);
+                    child_sums_.increment(child_index, child_count_,
+                                          v ? elems : 0);
+                    return elems;
+                }
+            }
+            bool value = source == nullptr
+                             ? v
+                             : (source[offset / WORD_BITS] >>
+                                (offset % WORD_BITS)) & 1;
+            leaf_insert(index, value, alloc);
+            [[unlikely]] return 1;
+        }
+        child->flush();
+        dtype size = child->size();
+        dtype total = size + elems;
+        if (total <= leaf_size) {
+            dtype cap = child->capacity();
+            dtype n_cap = 2 + total / WORD_BITS;
+            n_cap += n_cap % 2;
+            n_cap = n_cap * WORD_BITS > leaf_size ? leaf_size / WORD_BITS
+                                                  : n_cap;
+            if (n_cap > cap) {
+                child = alloc->reallocate_leaf(child, cap, n_cap);
+                children_[child_index] = child;
+            }
+            dtype ones = child->p_sum();
+            if (source == nullptr) {
+                child->insert_run(l_index, v, elems);
+            } else {
+                child->insert_bits(l_index, source, offset, elems);
+            }
+            child_sizes_.increment(child_index, child_count_, elems);
+            child_sums_.increment(child_index, child_count_,
+                                  child->p_sum() - ones);
+            return elems;
+        }
+        dtype m = total / leaf_size + (total % leaf_size ? 1 : 0);
+        if (m > dtype(branches - child_count_ + 1)) {
+            m = branches - child_count_ + 1;
+            elems = m * leaf_size - size;
+            total = m * leaf_size;
+        }
+        dtype old_ones = child->p_sum();
+        const uint64_t* l_data = child->data();
+        for (uint8_t i = child_count_ - 1; i > child_index; i--) {
+            children_[i + m - 1] = children_[i];
+            child_sizes_.set(i + m - 1, child_sizes_.get(i) + elems);
+            child_sums_.set(i + m - 1, child_sums_.get(i));
+        }
+        dtype c_size = child_index != 0 ? child_sizes_.get(child_index - 1) : 0;
+        dtype c_sum = child_index != 0 ? child_sums_.get(child_index - 1) : 0;
+        dtype new_ones = 0;
+        dtype from = 0;
+        for (dtype k = 0; k < m; k++) {
+            dtype to = total * (k + 1) / m;
+            dtype n_cap = 2 + (to - from) / WORD_BITS;
+            n_cap += n_cap % 2;
+            n_cap = n_cap * WORD_BITS > leaf_size ? leaf_size / WORD_BITS
+                                                  : n_cap;
+            leaf_type* l = alloc->template allocate_leaf<leaf_type>(n_cap);
+            if (from < l_index) {
+                dtype count = (to < l_index ? to : l_index) - from;
+                l->append_bits(l_data, from, count);
+                from += count;
+            }
+            if (from < to && from < l_index + elems) {
+                dtype count = (to < l_index + elems ? to : l_index + elems) -
+                              from;
+                if (source == nullptr) {
+                    l->append_run(v, count);
+                } else {
+                    l->append_bits(source, offset + from - l_index, count);
+                }
+                from += count;
+            }
+            if (from < to) {
+                l->append_bits(l_data, from - elems, to - from);
+                from = to;
+            }
+            children_[child_index + k] = l;
+            c_size += l->size();
+            c_sum += l->p_sum();
+            new_ones += l->p_sum();
+            child_sizes_.set(child_index + k, c_size);
+            child_sums_.set(child_index + k, c_sum);
+        }
+        alloc->deallocate_leaf(child);
+        child_count_ += m - 1;
+        for (uint8_t i = child_index + m; i < child_count_; i++) {
+            child_sums_.set(i, child_sums_.get(i) + new_ones - old_ones);
+        }
+        return elems;
+    }
+
+    /**
+     * @brief Range insertion if the children are internal nodes.
+     *
+     * Full children are rebalanced before descending, as with `node_insert`.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param index  Location of insertion.
+     * @param source Pointer to packed source data or `nullptr` for a run.
+     * @param offset Bit position in "source" to start reading from.
+     * @param v      Value of the inserted run if "source" is `nullptr`.
+     * @param elems  Number of elements to insert.
+     * @param alloc  Instance of allocator to use for allocation and
+     * reallocation.
+     *
+     * @return Number of elements inserted.
+     */
+    template <class allocator>
+    dtype node_insert_range(dtype index, const uint64_t* source,
+                            uint64_t offset, bool v, dtype elems,
+                            allocator* alloc) {
+        uint8_t child_index = child_sizes_.find(index);
+        node* child = reinterpret_cast<node*>(children_[child_index]);
+        if (child->child_count() == branches) {
+            rebalance_node(child_index, alloc);
+            child_index = child_sizes_.find(index);
+            [[unlikely]] child =
+                reinterpret_cast<node*>(children_[child_index]);
+        }
+        if (child_index != 0) {
+            [[likely]] index -= child_sizes_.get(child_index - 1);
+        }
+        dtype ones = child->p_sum();
+        dtype done = child->insert_range(index, source, offset, v, elems, alloc);
+        child_sizes_.increment(child_index, child_count_, done);
+        child_sums_.increment(child_index, child_count_, child->p_sum() - ones);
+        return done;
+    }
+
+    /**
+     * @brief Merge or rebalance underfull children with their siblings.
+     *
+     * Used after batch removal, where any number of children may have become
+     * underfull. Leaves with less than `leaf_size / 3` elements and nodes
+     * with at most `branches / 3` children are balanced against a sibling.
+     * A single underfull child without siblings is left for the parent to
+     * deal with.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param alloc Allocator instance to use for reallocation and
+     * deallocation.
+     */
+    template <class allocator>
+    void repair(allocator* alloc) {
+        uint8_t i = 0;
+        while (i < child_count_ && child_count_ > 1) {
+            bool underfull;
+            if (has_leaves()) {
+                underfull = reinterpret_cast<leaf_type*>(children_[i])->size() <
+                            leaf_size / 3;
+            } else {
+                underfull =
+                    reinterpret_cast<node*>(children_[i])->child_count() <=
+                    branches / 3;
+            }
+            if (!underfull) {
+                i++;
+                continue;
+            }
+            // Balancing with the left sibling, that is known to be valid,
+            // when possible. The result may still be underfull if underfull
+            // grandchildren had to be merged, so checking resumes from the
+            // left of the balanced pair.
+            i = i > 0 ? i - 1 : 0;
+            if (has_leaves()) {
+                balance_leaves(i, alloc);
+            } else {
+                balance_nodes(i, alloc);
+            }
+        }
+    }
+
+    /**
+     * @brief Merge or evenly rebalance adjacent leaves.
+     *
+     * Leaves are merged if the result is at most \f$\frac{5}{6}\f$ full.
+     * Otherwise elements are moved so that both leaves have approximately
+     * the same number of elements.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param idx   Index of the "left" leaf.
+     * @param alloc Allocator instance to use for reallocation and
+     * deallocation.
+     */
+    template <class allocator>
+    void balance_leaves(uint8_t idx, allocator* alloc) {
+        leaf_type* a = reinterpret_cast<leaf_type*>(children_[idx]);
+        leaf_type* b = reinterpret_cast<leaf_type*>(children_[idx + 1]);
+        dtype total = a->size() + b->size();
+        if (total <= leaf_size * 5 / 6 && mergeable(a, b)) {
+            merge_leaves(a, b, idx, alloc);
+            return;
+        }
+        dtype target = total / 2;
+        if constexpr (compressed) {
+            // Run-length encoded leaves may hold more than leaf_size elements,
+            // and the receiving leaf gets flattened.
+            if (a->size() > b->size()) {
+                if (total - target > leaf_size * 2 / 3) {
+                    target = total - leaf_size * 2 / 3;
+                }
+            } else if (target > leaf_size * 2 / 3) {
+                target = leaf_size * 2 / 3;
+            }
+        }
+        if (a->size() > target) {
+            dtype addition = a->size() - target;
+            dtype cap = b->capacity();
+            if (cap * WORD_BITS < b->size() + addition) {
+                dtype n_cap = 2 + (b->size() + addition) / WORD_BITS;
+                n_cap += n_cap % 2;
+                n_cap = n_cap * WORD_BITS <= leaf_size ? n_cap
+                                                       : leaf_size / WORD_BITS;
+                b = alloc->reallocate_leaf(b, cap, n_cap);
+                children_[idx + 1] = b;
+            }
+            b->transfer_prepend(a, addition);
+        } else {
+            dtype addition = target - a->size();
+            dtype cap = a->capacity();
+            if (cap * WORD_BITS < a->size() + addition) {
+                dtype n_cap = 2 + (a->size() + addition) / WORD_BITS;
+                n_cap += n_cap % 2;
+                n_cap = n_cap * WORD_BITS <= leaf_size ? n_cap
+                                                       : leaf_size / WORD_BITS;
+                a = alloc->reallocate_leaf(a, cap, n_cap);
+                children_[idx] = a;
+            }
+            a->transfer_append(b, addition);
+        }
+        if constexpr (aggressive_realloc) {
+            dtype cap = a->capacity();
+            dtype n_cap = a->desired_capacity();
+            if (cap > n_cap) {
+                a = alloc->reallocate_leaf(a, cap, n_cap);
+                children_[idx] = a;
+            }
+            cap = b->capacity();
+            n_cap = b->desired_capacity();
+            if (cap > n_cap) {
+                b = alloc->reallocate_leaf(b, cap, n_cap);
+                children_[idx + 1] = b;
+            }
+        }
+        dtype base = idx ? child_sizes_.get(idx - 1) : 0;
+        child_sizes_.set(idx, base + a->size());
+        base = idx ? child_sums_.get(idx - 1) : 0;
+        child_sums_.set(idx, base + a->p_sum());
+    }
+
+    /**
+     * @brief Merge or evenly rebalance adjacent internal nodes.
+     *
+     * Nodes are merged if the result has at most \f$\frac{5}{6}\f$ of
+     * `branches` children. Otherwise children are moved so that both nodes
+     * have approximately the same number of children. The resulting nodes
+     * are repaired, since the moved children may include underfull children
+     * that did not have siblings before.
+     *
+     * @tparam allocator Type of `alloc`.
+     *
+     * @param idx   Index of the "left" node.
+     * @param alloc Allocator instance to use for deallocation.
+     */
+    template <class allocator>
+    void balance_nodes(uint8_t idx, allocator* alloc) {
+        node* a = reinterpret_cast<node*>(children_[idx]);
+        node* b = reinterpret_cast<node*>(children_[idx + 1]);
+        uint8_t total = a->child_count() + b->child_count();
+        if (total <= branches * 5 / 6) {
+            merge_nodes(a, b, idx, alloc);
+            a->repair(alloc);
+            return;
+        }
+        uint8_t target = total / 2;
+        if (a->child_count() > target) {
+            b->transfer_prepend(a, a->child_count() - target);
+        } else {
+            a->transfer_append(b, target - a->child_count());
+        }
+        a->repair(alloc);
+        b->repair(alloc);
+        dtype base = idx ? child_sizes_.get(idx - 1) : 0;
+        child_sizes_.set(idx, base + a->size());
+        base = idx ? child_sums_.get(idx - 1) : 0;
+        child_sums_.set(idx, base + a->p_sum());
+    }
+
     /**
      * @brief Transfer elements from the "right" leaf to the "left" leaf.
      *
@@ -1318,12 +2843,26 @@ class node : uncopyable {
         }
     }
 
+    /**
+     * @brief True if the elements of both leaves fit in a single leaf.
+     *
+     * Unaligned appends write one word past the last copied word, which needs
+     * to fit in the largest leaf allocation.
+     *
+     * @param a "Left" leaf.
+     * @param b "Right" leaf.
+     */
+    bool mergeable(const leaf_type* a, const leaf_type* b) const {
+        return a->size() + b->size() + WORD_BITS <=
+               leaf_size / WORD_BITS * WORD_BITS;
+    }
+
     /**
      * @brief Merge the right leaf into the left leaf.
      *
      * Intended for when a removal would break structural invariant and there
      * are not enough elements in siblings to transfer elements while
-     * maintaining invariants.
+     * maintaining invariants. Expects the leaves to be `mergeable`.
      *
      * @tparam allocator Type of `alloc`
      *
@@ -1336,7 +2875,8 @@ class node : uncopyable {
     void merge_leaves(leaf_type* a, leaf_type* b, uint8_t idx,
                       allocator* alloc) {
         dtype a_cap = a->capacity();
-        if (a_cap * WORD_BITS < a->size() + b->size()) {
+        // Unaligned appends write one word past the last copied word.
+        if (a_cap * WORD_BITS < a->size() + b->size() + WORD_BITS) {
             dtype n_cap = 2 + (a->size() + b->size()) / WORD_BITS;
             n_cap += n_cap % 2;
             n_cap =
@@ -1374,7 +2914,8 @@ class node : uncopyable {
         if (child->size() <= leaf_size / 3) {
             if (child_index == 0) {
                 leaf_type* sibling = reinterpret_cast<leaf_type*>(children_[1]);
-                if (sibling->size() > leaf_size * 5 / 9) {
+                if (sibling->size() > leaf_size * 5 / 9 ||
+                    !mergeable(child, sibling)) {
                     rebalance_leaves_right(child, sibling, alloc);
                 } else {
                     merge_leaves(child, sibling, 0, alloc);
@@ -1383,7 +2924,8 @@ class node : uncopyable {
             } else {
                 leaf_type* sibling =
                     reinterpret_cast<leaf_type*>(children_[child_index - 1]);
-                if (sibling->size() > leaf_size * 5 / 9) {
+                if (sibling->size() > leaf_size * 5 / 9 ||
+                    !mergeable(sibling, child)) {
                     rebalance_leaves_left(sibling, child, child_index - 1,
                                           alloc);
                 } else {
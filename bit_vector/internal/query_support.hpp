@@ -4,10 +4,19 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "uncopyable.hpp"
 
+#ifndef CACHE_LINE
+// Apparently the most common cache line size is 64.
+#define CACHE_LINE 64
+#endif
+
 namespace bv {
 
 /**
@@ -18,6 +27,7 @@ struct r_elem : uncopyable {
     dtype p_size;
     dtype p_sum;
     dtype select_index;
+    dtype select0_index;
     dtype internal_offset;
     const leaf_type* leaf;
 
@@ -29,6 +39,267 @@ struct r_elem : uncopyable {
     }
 };
 
+/**
+ * @brief Default block storage for bv::query_support.
+ *
+ * Blocks are stored as an array of bv::r_elem, each with absolute counts and
+ * a leaf pointer. Blocks can thus be set in any order, and concurrently.
+ */
+template <class dtype, class leaf_type>
+class r_elem_array : uncopyable {
+   private:
+    typedef r_elem<dtype, leaf_type> E;
+
+    E* elems_;
+
+   public:
+    /** @brief Blocks may be set in any order, and concurrently. */
+    static const constexpr bool concurrent_set = true;
+
+    /**
+     * @brief Allocate storage for `n` blocks.
+     */
+    r_elem_array(dtype n) { elems_ = (E*)malloc(sizeof(E) * n); }
+
+    ~r_elem_array() { free(elems_); }
+
+    /**
+     * @brief Reallocate storage for `n` blocks, keeping existing blocks.
+     */
+    void reserve(dtype n) { elems_ = (E*)realloc(elems_, sizeof(E) * n); }
+
+    /**
+     * @brief Drop all blocks from the `n`<sup>th</sup> block onward.
+     */
+    void truncate(dtype) {}
+
+    /**
+     * @brief Set the values of block `i`.
+     *
+     * @param i      Block index.
+     * @param p_size Number of elements preceding the leaf of the block.
+     * @param p_sum  Number of 1-bits preceding the leaf of the block.
+     * @param offset Number of 1-bits in the leaf preceding the block.
+     * @param leaf   Leaf containing the start of the block.
+     */
+    void set(dtype i, dtype p_size, dtype p_sum, dtype offset,
+             leaf_type* leaf) {
+        elems_[i].set(p_size, p_sum, offset, leaf);
+    }
+
+    /**
+     * @brief Access block `i`.
+     */
+    const E& operator[](dtype i) const { return elems_[i]; }
+
+    /**
+     * @brief Number of 1-bits preceding the start of block `i`.
+     */
+    dtype block_rank(dtype i) const {
+        return elems_[i].p_sum + elems_[i].internal_offset;
+    }
+
+    /**
+     * @brief Select sample `i` for elements with value `v`.
+     */
+    template <bool v>
+    dtype& sample(dtype i) {
+        return v ? elems_[i].select_index : elems_[i].select0_index;
+    }
+
+    /**
+     * @brief Select sample `i` for elements with value `v`.
+     */
+    template <bool v>
+    dtype sample(dtype i) const {
+        return v ? elems_[i].select_index : elems_[i].select0_index;
+    }
+
+    /**
+     * @brief Number of bits allocated for `n` blocks.
+     */
+    uint64_t bit_size(dtype n) const { return uint64_t(n) * sizeof(E) * 8; }
+};
+
+/**
+ * @brief Cache line packed block storage for bv::query_support.
+ *
+ * Blocks are stored 16 to a cache line. Each line stores the absolute number
+ * of 1-bits preceding the first block of the line, and 16-bit counts relative
+ * to that for each block. Leaf pointers and leaf positions are stored once
+ * per leaf in a separate table, and each block references its leaf with an
+ * 8-bit offset from the leaf of the first block of the line. Select samples
+ * are stored in separate arrays.
+ *
+ * A block thus takes 4 bytes, in addition to leaf table entries and select
+ * samples, and locating the leaf and block rank for a rank query reads one
+ * line and one leaf table entry. Blocks need to be set in order.
+ */
+template <class dtype, class leaf_type, dtype block_size>
+class packed_r_array : uncopyable {
+   public:
+    /** @brief Number of blocks stored per cache line. */
+    static const constexpr dtype LINE_BLOCKS = 16;
+
+    /** @brief Unpacked values for a single block. */
+    struct view {
+        dtype p_size;
+        dtype p_sum;
+        dtype internal_offset;
+        const leaf_type* leaf;
+    };
+
+   private:
+    static_assert(block_size * LINE_BLOCKS <= (dtype(1) << 16),
+                  "relative block counts need to fit in 16 bits");
+
+    struct alignas(CACHE_LINE) line {
+        dtype rank;
+        uint32_t leaf;
+        uint8_t leaf_offset[LINE_BLOCKS];
+        uint16_t rel[LINE_BLOCKS];
+    };
+
+    struct leaf_ref {
+        const leaf_type* leaf;
+        dtype p_size;
+        dtype p_sum;
+    };
+
+    static_assert(sizeof(line) == CACHE_LINE);
+
+    line* lines_;
+    leaf_ref* leaves_;
+    dtype* samples_[2];
+    dtype n_leaves_;
+    dtype capacity_;
+
+    static dtype line_count(dtype n) {
+        return (n + LINE_BLOCKS - 1) / LINE_BLOCKS;
+    }
+
+   public:
+    /** @brief Blocks need to be set in order from a single thread. */
+    static const constexpr bool concurrent_set = false;
+
+    /**
+     * @brief Allocate storage for `n` blocks.
+     */
+    packed_r_array(dtype n) : n_leaves_(0), capacity_(n) {
+        lines_ = (line*)aligned_alloc(CACHE_LINE,
+                                      sizeof(line) * line_count(n));
+        leaves_ = (leaf_ref*)malloc(sizeof(leaf_ref) * n);
+        samples_[0] = (dtype*)malloc(sizeof(dtype) * n);
+        samples_[1] = (dtype*)malloc(sizeof(dtype) * n);
+    }
+
+    ~packed_r_array() {
+        free(lines_);
+        free(leaves_);
+        free(samples_[0]);
+        free(samples_[1]);
+    }
+
+    /**
+     * @brief Reallocate storage for `n` blocks, keeping existing blocks.
+     */
+    void reserve(dtype n) {
+        line* lines = (line*)aligned_alloc(CACHE_LINE,
+                                           sizeof(line) * line_count(n));
+        dtype keep = n < capacity_ ? n : capacity_;
+        memcpy(lines, lines_, sizeof(line) * line_count(keep));
+        free(lines_);
+        lines_ = lines;
+        leaves_ = (leaf_ref*)realloc(leaves_, sizeof(leaf_ref) * n);
+        samples_[0] = (dtype*)realloc(samples_[0], sizeof(dtype) * n);
+        samples_[1] = (dtype*)realloc(samples_[1], sizeof(dtype) * n);
+        capacity_ = n;
+    }
+
+    /**
+     * @brief Drop all blocks from the `n`<sup>th</sup> block onward.
+     */
+    void truncate(dtype n) {
+        if (n == 0) {
+            n_leaves_ = 0;
+            [[unlikely]] return;
+        }
+        const line& l = lines_[(n - 1) / LINE_BLOCKS];
+        n_leaves_ = l.leaf + l.leaf_offset[(n - 1) % LINE_BLOCKS] + 1;
+    }
+
+    /**
+     * @brief Set the values of block `i`.
+     *
+     * Requires blocks `0` to `i - 1` to be set.
+     *
+     * @param i      Block index.
+     * @param p_size Number of elements preceding the leaf of the block.
+     * @param p_sum  Number of 1-bits preceding the leaf of the block.
+     * @param offset Number of 1-bits in the leaf preceding the block.
+     * @param leaf   Leaf containing the start of the block.
+     */
+    void set(dtype i, dtype p_size, dtype p_sum, dtype offset,
+             leaf_type* leaf) {
+        if (n_leaves_ == 0 || leaves_[n_leaves_ - 1].p_size != p_size) {
+            leaves_[n_leaves_++] = {leaf, p_size, p_sum};
+        }
+        line& l = lines_[i / LINE_BLOCKS];
+        dtype j = i % LINE_BLOCKS;
+        dtype b_rank = p_sum + offset;
+        if (j == 0) {
+            l.rank = b_rank;
+            l.leaf = n_leaves_ - 1;
+        }
+        l.rel[j] = b_rank - l.rank;
+        l.leaf_offset[j] = n_leaves_ - 1 - l.leaf;
+    }
+
+    /**
+     * @brief Unpacked values of block `i`.
+     */
+    view operator[](dtype i) const {
+        const line& l = lines_[i / LINE_BLOCKS];
+        dtype j = i % LINE_BLOCKS;
+        const leaf_ref& r = leaves_[l.leaf + l.leaf_offset[j]];
+        return {r.p_size, r.p_sum, l.rank + l.rel[j] - r.p_sum, r.leaf};
+    }
+
+    /**
+     * @brief Number of 1-bits preceding the start of block `i`.
+     */
+    dtype block_rank(dtype i) const {
+        const line& l = lines_[i / LINE_BLOCKS];
+        return l.rank + l.rel[i % LINE_BLOCKS];
+    }
+
+    /**
+     * @brief Select sample `i` for elements with value `v`.
+     */
+    template <bool v>
+    dtype& sample(dtype i) {
+        return samples_[v][i];
+    }
+
+    /**
+     * @brief Select sample `i` for elements with value `v`.
+     */
+    template <bool v>
+    dtype sample(dtype i) const {
+        return samples_[v][i];
+    }
+
+    /**
+     * @brief Number of bits allocated for `n` blocks.
+     */
+    uint64_t bit_size(dtype n) const {
+        return (uint64_t(line_count(n)) * sizeof(line) +
+                uint64_t(n_leaves_) * sizeof(leaf_ref) +
+                2 * uint64_t(n) * sizeof(dtype)) *
+               8;
+    }
+};
+
 /**
  * @brief Support structure for bv::bit_vector to enable fast queries.
  *
@@ -40,23 +311,39 @@ struct r_elem : uncopyable {
  * blocks.
  *
  * If the underlying structure changes, querying the support structure may lead
- * to undefined behaviour. The support structure should be discarded
- * (`delete(q)`) as it becomes outdated.
+ * to undefined behaviour. The support structure should either be discarded
+ * (`delete(q)`) or brought up to date with `update(bv)` as it becomes
+ * outdated. Updating only recalculates blocks for leaves that may have changed
+ * since the last update, if possible.
  *
- * @tparam dtype     Integer type to use for indexing (uint32_t or uint64_t).
- * @tparam leaf_type Leaf type used by the relevant bv::bit_vector.
+ * @tparam dtype      Integer type to use for indexing (uint32_t or uint64_t).
+ * @tparam leaf_type  Leaf type used by the relevant bv::bit_vector.
+ * @tparam block_size Number of elements per block.
+ * @tparam flush      Should leaf buffers be flushed when leaves are added.
+ * @tparam packed     Use the cache line packed bv::packed_r_array block
+ *                    layout instead of the bv::r_elem_array layout.
  */
-template <class dtype, class leaf_type, dtype block_size, bool flush = false>
+template <class dtype, class leaf_type, dtype block_size, bool flush = false,
+          bool packed = false>
 class query_support : uncopyable {
    private:
-    typedef r_elem<dtype, leaf_type> E;
+    typedef typename std::conditional<
+        packed, packed_r_array<dtype, leaf_type, block_size>,
+        r_elem_array<dtype, leaf_type>>::type blocks;
+
+    /** @brief Fewest select samples worth handing to a separate thread. */
+    static const constexpr dtype MIN_SAMPLES_PER_THREAD = 1024;
 
     dtype size_;
     dtype sum_;
     dtype n_elems_;
-    E* elems_;
+    blocks blocks_;
+    uint64_t version_;  ///< Version of the bit vector at latest update.
 
    public:
+    /** @brief Leaves may be added concurrently with `place`. */
+    static const constexpr bool concurrent_placement = blocks::concurrent_set;
+
     /**
      * @brief Create a query support structure from bv.
      *
@@ -65,11 +352,16 @@ class query_support : uncopyable {
      *
      * @tparam bit_vector Some kind of bv::bit_vector.
      * @param bv          Pointer to bv::bit_vector source for support structure
+     * @param threads     Number of threads to use for construction.
      */
     template <class bit_vector>
-    query_support(const bit_vector* const bv) : size_(0), sum_(0), n_elems_(0) {
-        elems_ = (E*)malloc(sizeof(E) * (1 + bv->size() / block_size));
-        bv->template generate_query_structure(this);
+    query_support(bit_vector* const bv, uint32_t threads = 1)
+        : size_(0),
+          sum_(0),
+          n_elems_(0),
+          blocks_(1 + bv->size() / block_size),
+          version_(~uint64_t(0)) {
+        bv->template generate_query_structure(this, threads);
     }
 
     /**
@@ -81,13 +373,12 @@ class query_support : uncopyable {
      * 
      * @param size Number of elements the structure needs to support.
      */
-    query_support(dtype size) : size_(0), sum_(0), n_elems_(0) {
-        elems_ = (E*)malloc(sizeof(E) * (1 + size / block_size));
-    }
-
-    ~query_support() {
-        free(elems_);
-    }
+    query_support(dtype size)
+        : size_(0),
+          sum_(0),
+          n_elems_(0),
+          blocks_(1 + size / block_size),
+          version_(~uint64_t(0)) {}
 
     /**
      * @brief Add leaf reference to the support structure.
@@ -99,41 +390,108 @@ class query_support : uncopyable {
      * @param leaf Pointer to the leaf to add.
      */
     void append(leaf_type* leaf) {
-        dtype a_size = leaf->size();
+        place(leaf, size_, sum_);
+        size_ += leaf->size();
+        sum_ += leaf->p_sum();
+        n_elems_ = (size_ + block_size - 1) / block_size;
+    }
+
+    /**
+     * @brief Add leaf reference for a leaf starting at position `p_size`.
+     *
+     * Only the blocks starting within the leaf are written, so leaves may be
+     * placed concurrently from different threads if `concurrent_placement`.
+     * Otherwise leaves need to be placed in order. Once all leaves have been
+     * placed, `placed` should be called, followed by `finalize`.
+     *
+     * @param leaf   Pointer to the leaf to add.
+     * @param p_size Number of elements preceding the leaf.
+     * @param p_sum  Number of 1-bits preceding the leaf.
+     */
+    void place(leaf_type* leaf, dtype p_size, dtype p_sum) {
         if constexpr (flush) {
             leaf->flush();
         }
-        while (size_ + a_size > n_elems_ * block_size) {
-            dtype i_rank = leaf->rank(n_elems_ * block_size - size_);
-            elems_[n_elems_].set(size_, sum_, i_rank, leaf);
-            n_elems_++;
+        dtype end = p_size + leaf->size();
+        for (dtype i = (p_size + block_size - 1) / block_size;
+             i * block_size < end; i++) {
+            dtype i_rank = leaf->rank(i * block_size - p_size);
+            blocks_.set(i, p_size, p_sum, i_rank, leaf);
         }
-        size_ += a_size;
-        sum_ += leaf->p_sum();
     }
 
+    /**
+     * @brief Set totals after leaves have been added with `place`.
+     *
+     * @param size Number of elements in the placed leaves.
+     * @param sum  Number of 1-bits in the placed leaves.
+     */
+    void placed(dtype size, dtype sum) {
+        size_ = size;
+        sum_ = sum;
+        n_elems_ = (size_ + block_size - 1) / block_size;
+    }
+
+    /**
+     * @brief Drop blocks for leaves starting at or after position `size`.
+     *
+     * Used for partial rebuilds. Leaves from position `size` onward should
+     * subsequently be appended, followed by a call to `finalize`.
+     *
+     * @param size     Start of the first leaf to drop.
+     * @param sum      Number of 1-bits before position `size`.
+     * @param capacity Number of elements the structure needs to support.
+     */
+    void truncate(dtype size, dtype sum, dtype capacity) {
+        n_elems_ = (size + block_size - 1) / block_size;
+        size_ = size;
+        sum_ = sum;
+        blocks_.truncate(n_elems_);
+        blocks_.reserve(1 + capacity / block_size);
+    }
+
+    /**
+     * @brief Bring the structure up to date with modifications to `bv`.
+     *
+     * Convenience function. Does `bv->update_query_structure(this)`.
+     *
+     * @tparam bit_vector Some kind of bv::bit_vector.
+     * @param bv          Pointer to the bv::bit_vector source of the structure.
+     */
+    template <class bit_vector>
+    void update(bit_vector* const bv) {
+        bv->update_query_structure(this);
+    }
+
+    /**
+     * @brief Version of the underlying bit vector at the latest update.
+     */
+    uint64_t version() const { return version_; }
+
+    /**
+     * @brief Set the version of the underlying bit vector after an update.
+     */
+    void version(uint64_t v) { version_ = v; }
+
     /**
      * @brief Prepare the structure for querying
      *
-     * Precalculates and stores results for some select queries to speed up
-     * subsequent select queries.
+     * Precalculates and stores results for some select queries for both 1-bits
+     * and 0-bits to speed up subsequent select queries.
      *
      * For sparse bit vectors where p_sum < size / block_size, locations for all
      * 1-bits are precalculated, to allow constant time select queries.
+     * Similarly for dense bit vectors locations for all 0-bits are
+     * precalculated.
+     *
+     * Samples are independent of each other, and are split evenly between
+     * `threads` threads.
+     *
+     * @param threads Number of threads to use.
      */
-    void finalize() {
-        if (sum_ <= n_elems_) {
-            for (size_t i = 0; i < sum_; i++) {
-                elems_[i].select_index = dumb_select(i + 1);
-            }
-            [[unlikely]] (void(0));
-        } else {
-            for (size_t i = 0; i < n_elems_; i++) {
-                uint64_t s_trg = 1 + (i * sum_) / n_elems_;
-                uint64_t s_idx = s_select(s_trg);
-                elems_[i].select_index = s_idx;
-            }
-        }
+    void finalize(uint32_t threads = 1) {
+        sample<true>(threads);
+        sample<false>(threads);
     }
 
     /**
@@ -159,12 +517,8 @@ class query_support : uncopyable {
      * @return Value of bit at index \f$i\f$.
      */
     bool at(dtype i) const {
-        dtype idx = i / block_size;
-        E* e = elems_ + idx;
-        if (e->p_size + e->leaf->size() <= i) {
-            [[unlikely]] e = elems_ + idx + 1;
-        }
-        return e->leaf->at(i - e->p_size);
+        const auto& e = blocks_[leaf_block(i)];
+        return e.leaf->at(i - e.p_size);
     }
 
     /**
@@ -184,14 +538,13 @@ class query_support : uncopyable {
         dtype idx = block_size;
         idx = i / idx;
         if (idx == n_elems_) idx--;
-        E* e = elems_ + idx;
-        if (e->p_size + e->leaf->size() < i) {
-            idx++;
-            e = elems_ + idx;
-            [[unlikely]] return e->p_sum + e->leaf->rank(i - e->p_size);
+        const auto& e = blocks_[idx];
+        if (e.p_size + e.leaf->size() < i) {
+            const auto& n = blocks_[idx + 1];
+            [[unlikely]] return n.p_sum + n.leaf->rank(i - n.p_size);
         }
-        dtype offs = idx * block_size - e->p_size;
-        return e->p_sum + e->internal_offset + e->leaf->rank(i - e->p_size, offs);
+        dtype offs = idx * block_size - e.p_size;
+        return e.p_sum + e.internal_offset + e.leaf->rank(i - e.p_size, offs);
     }
 
     /**
@@ -216,32 +569,122 @@ class query_support : uncopyable {
      */
     dtype select(dtype i) const {
         if (sum_ <= n_elems_) {
-            [[unlikely]] return elems_[i - 1].select_index;
+            [[unlikely]] return blocks_.template sample<true>(i - 1);
         }
-        dtype idx = n_elems_ * i / (sum_ + 1);
-        if (idx == n_elems_) {
-            [[unlikely]] idx--;
+        dtype a_idx = sampled_block<true>(i, sum_);
+        const auto& e = blocks_[a_idx];
+        if (e.p_sum + e.leaf->p_sum() < i) {
+            const auto& n = blocks_[a_idx + 1];
+            [[unlikely]] return n.p_size + n.leaf->select(i - n.p_sum);
         }
-        dtype a_idx = elems_[idx].select_index;
-        dtype b_idx =
-            idx < n_elems_ - 1 ? elems_[idx + 1].select_index : a_idx;
-        if (b_idx - a_idx > 1 || idx == n_elems_ - 1) {
-            [[unlikely]] a_idx = s_select(i);
+        dtype s_pos = a_idx * block_size - e.p_size;
+        if (s_pos == 0) {
+            [[unlikely]] return e.p_size + e.leaf->select(i - e.p_sum);
+        }
+        return e.p_size +
+               e.leaf->select(i - e.p_sum, s_pos, e.internal_offset);
+    }
+
+    /**
+     * @brief Number of 0-bits up to position \f$i\f$ in the underlying bit
+     * vector.
+     *
+     * @param i Number of elements to include in the "summation".
+     *
+     * @return \f$i - \mathrm{rank}(i)\f$.
+     */
+    dtype rank0(dtype i) const { return i - rank(i); }
+
+    /**
+     * @brief Index of the \f$i\f$<sup>th</sup> 0-bit in the data structure.
+     *
+     * Works like `select` using separately precalculated samples for 0-bits.
+     *
+     * @param i Selection target.
+     * @return \f$\underset{j \in [0..n)}{\mathrm{arg min}}\left(j + 1 -
+     * \sum_{k = 0}^j \mathrm{bv}[k]\right) =  i\f$.
+     */
+    dtype select0(dtype i) const {
+        dtype zeros = size_ - sum_;
+        if (zeros <= n_elems_) {
+            [[unlikely]] return blocks_.template sample<false>(i - 1);
         }
-        E* e = elems_ + a_idx;
-        if (e->p_sum + e->leaf->p_sum() < i) {
-            e = elems_ + a_idx + 1;
-            [[unlikely]] return e->p_size + e->leaf->select(i - e->p_sum);
+        dtype a_idx = sampled_block<false>(i, zeros);
+        const auto& e = blocks_[a_idx];
+        dtype z = v_count<false>(e);
+        if (z + v_leaf_count<false>(e.leaf) < i) {
+            const auto& n = blocks_[a_idx + 1];
+            [[unlikely]] return n.p_size +
+                                n.leaf->select0(i - v_count<false>(n));
         }
-        dtype s_pos = a_idx * block_size - e->p_size;
-        if (s_pos == 0) {
-            [[unlikely]] return e->p_size + e->leaf->select(i - e->p_sum);
+        dtype s_pos = a_idx * block_size - e.p_size;
+        dtype b_z = s_pos - e.internal_offset;
+        if (z + b_z >= i) {
+            [[unlikely]] return e.p_size + e.leaf->select0(i - z);
         }
-        return e->p_size + e->leaf->select(i - e->p_sum,
-                                           a_idx * block_size - e->p_size,
-                                           e->internal_offset);
+        return e.p_size + e.leaf->select0(i - z - b_z, s_pos);
     }
 
+    /**
+     * @brief Value-generic rank.
+     */
+    dtype rank(bool v, dtype i) const { return v ? rank(i) : rank0(i); }
+
+    /**
+     * @brief Value-generic select.
+     */
+    dtype select(bool v, dtype i) const { return v ? select(i) : select0(i); }
+
+    /**
+     * @brief Position of the first 1-bit at or after index \f$i\f$.
+     *
+     * The leaf containing \f$i\f$ is located in constant time and scanned
+     * from \f$i\f$ onward. If the leaf contains no 1-bit at or after
+     * \f$i\f$, the leaf containing the next 1-bit is located with a binary
+     * search over the precalculated block sums, skipping any leaves without
+     * 1-bits.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype next_one(dtype i) const { return next_bit<true>(i); }
+
+    /**
+     * @brief Position of the last 1-bit at or before index \f$i\f$.
+     *
+     * See `next_one`.
+     *
+     * @param i Start position of the search. Values past the end are treated
+     *          as `size() - 1`.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype prev_one(dtype i) const { return prev_bit<true>(i); }
+
+    /**
+     * @brief Position of the first 0-bit at or after index \f$i\f$.
+     *
+     * See `next_one`.
+     *
+     * @param i Start position of the search.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype next_zero(dtype i) const { return next_bit<false>(i); }
+
+    /**
+     * @brief Position of the last 0-bit at or before index \f$i\f$.
+     *
+     * See `next_one`.
+     *
+     * @param i Start position of the search. Values past the end are treated
+     *          as `size() - 1`.
+     *
+     * @return Found position or `size()` if there is none.
+     */
+    dtype prev_zero(dtype i) const { return prev_bit<false>(i); }
+
     /**
      * @brief Number of bits allocated for the support structure.
      *
@@ -251,9 +694,7 @@ class query_support : uncopyable {
      * @return Number of bits allocated for the support structure.
      */
     uint64_t bit_size() const {
-        return (sizeof(query_support) +
-                (n_elems_ + 1) * sizeof(r_elem<dtype, leaf_type>)) *
-               8;
+        return sizeof(query_support) * 8 + blocks_.bit_size(n_elems_ + 1);
     }
 
     /**
@@ -268,7 +709,7 @@ class query_support : uncopyable {
                   << "\"number of elems\": " << n_elems_ << ",\n"
                   << "\"p_sizes\": [";
         for (size_t i = 0; i < n_elems_; i++) {
-            std::cout << elems_[i].p_size;
+            std::cout << blocks_[i].p_size;
             if (i != n_elems_ - 1) {
                 std::cout << ", ";
             }
@@ -276,7 +717,7 @@ class query_support : uncopyable {
         std::cout << "],\n"
                   << "\"p_sums\": [";
         for (size_t i = 0; i < n_elems_; i++) {
-            std::cout << elems_[i].p_sum;
+            std::cout << blocks_[i].p_sum;
             if (i != n_elems_ - 1) {
                 std::cout << ", ";
             }
@@ -284,7 +725,7 @@ class query_support : uncopyable {
         std::cout << "],\n"
                   << "\"internal_offsets\": [";
         for (size_t i = 0; i < n_elems_; i++) {
-            std::cout << elems_[i].internal_offset;
+            std::cout << blocks_[i].internal_offset;
             if (i != n_elems_ - 1) {
                 std::cout << ", ";
             }
@@ -292,7 +733,15 @@ class query_support : uncopyable {
         std::cout << "],\n"
                   << "\"select_index\": [";
         for (size_t i = 0; i < n_elems_; i++) {
-            std::cout << elems_[i].select_index;
+            std::cout << blocks_.template sample<true>(i);
+            if (i != n_elems_ - 1) {
+                std::cout << ", ";
+            }
+        }
+        std::cout << "],\n"
+                  << "\"select0_index\": [";
+        for (size_t i = 0; i < n_elems_; i++) {
+            std::cout << blocks_.template sample<false>(i);
             if (i != n_elems_ - 1) {
                 std::cout << ", ";
             }
@@ -300,7 +749,7 @@ class query_support : uncopyable {
         std::cout << "],\n"
                   << "\"nodes\": [";
         for (uint8_t i = 0; i < n_elems_; i++) {
-            elems_[i].leaf->print(internal_only);
+            blocks_[i].leaf->print(internal_only);
             if (i != n_elems_ - 1) {
                 std::cout << ",";
             }
@@ -311,27 +760,247 @@ class query_support : uncopyable {
 
    private:
     /**
-     * @brief Locate the block containing the \f$i\f$<sup>th</sup> 1-bit.
+     * @brief Locate a block for the leaf containing the \f$i\f$<sup>th</sup>
+     * element.
      *
-     * Used for building the select support index for dense bit vectors.
+     * @param i Index to locate. Requires \f$i <\f$ `size()`.
      *
-     * @param i Selection target.
+     * @return Index of a block referencing the leaf containing the element.
+     */
+    dtype leaf_block(dtype i) const {
+        dtype idx = i / block_size;
+        const auto& e = blocks_[idx];
+        if (e.p_size + e.leaf->size() <= i) {
+            [[unlikely]] idx++;
+        }
+        return idx;
+    }
+
+    /**
+     * @brief Block to start a select query for the \f$i\f$<sup>th</sup>
+     * element with value `v` from, based on precalculated samples.
      *
-     * @return The index of the block containing the \f$i\f$<sup>th</sup> 1-bit.
+     * @param i     Selection target.
+     * @param total Number of elements with value `v`.
      */
-    dtype s_select(dtype i) const {
+    template <bool v>
+    dtype sampled_block(dtype i, dtype total) const {
+        dtype idx = n_elems_ * i / (total + 1);
+        if (idx == n_elems_) {
+            [[unlikely]] idx--;
+        }
+        dtype a_idx = blocks_.template sample<v>(idx);
+        dtype b_idx = idx < n_elems_ - 1
+                          ? blocks_.template sample<v>(idx + 1)
+                          : a_idx;
+        if (b_idx - a_idx > 1 || idx == n_elems_ - 1) {
+            [[unlikely]] a_idx = s_select<v>(i);
+        }
+        return a_idx;
+    }
+
+    /**
+     * @brief Number of elements with value `v` preceding the leaf of `e`.
+     */
+    template <bool v, class B>
+    static dtype v_count(const B& e) {
+        return v ? e.p_sum : e.p_size - e.p_sum;
+    }
+
+    /**
+     * @brief Last block where fewer than \f$c + 1\f$ elements with value
+     * `v` precede the leaf of the block.
+     *
+     * The leaf of the block contains the \f$(c + 1)\f$<sup>th</sup> element
+     * with value `v`, if such an element exists.
+     *
+     * @tparam v Value to count.
+     *
+     * @param c Number of preceding elements.
+     *
+     * @return Index of the block.
+     */
+    template <bool v>
+    dtype last_block(dtype c) const {
+        dtype idx = 0;
+        dtype b = n_elems_ - 1;
+        while (idx < b) {
+            dtype m = (idx + b + 1) / 2;
+            if (v_count<v>(blocks_[m]) > c) {
+                b = m - 1;
+            } else {
+                idx = m;
+            }
+        }
+        return idx;
+    }
+
+    /**
+     * @brief Shared implementation of `next_one` and `next_zero`.
+     */
+    template <bool v>
+    dtype next_bit(dtype i) const {
+        if (i >= size_) {
+            [[unlikely]] return size_;
+        }
+        const auto& e = blocks_[leaf_block(i)];
+        dtype res = e.leaf->template next_bit<v>(i - e.p_size);
+        if (res < e.leaf->size()) {
+            [[likely]] return e.p_size + res;
+        }
+        dtype c = v_count<v>(e) + v_leaf_count<v>(e.leaf);
+        if (c == (v ? sum_ : size_ - sum_)) {
+            [[unlikely]] return size_;
+        }
+        const auto& n = blocks_[last_block<v>(c)];
+        return n.p_size + n.leaf->template next_bit<v>(0);
+    }
+
+    /**
+     * @brief Shared implementation of `prev_one` and `prev_zero`.
+     */
+    template <bool v>
+    dtype prev_bit(dtype i) const {
+        if (size_ == 0) {
+            [[unlikely]] return 0;
+        }
+        i = i < size_ ? i : size_ - 1;
+        const auto& e = blocks_[leaf_block(i)];
+        dtype res = e.leaf->template prev_bit<v>(i - e.p_size);
+        if (res < e.leaf->size()) {
+            [[likely]] return e.p_size + res;
+        }
+        dtype c = v_count<v>(e);
+        if (c == 0) {
+            [[unlikely]] return size_;
+        }
+        const auto& n = blocks_[last_block<v>(c - 1)];
+        return n.p_size + n.leaf->template prev_bit<v>(n.leaf->size() - 1);
+    }
+
+    /**
+     * @brief Number of elements with value `v` preceding block `idx`.
+     */
+    template <bool v>
+    dtype v_block_count(dtype idx) const {
+        dtype ones = blocks_.block_rank(idx);
+        return v ? ones : idx * block_size - ones;
+    }
+
+    /**
+     * @brief Number of elements with value `v` in `leaf`.
+     */
+    template <bool v>
+    static dtype v_leaf_count(const leaf_type* leaf) {
+        return v ? leaf->p_sum() : leaf->size() - leaf->p_sum();
+    }
+
+    /**
+     * @brief Precalculate select samples for elements with value `v`.
+     *
+     * Used by `finalize`.
+     *
+     * @param threads Number of threads to use.
+     */
+    template <bool v>
+    void sample(uint32_t threads) {
+        dtype total = v ? sum_ : size_ - sum_;
+        dtype count = total <= n_elems_ ? total : n_elems_;
+        if (threads > count / MIN_SAMPLES_PER_THREAD) {
+            threads = count / MIN_SAMPLES_PER_THREAD;
+        }
+        if (threads <= 1) {
+            sample_range<v>(0, count);
+            return;
+        }
+        std::thread* workers = new std::thread[threads - 1];
+        for (uint32_t t = 0; t < threads - 1; t++) {
+            dtype from = uint64_t(count) * t / threads;
+            dtype to = uint64_t(count) * (t + 1) / threads;
+            workers[t] = std::thread(&query_support::sample_range<v>, this,
+                                     from, to);
+        }
+        sample_range<v>(uint64_t(count) * (threads - 1) / threads, count);
+        for (uint32_t t = 0; t < threads - 1; t++) {
+            workers[t].join();
+        }
+        delete[] workers;
+    }
+
+    /**
+     * @brief Precalculate select samples `from` to `to - 1` for elements with
+     * value `v`.
+     */
+    template <bool v>
+    void sample_range(dtype from, dtype to) {
+        dtype total = v ? sum_ : size_ - sum_;
+        if (total <= n_elems_) {
+            for (dtype i = from; i < to; i++) {
+                blocks_.template sample<v>(i) = dumb_select<v>(i + 1);
+            }
+            [[unlikely]] return;
+        }
+        if (from >= to) return;
+        // Sampled targets are increasing, so the blocks are located with a
+        // single sweep instead of a binary search per sample.
+        dtype idx = block_before<v>(1 + (uint64_t(from) * total) / n_elems_);
+        for (dtype i = from; i < to; i++) {
+            uint64_t s_trg = 1 + (uint64_t(i) * total) / n_elems_;
+            while (idx + 1 < n_elems_ && v_block_count<v>(idx + 1) < s_trg) {
+                idx++;
+            }
+            dtype s_idx = idx;
+            while (true) {
+                const auto& e = blocks_[s_idx];
+                if (v_count<v>(e) + v_leaf_count<v>(e.leaf) >= s_trg) {
+                    [[likely]] break;
+                }
+                s_idx++;
+            }
+            blocks_.template sample<v>(i) = s_idx;
+        }
+    }
+
+    /**
+     * @brief Last block where fewer than \f$i\f$ elements with value `v`
+     * precede the start of the block, or 0 if there is none.
+     */
+    template <bool v>
+    dtype block_before(dtype i) const {
         dtype idx = 0;
         dtype b = n_elems_ - 1;
         while (idx < b) {
             dtype m = (idx + b + 1) / 2;
-            if (elems_[m].p_sum + elems_[m].internal_offset >= i) {
+            if (v_block_count<v>(m) >= i) {
                 b = m - 1;
             } else {
                 idx = m;
             }
         }
-        E* e = elems_ + idx;
-        while (e->p_sum + e->leaf->p_sum() < i) {
+        return idx;
+    }
+
+    /**
+     * @brief Locate the block containing the \f$i\f$<sup>th</sup> element
+     * with value `v`.
+     *
+     * Used for select queries when samples are not sufficient.
+     *
+     * @tparam v Value to select.
+     *
+     * @param i Selection target.
+     *
+     * @return The index of the block containing the \f$i\f$<sup>th</sup>
+     * element with value `v`.
+     */
+    template <bool v>
+    dtype s_select(dtype i) const {
+        dtype idx = block_before<v>(i);
+        while (true) {
+            const auto& e = blocks_[idx];
+            if (v_count<v>(e) + v_leaf_count<v>(e.leaf) >= i) {
+                [[likely]] break;
+            }
             idx++;
 #ifdef DEBUG
             if (idx >= n_elems_) {
@@ -341,38 +1010,48 @@ class query_support : uncopyable {
                 //exit(1);
             }
 #endif
-            [[unlikely]] e = elems_ + idx;
         }
         return idx;
     }
 
     /**
-     * @brief Index of the \f$i\f$<sup>th</sup> 1-bit in the data structure.
+     * @brief Index of the \f$i\f$<sup>th</sup> element with value `v` in
+     * the data structure.
      *
-     * Used for populating precalculated sums for sparese vectors.
+     * Used for populating precalculated results for sparse (or dense) bit
+     * vectors.
+     *
+     * @tparam v Value to select.
      *
      * @param i Selection target.
      *
-     * @return @return \f$\underset{j \in [0..n)}{\mathrm{arg min}}\left(\sum_{k
-     * = 0}^j \mathrm{bv}[k]\right) =  i\f$.
+     * @return Position of the \f$i\f$<sup>th</sup> element with value `v`.
      */
+    template <bool v>
     dtype dumb_select(dtype i) const {
         dtype idx = 0;
         dtype b = n_elems_ - 1;
         while (idx < b) {
             dtype m = (idx + b + 1) / 2;
-            if (elems_[m].p_sum >= i) {
+            if (v_count<v>(blocks_[m]) >= i) {
                 b = m - 1;
             } else {
                 idx = m;
             }
         }
-        E* e = elems_ + idx;
-        while (e->p_sum + e->leaf->p_sum() < i) {
+        while (true) {
+            const auto& e = blocks_[idx];
+            if (v_count<v>(e) + v_leaf_count<v>(e.leaf) >= i) {
+                [[likely]] break;
+            }
             idx++;
-            [[unlikely]] e = elems_ + idx;
         }
-        return e->p_size + e->leaf->select(i - e->p_sum);
+        const auto& e = blocks_[idx];
+        if constexpr (v) {
+            return e.p_size + e.leaf->select(i - e.p_sum);
+        } else {
+            return e.p_size + e.leaf->select0(i - v_count<false>(e));
+        }
     }
 };
 
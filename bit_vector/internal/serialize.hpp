@@ -0,0 +1,41 @@
+#ifndef BV_SERIALIZE_HPP
+#define BV_SERIALIZE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+namespace bv {
+
+/**
+ * @brief Current version of the binary format written by `serialize`.
+ *
+ * Should be incremented whenever the layout of serialized nodes or leaves
+ * changes.
+ */
+static const constexpr uint32_t SERIAL_FORMAT_VERSION = 1;
+
+/**
+ * @brief Write `n` consecutive values starting from `src` to `out` as raw
+ * bytes.
+ */
+template <class T>
+inline void write_raw(std::ostream& out, const T* src, size_t n = 1) {
+    out.write(reinterpret_cast<const char*>(src), sizeof(T) * n);
+}
+
+/**
+ * @brief Read `n` consecutive values written with `write_raw` into `dst`.
+ *
+ * @return False if the stream ended or failed before all values were read.
+ */
+template <class T>
+inline bool read_raw(std::istream& in, T* dst, size_t n = 1) {
+    in.read(reinterpret_cast<char*>(dst), sizeof(T) * n);
+    return bool(in);
+}
+
+}  // namespace bv
+
+#endif
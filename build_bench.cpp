@@ -0,0 +1,70 @@
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "bit_vector/bv.hpp"
+
+template <class bv_type>
+void run(uint64_t seed, uint64_t n, uint32_t max_threads, uint64_t reps) {
+    std::mt19937_64 mt(seed);
+    uint64_t words = n / 64 + 1;
+    uint64_t* data = (uint64_t*)malloc(words * sizeof(uint64_t));
+    for (uint64_t i = 0; i < words; i++) {
+        data[i] = mt();
+    }
+
+    using std::chrono::duration_cast;
+    using std::chrono::high_resolution_clock;
+    using std::chrono::microseconds;
+
+    std::cout << "size\tthreads\ttime(ms)\tthroughput(GB/s)\tchecksum"
+              << std::endl;
+
+    for (uint32_t threads = 1; threads <= max_threads; threads *= 2) {
+        for (uint64_t r = 0; r < reps; r++) {
+            auto t1 = high_resolution_clock::now();
+            bv_type* bv = new bv_type(data, n, threads);
+            auto t2 = high_resolution_clock::now();
+            uint64_t checksum = bv->sum() + bv->rank(n / 2);
+            delete bv;
+            double us = (double)duration_cast<microseconds>(t2 - t1).count();
+            std::cout << n << "\t" << threads << "\t" << us / 1000 << "\t"
+                      << (n / 8) / (us * 1000) << "\t" << checksum
+                      << std::endl;
+        }
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+    free(data);
+}
+
+int main(int argc, char const *argv[]) {
+    if (argc <= 2) {
+        std::cerr << "Need seed and size in bits" << std::endl;
+        return 1;
+    }
+    uint64_t seed;
+    std::sscanf(argv[1], "%lu", &seed);
+    uint64_t n;
+    std::sscanf(argv[2], "%lu", &n);
+
+    uint32_t max_threads = std::thread::hardware_concurrency();
+    if (argc >= 4) {
+        std::sscanf(argv[3], "%u", &max_threads);
+    }
+    if (max_threads == 0) max_threads = 1;
+    uint64_t reps = 5;
+    if (argc >= 5) {
+        std::sscanf(argv[4], "%lu", &reps);
+    }
+
+    std::cerr << "Testing bulk build seed = " << seed << ", n = " << n
+              << ", max threads = " << max_threads << ", reps = " << reps
+              << std::endl;
+    run<bv::bv>(seed, n, max_threads, reps);
+    return 0;
+}
@@ -6,6 +6,7 @@
 #include <iomanip>
 #include <iostream>
 #include <random>
+#include <string>
 
 #include "bit_vector/bv.hpp"
 
@@ -161,12 +162,231 @@ void test(uint64_t size, uint64_t steps, uint64_t seed) {
     }
 }
 
+template <class bit_vector>
+void batch_test(uint64_t size, uint64_t ops, uint64_t seed) {
+    std::mt19937_64 mt(seed);
+    uint64_t* data = (uint64_t*)malloc((size / 64 + 1) * sizeof(uint64_t));
+    for (uint64_t i = 0; i <= size / 64; i++) {
+        data[i] = mt();
+    }
+    bit_vector bv(data, size);
+    free(data);
+
+    using std::chrono::duration_cast;
+    using std::chrono::high_resolution_clock;
+    using std::chrono::microseconds;
+
+    std::vector<uint64_t> loc(ops), res(ops);
+    bool* bits = (bool*)malloc(ops);
+    double single[] = {0.0, 0.0, 0.0};
+    double batch[] = {0.0, 0.0, 0.0};
+    uint64_t checksum = 0;
+
+    for (size_t i = 0; i < ops; i++) {
+        loc[i] = mt() % size;
+    }
+    auto t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += bv.at(loc[i]);
+    }
+    auto t2 = high_resolution_clock::now();
+    single[0] = (double)duration_cast<microseconds>(t2 - t1).count() / ops;
+    t1 = high_resolution_clock::now();
+    bv.at_batch(loc.data(), bits, ops);
+    t2 = high_resolution_clock::now();
+    batch[0] = (double)duration_cast<microseconds>(t2 - t1).count() / ops;
+    for (size_t i = 0; i < ops; i++) {
+        checksum -= bits[i];
+    }
+
+    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += bv.rank(loc[i]);
+    }
+    t2 = high_resolution_clock::now();
+    single[1] = (double)duration_cast<microseconds>(t2 - t1).count() / ops;
+    t1 = high_resolution_clock::now();
+    bv.rank_batch(loc.data(), res.data(), ops);
+    t2 = high_resolution_clock::now();
+    batch[1] = (double)duration_cast<microseconds>(t2 - t1).count() / ops;
+    for (size_t i = 0; i < ops; i++) {
+        checksum -= res[i];
+    }
+
+    uint64_t limit = bv.sum();
+    for (size_t i = 0; i < ops; i++) {
+        loc[i] = 1 + mt() % limit;
+    }
+    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += bv.select(loc[i]);
+    }
+    t2 = high_resolution_clock::now();
+    single[2] = (double)duration_cast<microseconds>(t2 - t1).count() / ops;
+    t1 = high_resolution_clock::now();
+    bv.select_batch(loc.data(), res.data(), ops);
+    t2 = high_resolution_clock::now();
+    batch[2] = (double)duration_cast<microseconds>(t2 - t1).count() / ops;
+    for (size_t i = 0; i < ops; i++) {
+        checksum -= res[i];
+    }
+    free(bits);
+
+    if (checksum != 0) {
+        std::cerr << "Invalid checksum " << checksum << std::endl;
+        exit(1);
+    }
+
+    std::cout << "type\tsize\taccess\trank\tselect" << std::endl;
+    std::cout << "single\t" << size;
+    for (size_t i = 0; i < 3; i++) {
+        std::cout << "\t" << single[i];
+    }
+    std::cout << "\nbatch\t" << size;
+    for (size_t i = 0; i < 3; i++) {
+        std::cout << "\t" << batch[i];
+    }
+    std::cout << std::endl;
+}
+
+template <class Q>
+void layout_queries(const Q* qs, const std::vector<uint64_t>& loc,
+                    const std::vector<uint64_t>& ones,
+                    const std::vector<uint64_t>& zeros, double* res,
+                    uint64_t& checksum) {
+    using std::chrono::duration_cast;
+    using std::chrono::high_resolution_clock;
+    using std::chrono::nanoseconds;
+
+    size_t ops = loc.size();
+    auto t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += qs->at(loc[i]);
+    }
+    auto t2 = high_resolution_clock::now();
+    res[0] = (double)duration_cast<nanoseconds>(t2 - t1).count() / ops;
+    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += qs->rank(loc[i]);
+    }
+    t2 = high_resolution_clock::now();
+    res[1] = (double)duration_cast<nanoseconds>(t2 - t1).count() / ops;
+    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += qs->select(ones[i]);
+    }
+    t2 = high_resolution_clock::now();
+    res[2] = (double)duration_cast<nanoseconds>(t2 - t1).count() / ops;
+    t1 = high_resolution_clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        checksum += qs->select0(zeros[i]);
+    }
+    t2 = high_resolution_clock::now();
+    res[3] = (double)duration_cast<nanoseconds>(t2 - t1).count() / ops;
+}
+
+/**
+ * Compares query support block layouts and the flat static copy. Reports
+ * bits of support structure per bit of data and ns per query. The flat copy
+ * includes the raw data in its size.
+ */
+template <class bit_vector>
+void layout_test(uint64_t size, uint64_t ops, uint64_t seed) {
+    std::mt19937_64 mt(seed);
+    uint64_t* data = (uint64_t*)malloc((size / 64 + 1) * sizeof(uint64_t));
+    for (uint64_t i = 0; i <= size / 64; i++) {
+        data[i] = mt();
+    }
+    bit_vector bv(data, size);
+    free(data);
+
+    std::vector<uint64_t> loc(ops), ones(ops), zeros(ops);
+    for (size_t i = 0; i < ops; i++) {
+        loc[i] = mt() % size;
+        ones[i] = 1 + mt() % bv.sum();
+        zeros[i] = 1 + mt() % (size - bv.sum());
+    }
+    auto* qs = bv.generate_query_structure();
+    auto* pqs = bv.template generate_query_structure<2048, false, true>();
+    auto* fqs = bv.generate_flat_query_structure();
+    double res[4];
+    double p_res[4];
+    double f_res[4];
+    uint64_t checksum = 0;
+    uint64_t p_checksum = 0;
+    uint64_t f_checksum = 0;
+    layout_queries(qs, loc, ones, zeros, res, checksum);
+    layout_queries(pqs, loc, ones, zeros, p_res, p_checksum);
+    layout_queries(fqs, loc, ones, zeros, f_res, f_checksum);
+    if (checksum != p_checksum || checksum != f_checksum) {
+        std::cerr << "Invalid checksum " << checksum << " != " << p_checksum
+                  << " != " << f_checksum << std::endl;
+        exit(1);
+    }
+
+    std::cout << "layout\tsize\tbits/bit\taccess\trank\tselect\tselect0"
+              << std::endl;
+    std::cout << "r_elem\t" << size << "\t" << double(qs->bit_size()) / size;
+    for (size_t i = 0; i < 4; i++) {
+        std::cout << "\t" << res[i];
+    }
+    std::cout << "\npacked\t" << size << "\t"
+              << double(pqs->bit_size()) / size;
+    for (size_t i = 0; i < 4; i++) {
+        std::cout << "\t" << p_res[i];
+    }
+    std::cout << "\nflat\t" << size << "\t" << double(fqs->bit_size()) / size;
+    for (size_t i = 0; i < 4; i++) {
+        std::cout << "\t" << f_res[i];
+    }
+    std::cout << std::endl;
+    delete qs;
+    delete pqs;
+    delete fqs;
+}
+
 typedef bv::malloc_alloc alloc;
-typedef bv::leaf<8> leaf;
+typedef bv::leaf<8, 16384> leaf;
 typedef bv::node<leaf, uint64_t, 16384, 64> node;
 typedef bv::query_support<uint64_t, leaf, 2048> qs;
 
 int main(int argc, char const* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "batch") {
+        if (argc < 3) {
+            std::cerr << "Usage: queries batch seed [size] [ops]" << std::endl;
+            return 1;
+        }
+        uint64_t seed;
+        uint64_t b_size = 100000000;
+        uint64_t ops = 1000000;
+        std::sscanf(argv[2], "%lu", &seed);
+        if (argc > 3) {
+            std::sscanf(argv[3], "%lu", &b_size);
+        }
+        if (argc > 4) {
+            std::sscanf(argv[4], "%lu", &ops);
+        }
+        batch_test<bv::bv>(b_size, ops, seed);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "layout") {
+        if (argc < 3) {
+            std::cerr << "Usage: queries layout seed [size] [ops]" << std::endl;
+            return 1;
+        }
+        uint64_t seed;
+        uint64_t l_size = 100000000;
+        uint64_t ops = 1000000;
+        std::sscanf(argv[2], "%lu", &seed);
+        if (argc > 3) {
+            std::sscanf(argv[3], "%lu", &l_size);
+        }
+        if (argc > 4) {
+            std::sscanf(argv[4], "%lu", &ops);
+        }
+        layout_test<bv::simple_bv<16, 16384, 64>>(l_size, ops, seed);
+        return 0;
+    }
     uint64_t size = 16384;
     alloc* a = new alloc();
     node* n = a->template allocate_node<node>();
@@ -182,7 +402,7 @@ int main(int argc, char const* argv[]) {
     }
     n->append_child(l);
 
-    qs* q = new qs();
+    qs* q = new qs(size);
     n->generate_query_structure(q);
     q->finalize();
     q->print(true);
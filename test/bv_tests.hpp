@@ -1,7 +1,14 @@
 #ifndef TEST_BV_HPP
 #define TEST_BV_HPP
 
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
 
@@ -467,6 +474,1214 @@ void bv_select_0_test(uint64_t size) {
     delete(cbv);
 }
 
+template <class alloc, class bit_vector>
+void bv_build_test(uint64_t size, uint32_t threads = 1) {
+    uint64_t* data = (uint64_t*)calloc(size / 64 + 1, sizeof(uint64_t));
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t v = ((i * 2654435761u) >> 7) & 1;
+        data[i / 64] |= v << (i % 64);
+        sum += v;
+    }
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a, data, size, threads);
+    ASSERT_EQ(size, bv->size());
+    ASSERT_EQ(sum, bv->sum());
+    bv->validate();
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        bool v = (data[i / 64] >> (i % 64)) & 1;
+        ASSERT_EQ(ones, bv->rank(i)) << "i = " << i;
+        ASSERT_EQ(v, bv->at(i)) << "i = " << i;
+        if (v) {
+            ones++;
+            ASSERT_EQ(i, bv->select(ones)) << "i = " << i;
+        }
+    }
+    ASSERT_EQ(ones, bv->rank(size));
+
+    uint64_t* dumped = (uint64_t*)calloc(size / 64 + 1, sizeof(uint64_t));
+    bv->dump(dumped);
+    for (uint64_t i = 0; i < size / 64 + 1; i++) {
+        ASSERT_EQ(data[i], dumped[i]) << "i = " << i;
+    }
+
+    for (uint64_t i = 0; i < size; i += 2) {
+        bv->insert(i, true);
+    }
+    ASSERT_EQ(size + (size + 1) / 2, bv->size());
+    bv->validate();
+    for (uint64_t i = 0; i < size; i += 2) {
+        ASSERT_EQ(true, bv->at(i / 2));
+        bv->remove(i / 2);
+    }
+    ASSERT_EQ(size, bv->size());
+    ASSERT_EQ(sum, bv->sum());
+    bv->validate();
+    for (uint64_t i = 0; i < size; i++) {
+        ASSERT_EQ((data[i / 64] >> (i % 64)) & 1, bv->at(i)) << "i = " << i;
+    }
+
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+    free(data);
+    free(dumped);
+}
+
+template <class alloc, class bit_vector>
+void bv_builder_test(uint64_t size) {
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    {
+        typename bit_vector::builder b(bv);
+        uint64_t i = 0;
+        while (i < size / 3) {
+            b.push_back(((i * 2654435761u) >> 7) & 1);
+            i++;
+        }
+        while (i < size) {
+            uint32_t n = 1 + i % 64;
+            n = i + n > size ? size - i : n;
+            uint64_t w = 0;
+            for (uint32_t j = 0; j < n; j++) {
+                w |= (((i + j) * 2654435761u) >> 7 & 1) << j;
+            }
+            b.append_word(n < 64 ? w | (~uint64_t(0) << n) : w, n);
+            i += n;
+        }
+        ASSERT_EQ(size, b.size());
+    }
+    ASSERT_EQ(size, bv->size());
+    bv->validate();
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        bool v = ((i * 2654435761u) >> 7) & 1;
+        ASSERT_EQ(v, bv->at(i)) << "i = " << i;
+        ones += v;
+    }
+    ASSERT_EQ(ones, bv->sum());
+
+    for (uint64_t i = 0; i < size; i += 2) {
+        bv->remove(i / 2);
+    }
+    ASSERT_EQ(size / 2, bv->size());
+    bv->validate();
+
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_insert_batch_test(uint64_t size, uint64_t batch, uint64_t rounds) {
+    std::mt19937 mt(size + batch);
+    std::vector<bool> control;
+    for (uint64_t i = 0; i < size; i++) {
+        control.push_back(((i * 2654435761u) >> 7) & 1);
+    }
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    for (uint64_t i = 0; i < size; i++) {
+        bv->insert(i, control[i]);
+    }
+    uint64_t* pos = (uint64_t*)malloc(batch * sizeof(uint64_t));
+    bool* vals = (bool*)malloc(batch);
+    for (uint64_t r = 0; r < rounds; r++) {
+        uint64_t n_size = control.size() + batch;
+        std::vector<bool> taken(n_size);
+        for (uint64_t i = 0; i < batch; i++) {
+            uint64_t p = mt() % n_size;
+            while (taken[p]) p = (p + 1) % n_size;
+            taken[p] = true;
+        }
+        std::vector<bool> expected;
+        uint64_t j = 0;
+        uint64_t k = 0;
+        for (uint64_t i = 0; i < n_size; i++) {
+            if (taken[i]) {
+                pos[j] = i;
+                vals[j] = mt() % 2;
+                expected.push_back(vals[j++]);
+            } else {
+                expected.push_back(control[k++]);
+            }
+        }
+        control = expected;
+        bv->insert_batch(pos, vals, batch);
+        ASSERT_EQ(control.size(), bv->size());
+        bv->validate();
+        uint64_t ones = 0;
+        for (uint64_t i = 0; i < control.size(); i++) {
+            ASSERT_EQ(control[i], bv->at(i)) << "i = " << i << ", r = " << r;
+            ones += control[i];
+        }
+        ASSERT_EQ(ones, bv->sum());
+    }
+    free(pos);
+    free(vals);
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_remove_batch_test(uint64_t size, uint64_t batch, uint64_t rounds,
+                          bool contiguous = false, bool runs = false) {
+    std::mt19937 mt(size + batch);
+    std::vector<bool> control;
+    uint64_t* data = (uint64_t*)calloc(size / 64 + 1, sizeof(uint64_t));
+    for (uint64_t i = 0; i < size; i++) {
+        uint64_t x = runs ? i / 1000 : i;
+        bool v = ((x * 2654435761u) >> 7) & 1;
+        control.push_back(v);
+        data[i / 64] |= uint64_t(v) << (i % 64);
+    }
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a, data, size);
+    uint64_t* pos = (uint64_t*)malloc(batch * sizeof(uint64_t));
+    for (uint64_t r = 0; r < rounds && control.size() >= batch; r++) {
+        std::vector<bool> taken(control.size());
+        if (contiguous) {
+            uint64_t start = mt() % (control.size() - batch + 1);
+            for (uint64_t i = 0; i < batch; i++) taken[start + i] = true;
+        } else {
+            for (uint64_t i = 0; i < batch; i++) {
+                uint64_t p = mt() % control.size();
+                while (taken[p]) p = (p + 1) % control.size();
+                taken[p] = true;
+            }
+        }
+        std::vector<bool> expected;
+        uint64_t j = 0;
+        for (uint64_t i = 0; i < control.size(); i++) {
+            if (taken[i]) {
+                pos[j++] = i;
+            } else {
+                expected.push_back(control[i]);
+            }
+        }
+        control = expected;
+        bv->remove_batch(pos, batch);
+        ASSERT_EQ(control.size(), bv->size());
+        bv->validate();
+        uint64_t ones = 0;
+        for (uint64_t i = 0; i < control.size(); i++) {
+            ASSERT_EQ(control[i], bv->at(i)) << "i = " << i << ", r = " << r;
+            ones += control[i];
+        }
+        ASSERT_EQ(ones, bv->sum());
+    }
+    for (uint64_t i = 0; i < 2 * SIZE; i++) {
+        bv->insert(i % (bv->size() + 1), i % 3);
+    }
+    bv->validate();
+    free(pos);
+    free(data);
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_query_batch_test(uint64_t size, uint64_t batch) {
+    std::mt19937 mt(size + batch);
+    uint64_t* data = (uint64_t*)calloc(size / 64 + 1, sizeof(uint64_t));
+    for (uint64_t i = 0; i < size; i++) {
+        data[i / 64] |= uint64_t(mt() % 3 == 0) << (i % 64);
+    }
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a, data, size);
+    uint64_t ones = bv->sum();
+    uint64_t* q = (uint64_t*)malloc(batch * sizeof(uint64_t));
+    uint64_t* res = (uint64_t*)malloc(batch * sizeof(uint64_t));
+    bool* bits = (bool*)malloc(batch);
+    for (uint64_t i = 0; i < batch; i++) q[i] = mt() % size;
+    bv->at_batch(q, bits, batch);
+    for (uint64_t i = 0; i < batch; i++) {
+        ASSERT_EQ(bv->at(q[i]), bits[i]) << "i = " << i;
+    }
+    bv->rank_batch(q, res, batch);
+    for (uint64_t i = 0; i < batch; i++) {
+        ASSERT_EQ(bv->rank(q[i]), res[i]) << "i = " << i;
+    }
+    for (uint64_t i = 0; i < batch; i++) q[i] = 1 + mt() % ones;
+    bv->select_batch(q, res, batch);
+    for (uint64_t i = 0; i < batch; i++) {
+        ASSERT_EQ(bv->select(q[i]), res[i]) << "i = " << i;
+    }
+    free(q);
+    free(res);
+    free(bits);
+    free(data);
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_insert_range_test(uint64_t size, uint64_t rounds, bool runs) {
+    std::mt19937 mt(size + rounds);
+    std::vector<bool> control;
+    uint64_t* bits = (uint64_t*)calloc(size / 64 + 1, sizeof(uint64_t));
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    for (uint64_t r = 0; r < rounds; r++) {
+        uint64_t len = r % 3 ? 1 + mt() % size : 1 + mt() % 100;
+        uint64_t idx = mt() % (control.size() + 1);
+        if (runs || r % 2) {
+            bool v = mt() % 2;
+            bv->insert_run(idx, v, len);
+            control.insert(control.begin() + idx, len, v);
+        } else {
+            for (uint64_t i = 0; i <= size / 64; i++) {
+                bits[i] = uint64_t(mt()) << 32 | mt();
+            }
+            bv->insert_range(idx, bits, len);
+            std::vector<bool> range;
+            for (uint64_t i = 0; i < len; i++) {
+                range.push_back((bits[i / 64] >> (i % 64)) & 1);
+            }
+            control.insert(control.begin() + idx, range.begin(), range.end());
+        }
+        ASSERT_EQ(control.size(), bv->size()) << "r = " << r;
+        bv->validate();
+    }
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ASSERT_EQ(control[i], bv->at(i)) << "i = " << i;
+        ones += control[i];
+    }
+    ASSERT_EQ(ones, bv->sum());
+    for (uint64_t i = 0; i < 2 * SIZE; i++) {
+        bv->insert(i % (bv->size() + 1), i % 3);
+    }
+    bv->validate();
+    free(bits);
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_remove_range_test(uint64_t size, uint64_t max_len, uint64_t rounds) {
+    std::mt19937 mt(size + max_len);
+    std::vector<bool> control;
+    uint64_t* data = (uint64_t*)calloc(size / 64 + 1, sizeof(uint64_t));
+    for (uint64_t i = 0; i < size; i++) {
+        bool v = ((i * 2654435761u) >> 7) & 1;
+        control.push_back(v);
+        data[i / 64] |= uint64_t(v) << (i % 64);
+    }
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a, data, size);
+    for (uint64_t r = 0; r < rounds && control.size() > 0; r++) {
+        uint64_t len = 1 + mt() % max_len;
+        len = len < control.size() ? len : control.size();
+        uint64_t start = mt() % (control.size() - len + 1);
+        bv->remove_range(start, start + len);
+        control.erase(control.begin() + start, control.begin() + start + len);
+        ASSERT_EQ(control.size(), bv->size()) << "r = " << r;
+        bv->validate();
+    }
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ASSERT_EQ(control[i], bv->at(i)) << "i = " << i;
+        ones += control[i];
+    }
+    ASSERT_EQ(ones, bv->sum());
+    bv->remove_range(0, bv->size());
+    ASSERT_EQ(0u, bv->size());
+    for (uint64_t i = 0; i < 2 * SIZE; i++) {
+        bv->insert(i % (bv->size() + 1), i % 3);
+    }
+    bv->validate();
+    free(data);
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_mixed_range_test(uint64_t size, uint64_t max_len, uint64_t rounds,
+                         bool batch) {
+    std::mt19937 mt(size + max_len);
+    std::vector<bool> control;
+    uint64_t* data = (uint64_t*)calloc(size / 64 + 1, sizeof(uint64_t));
+    for (uint64_t i = 0; i < size; i++) {
+        bool v = ((i * 2654435761u) >> 7) & 1;
+        control.push_back(v);
+        data[i / 64] |= uint64_t(v) << (i % 64);
+    }
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a, data, size);
+    uint64_t* bits = (uint64_t*)calloc(max_len / 64 + 1, sizeof(uint64_t));
+    uint64_t* pos = (uint64_t*)malloc(max_len * sizeof(uint64_t));
+    for (uint64_t r = 0; r < rounds; r++) {
+        uint64_t len = 1 + mt() % max_len;
+        uint64_t idx = mt() % (control.size() + 1);
+        if (r % 2 == 0) {
+            bool v = mt() % 2;
+            bv->insert_run(idx, v, len);
+            control.insert(control.begin() + idx, len, v);
+        } else {
+            for (uint64_t i = 0; i <= max_len / 64; i++) {
+                bits[i] = uint64_t(mt()) << 32 | mt();
+            }
+            bv->insert_range(idx, bits, len);
+            std::vector<bool> range;
+            for (uint64_t i = 0; i < len; i++) {
+                range.push_back((bits[i / 64] >> (i % 64)) & 1);
+            }
+            control.insert(control.begin() + idx, range.begin(), range.end());
+        }
+        bv->validate();
+        len = 1 + mt() % max_len;
+        len = len < control.size() ? len : control.size();
+        uint64_t start = mt() % (control.size() - len + 1);
+        if (batch) {
+            for (uint64_t i = 0; i < len; i++) pos[i] = start + i;
+            bv->remove_batch(pos, len);
+        } else {
+            bv->remove_range(start, start + len);
+        }
+        control.erase(control.begin() + start, control.begin() + start + len);
+        ASSERT_EQ(control.size(), bv->size()) << "r = " << r;
+        bv->validate();
+    }
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ASSERT_EQ(control[i], bv->at(i)) << "i = " << i;
+        ones += control[i];
+    }
+    ASSERT_EQ(ones, bv->sum());
+    free(pos);
+    free(bits);
+    free(data);
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_set_range_test(uint64_t size, uint64_t max_len, uint64_t rounds,
+                       bool runs, bool singles = false) {
+    std::mt19937 mt(size + max_len);
+    std::vector<bool> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    while (control.size() < size) {
+        bool v = mt() % 2;
+        uint64_t len = runs ? 1 + mt() % 1000 : 1;
+        bv->insert_run(bv->size(), v, len);
+        control.insert(control.end(), len, v);
+    }
+    for (uint64_t r = 0; r < rounds; r++) {
+        uint64_t len = 1 + mt() % max_len;
+        len = len < control.size() ? len : control.size();
+        uint64_t start = mt() % (control.size() - len + 1);
+        if (singles && r % 5 == 4) {
+            // Single element updates between range updates.
+            for (uint64_t i = 0; i < 50; i++) {
+                uint64_t p = mt() % (control.size() + 1);
+                bool v = mt() % 2;
+                bv->insert(p, v);
+                control.insert(control.begin() + p, v);
+                p = mt() % control.size();
+                bv->remove(p);
+                control.erase(control.begin() + p);
+                p = mt() % control.size();
+                v = mt() % 2;
+                bv->set(p, v);
+                control[p] = v;
+            }
+        } else if (r % 3 == 0) {
+            bv->flip_range(start, start + len);
+            for (uint64_t i = start; i < start + len; i++) {
+                control[i] = !control[i];
+            }
+        } else {
+            bool v = r % 3 == 1;
+            bv->set_range(start, start + len, v);
+            std::fill(control.begin() + start, control.begin() + start + len,
+                      v);
+        }
+        bv->validate();
+    }
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ASSERT_EQ(control[i], bv->at(i)) << "i = " << i;
+        ones += control[i];
+    }
+    ASSERT_EQ(ones, bv->sum());
+    for (uint64_t i = 0; i < control.size(); i += 97) {
+        ASSERT_EQ(bv->rank(i + 1) - bv->rank(i), uint64_t(control[i]));
+    }
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_count_test(uint64_t size, uint64_t max_len, uint64_t queries,
+                   bool runs) {
+    std::mt19937 mt(size + queries);
+    std::vector<bool> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    while (control.size() < size) {
+        bool v = mt() % 2;
+        uint64_t len = runs ? 1 + mt() % 1000 : 1;
+        bv->insert_run(bv->size(), v, len);
+        control.insert(control.end(), len, v);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t idx = mt() % (control.size() + 1);
+        bool v = mt() % 2;
+        bv->insert(idx, v);
+        control.insert(control.begin() + idx, v);
+    }
+    std::vector<uint64_t> ranks(control.size() + 1, 0);
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ranks[i + 1] = ranks[i] + control[i];
+    }
+    ASSERT_EQ(ranks.back(), bv->count(0, bv->size()));
+    for (uint64_t q = 0; q < queries; q++) {
+        uint64_t len = mt() % max_len;
+        len = len < control.size() ? len : control.size();
+        uint64_t start = mt() % (control.size() - len + 1);
+        ASSERT_EQ(ranks[start + len] - ranks[start],
+                  bv->count(start, start + len))
+            << "[" << start << ", " << start + len << ")";
+    }
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_iterator_test(uint64_t size, bool runs) {
+    std::mt19937 mt(size);
+    std::vector<bool> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    ASSERT_TRUE(bv->begin() == bv->end());
+    while (control.size() < size) {
+        bool v = mt() % 2;
+        uint64_t len = runs ? 1 + mt() % 1000 : 1;
+        bv->insert_run(bv->size(), v, len);
+        control.insert(control.end(), len, v);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t idx = mt() % (control.size() + 1);
+        bool v = mt() % 2;
+        bv->insert(idx, v);
+        control.insert(control.begin() + idx, v);
+        idx = mt() % control.size();
+        bv->remove(idx);
+        control.erase(control.begin() + idx);
+    }
+    uint64_t i = 0;
+    for (bool v : *bv) {
+        ASSERT_EQ(control[i], v) << "i = " << i;
+        i++;
+    }
+    ASSERT_EQ(control.size(), i);
+    auto it = bv->begin();
+    i = 0;
+    uint64_t w;
+    while (uint32_t bits = it.next_word(w)) {
+        for (uint32_t j = 0; j < bits; j++) {
+            ASSERT_EQ(control[i], bool((w >> j) & 1)) << "i = " << i;
+            i++;
+        }
+        ASSERT_EQ(0u, bits < 64 ? w >> bits : 0);
+    }
+    ASSERT_EQ(control.size(), i);
+    ASSERT_TRUE(it == bv->end());
+    for (uint64_t q = 0; q < 100; q++) {
+        uint64_t start = mt() % control.size();
+        typename bit_vector::const_iterator s_it(bv, start);
+        for (i = start; i < control.size() && i < start + 3000; i++) {
+            ASSERT_EQ(control[i], *(s_it++)) << "i = " << i;
+        }
+    }
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_for_each_one_test(uint64_t size, uint64_t queries, bool runs) {
+    std::mt19937 mt(size + queries);
+    std::vector<bool> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    while (control.size() < size) {
+        // Long zero runs for skipping empty subtrees.
+        bool v = mt() % 4 == 0;
+        uint64_t len = runs || !v ? 1 + mt() % 2000 : 1;
+        bv->insert_run(bv->size(), v, len);
+        control.insert(control.end(), len, v);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t idx = mt() % (control.size() + 1);
+        bool v = mt() % 2;
+        bv->insert(idx, v);
+        control.insert(control.begin() + idx, v);
+        idx = mt() % control.size();
+        bv->remove(idx);
+        control.erase(control.begin() + idx);
+    }
+    for (uint64_t q = 0; q < queries; q++) {
+        uint64_t start = mt() % control.size();
+        uint64_t end = start + mt() % (control.size() - start + 1);
+        if (q == 0) {
+            start = 0;
+            end = control.size();
+        }
+        std::vector<uint64_t> expected;
+        for (uint64_t i = start; i < end; i++) {
+            if (control[i]) expected.push_back(i);
+        }
+        std::vector<uint64_t> found;
+        bv->for_each_one(start, end, [&](uint64_t p) { found.push_back(p); });
+        ASSERT_EQ(expected, found) << "[" << start << ", " << end << ")";
+        found.clear();
+        for (auto it = bv->ones_begin(start, end); it != bv->ones_end(end);
+             ++it) {
+            found.push_back(*it);
+        }
+        ASSERT_EQ(expected, found) << "[" << start << ", " << end << ")";
+    }
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_next_prev_test(uint64_t size, uint64_t queries, bool runs) {
+    std::mt19937 mt(size + queries);
+    std::vector<bool> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    ASSERT_EQ(0u, bv->next_one(0));
+    ASSERT_EQ(0u, bv->prev_zero(0));
+    while (control.size() < size) {
+        // Long runs of both values for skipping subtrees.
+        bool v = mt() % 2;
+        uint64_t len = runs || mt() % 8 == 0 ? 1 + mt() % 40000 : 1;
+        bv->insert_run(bv->size(), v, len);
+        control.insert(control.end(), len, v);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t idx = mt() % (control.size() + 1);
+        bool v = mt() % 2;
+        bv->insert(idx, v);
+        control.insert(control.begin() + idx, v);
+        idx = mt() % control.size();
+        bv->remove(idx);
+        control.erase(control.begin() + idx);
+    }
+    uint64_t n = control.size();
+    std::vector<uint64_t> next[2] = {std::vector<uint64_t>(n + 1, n),
+                                     std::vector<uint64_t>(n + 1, n)};
+    std::vector<uint64_t> prev[2] = {std::vector<uint64_t>(n, n),
+                                     std::vector<uint64_t>(n, n)};
+    for (uint64_t i = n; i > 0; i--) {
+        next[0][i - 1] = control[i - 1] ? next[0][i] : i - 1;
+        next[1][i - 1] = control[i - 1] ? i - 1 : next[1][i];
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        prev[0][i] = !control[i] ? i : (i > 0 ? prev[0][i - 1] : n);
+        prev[1][i] = control[i] ? i : (i > 0 ? prev[1][i - 1] : n);
+    }
+    for (uint64_t q = 0; q < queries; q++) {
+        uint64_t i = q < 4 ? (q % 2 ? n - 1 : 0) : mt() % n;
+        ASSERT_EQ(next[1][i], bv->next_one(i)) << "i = " << i;
+        ASSERT_EQ(next[0][i], bv->next_zero(i)) << "i = " << i;
+        ASSERT_EQ(prev[1][i], bv->prev_one(i)) << "i = " << i;
+        ASSERT_EQ(prev[0][i], bv->prev_zero(i)) << "i = " << i;
+    }
+    ASSERT_EQ(n, bv->next_one(n));
+    ASSERT_EQ(prev[1][n - 1], bv->prev_one(n + 10));
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_for_each_run_test(uint64_t size, uint64_t queries, bool runs) {
+    std::mt19937 mt(size + queries);
+    std::vector<bool> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    while (control.size() < size) {
+        bool v = mt() % 2;
+        uint64_t len = runs || mt() % 8 == 0 ? 1 + mt() % 40000 : 1;
+        bv->insert_run(bv->size(), v, len);
+        control.insert(control.end(), len, v);
+    }
+    for (uint64_t i = 0; i < 100; i++) {
+        uint64_t idx = mt() % (control.size() + 1);
+        bool v = mt() % 2;
+        bv->insert(idx, v);
+        control.insert(control.begin() + idx, v);
+        idx = mt() % control.size();
+        bv->remove(idx);
+        control.erase(control.begin() + idx);
+    }
+    for (uint64_t q = 0; q < queries; q++) {
+        uint64_t start = mt() % control.size();
+        uint64_t end = start + 1 + mt() % (control.size() - start);
+        if (q == 0) {
+            start = 0;
+            end = control.size();
+        }
+        std::vector<std::pair<uint64_t, uint64_t>> expected;
+        for (uint64_t i = start; i < end; i++) {
+            if (i == start || control[i] != control[i - 1]) {
+                expected.push_back({i, 0});
+            }
+            expected.back().second++;
+        }
+        uint64_t r = 0;
+        bv->for_each_run(start, end, [&](uint64_t p, uint64_t len, bool v) {
+            ASSERT_LT(r, expected.size());
+            ASSERT_EQ(expected[r].first, p) << "r = " << r;
+            ASSERT_EQ(expected[r].second, len) << "r = " << r;
+            ASSERT_EQ(control[p], v) << "r = " << r;
+            r++;
+        });
+        ASSERT_EQ(expected.size(), r) << "[" << start << ", " << end << ")";
+    }
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_cursor_test(uint64_t size, uint64_t ops, uint64_t spread) {
+    std::mt19937 mt(size + ops);
+    // Byte vector for fast insertion and removal in the middle.
+    std::vector<uint8_t> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    typename bit_vector::cursor c(bv);
+    uint64_t pos = 0;
+    for (uint64_t i = 0; i < size; i++) {
+        pos = (pos + mt() % spread) % (control.size() + 1);
+        bool v = mt() % 2;
+        c.insert(pos, v);
+        control.insert(control.begin() + pos, v);
+    }
+    bv->validate();
+    ASSERT_EQ(control.size(), bv->size());
+    for (uint64_t i = 0; i < ops; i++) {
+        pos = (pos + mt() % spread) % control.size();
+        switch (mt() % 5) {
+            case 0: {
+                bool v = mt() % 2;
+                c.insert(pos, v);
+                control.insert(control.begin() + pos, v);
+                break;
+            }
+            case 1:
+                ASSERT_EQ(bool(control[pos]), c.remove(pos)) << "i = " << i;
+                control.erase(control.begin() + pos);
+                if (control.size() == 0) {
+                    control.push_back(true);
+                    c.insert(0, true);
+                }
+                break;
+            case 2: {
+                bool v = mt() % 2;
+                c.set(pos, v);
+                control[pos] = v;
+                break;
+            }
+            case 3:
+                ASSERT_EQ(bool(control[pos]), c.at(pos)) << "i = " << i;
+                break;
+            default:
+                ASSERT_EQ(bv->rank(pos), c.rank(pos)) << "i = " << i;
+        }
+    }
+    bv->validate();
+    ASSERT_EQ(control.size(), bv->size());
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ASSERT_EQ(bool(control[i]), bv->at(i)) << "i = " << i;
+        ones += control[i];
+    }
+    ASSERT_EQ(ones, bv->sum());
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector, class other_bv>
+void bv_serialize_test(uint64_t size, bool runs) {
+    std::mt19937 mt(size);
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    while (bv->size() < size) {
+        bool v = mt() % 2;
+        uint64_t len = runs || mt() % 8 == 0 ? 1 + mt() % 40000 : 1;
+        bv->insert_run(bv->size(), v, len);
+    }
+    // Leave some operations in leaf buffers.
+    for (uint64_t i = 0; i < 100; i++) {
+        bv->insert(mt() % (bv->size() + 1), mt() % 2);
+        bv->remove(mt() % bv->size());
+    }
+    std::stringstream ss;
+    bv->serialize(ss);
+    std::string bytes = ss.str();
+
+    bit_vector* loaded = new bit_vector(a);
+    uint64_t version = loaded->version();
+    ASSERT_TRUE(loaded->load(ss));
+    ASSERT_NE(version, loaded->version());
+    loaded->validate();
+    ASSERT_EQ(bv->size(), loaded->size());
+    ASSERT_EQ(bv->sum(), loaded->sum());
+    for (uint64_t i = 0; i < bv->size(); i++) {
+        ASSERT_EQ(bv->at(i), loaded->at(i)) << "i = " << i;
+    }
+    // The loaded tree is fully dynamic.
+    for (uint64_t i = 0; i < 1000; i++) {
+        uint64_t idx = mt() % (bv->size() + 1);
+        bool v = mt() % 2;
+        bv->insert(idx, v);
+        loaded->insert(idx, v);
+    }
+    loaded->validate();
+    for (uint64_t i = 0; i < bv->size(); i += 1 + mt() % 100) {
+        ASSERT_EQ(bv->rank(i), loaded->rank(i)) << "i = " << i;
+    }
+
+    std::string path = testing::TempDir() + "bv_serialize_test";
+    ASSERT_TRUE(bv->serialize(path));
+    bit_vector* from_file = new bit_vector(a);
+    ASSERT_TRUE(from_file->load(path));
+    ASSERT_EQ(bv->size(), from_file->size());
+    ASSERT_EQ(bv->rank(bv->size()), from_file->rank(from_file->size()));
+    std::remove(path.c_str());
+    ASSERT_FALSE(from_file->load(path));
+    delete (from_file);
+
+    // A truncated stream is rejected and the target is left unchanged.
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 8));
+    ASSERT_FALSE(loaded->load(truncated));
+    loaded->validate();
+    ASSERT_EQ(bv->size(), loaded->size());
+    ASSERT_EQ(bv->sum(), loaded->sum());
+
+    // Mismatching template parameters are rejected from the header.
+    std::stringstream mismatch(bytes);
+    other_bv other;
+    ASSERT_FALSE(other.load(mismatch));
+    ASSERT_EQ(0u, other.size());
+    ASSERT_EQ(std::streamoff(36), mismatch.tellg());
+
+    delete (bv);
+    delete (loaded);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_snapshot_test(uint64_t size, uint64_t ops, bool runs) {
+    std::mt19937 mt(size + ops);
+    std::vector<uint8_t> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    while (bv->size() < size) {
+        bool v = mt() % 2;
+        uint64_t len = runs || mt() % 8 == 0 ? 1 + mt() % 4000 : 1;
+        bv->insert_run(bv->size(), v, len);
+        control.insert(control.end(), len, v);
+    }
+    std::vector<const bit_vector*> snaps;
+    std::vector<std::vector<uint8_t>> copies;
+    auto check = [](const bit_vector* s, const std::vector<uint8_t>& c) {
+        s->validate();
+        ASSERT_EQ(c.size(), s->size());
+        uint64_t ones = 0;
+        for (uint64_t i = 0; i < c.size(); i++) {
+            ASSERT_EQ(bool(c[i]), s->at(i)) << "i = " << i;
+            ones += c[i];
+        }
+        ASSERT_EQ(ones, s->sum());
+    };
+    for (uint64_t round = 0; round < 4; round++) {
+        snaps.push_back(bv->snapshot());
+        copies.push_back(control);
+        typename bit_vector::cursor c(bv);
+        for (uint64_t i = 0; i < ops; i++) {
+            uint64_t pos = mt() % control.size();
+            uint64_t len = 1 + mt() % 3000;
+            len = len < control.size() - pos ? len : control.size() - pos;
+            bool v = mt() % 2;
+            switch (mt() % 7) {
+                case 0:
+                    bv->insert(pos, v);
+                    control.insert(control.begin() + pos, v);
+                    break;
+                case 1:
+                    if (control.size() > 1) {
+                        ASSERT_EQ(bool(control[pos]), bv->remove(pos));
+                        control.erase(control.begin() + pos);
+                    }
+                    break;
+                case 2:
+                    bv->set(pos, v);
+                    control[pos] = v;
+                    break;
+                case 3:
+                    bv->insert_run(pos, v, len);
+                    control.insert(control.begin() + pos, len, v);
+                    break;
+                case 4:
+                    if (len < control.size()) {
+                        bv->remove_range(pos, pos + len);
+                        control.erase(control.begin() + pos,
+                                      control.begin() + pos + len);
+                    }
+                    break;
+                case 5:
+                    bv->set_range(pos, pos + len, v);
+                    std::fill(control.begin() + pos,
+                              control.begin() + pos + len, v);
+                    break;
+                default:
+                    c.insert(pos, v);
+                    control.insert(control.begin() + pos, v);
+            }
+        }
+        for (size_t i = 0; i < snaps.size(); i++) {
+            check(snaps[i], copies[i]);
+        }
+        check(bv, control);
+        if (round == 1) {
+            delete (snaps[0]);
+            snaps.erase(snaps.begin());
+            copies.erase(copies.begin());
+        }
+    }
+    delete (bv);
+    for (size_t i = 0; i < snaps.size(); i++) {
+        check(snaps[i], copies[i]);
+        delete (snaps[i]);
+    }
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+
+    // Snapshots keep an owned allocator alive.
+    bit_vector* owned = new bit_vector();
+    owned->insert_run(0, true, size);
+    const bit_vector* snap = owned->snapshot();
+    owned->remove_range(0, size / 2);
+    delete (owned);
+    ASSERT_EQ(size, snap->size());
+    ASSERT_EQ(size, snap->sum());
+    delete (snap);
+}
+
+template <class alloc, class bit_vector>
+void bv_snapshot_batch_test(uint64_t leaves, uint64_t leaf_size,
+                            uint64_t branches) {
+    std::mt19937 mt(leaves);
+    std::vector<uint8_t> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    {
+        typename bit_vector::builder b(bv);
+        for (uint64_t i = 0; i < leaves * leaf_size; i++) {
+            bool v = mt() % 2;
+            b.push_back(v);
+            control.push_back(v);
+        }
+    }
+    auto check = [](const bit_vector* s, const std::vector<uint8_t>& c) {
+        s->validate();
+        ASSERT_EQ(c.size(), s->size());
+        uint64_t ones = 0;
+        for (uint64_t i = 0; i < c.size(); i++) {
+            ASSERT_EQ(bool(c[i]), s->at(i)) << "i = " << i;
+            ones += c[i];
+        }
+        ASSERT_EQ(ones, s->sum());
+    };
+    // The builder fills leaves and nodes, so these are boundaries between
+    // subtrees with full leaves on the left.
+    const bit_vector* snap = bv->snapshot();
+    std::vector<uint8_t> copy = control;
+    for (uint64_t i = control.size() / (leaf_size * branches); i > 0; i--) {
+        uint64_t pos = i * leaf_size * branches;
+        bv->insert(pos, true);
+        control.insert(control.begin() + pos, true);
+    }
+    check(snap, copy);
+    check(bv, control);
+    delete (snap);
+
+    // Batches only copy the paths to the modified positions.
+    uint64_t n = control.size();
+    uint64_t bound = 3 * 8 * 4;
+    ASSERT_GT(a->live_allocations(), 10 * bound);
+    snap = bv->snapshot();
+    copy = control;
+    uint64_t before = a->live_allocations();
+    uint64_t r_pos[] = {0, n / 3, n - 1};
+    bv->remove_batch(r_pos, 3);
+    ASSERT_LE(a->live_allocations(), before + bound);
+    for (uint64_t i = 3; i > 0; i--) {
+        control.erase(control.begin() + r_pos[i - 1]);
+    }
+    n = control.size();
+    uint64_t i_pos[] = {0, n / 2, n / 2 + 2, n + 3};
+    bool i_vals[] = {true, false, true, true};
+    before = a->live_allocations();
+    bv->insert_batch(i_pos, i_vals, 4);
+    ASSERT_LE(a->live_allocations(), before + bound);
+    for (uint64_t i = 0; i < 4; i++) {
+        control.insert(control.begin() + i_pos[i], i_vals[i]);
+    }
+    check(snap, copy);
+    check(bv, control);
+    delete (snap);
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_concurrent_test(uint64_t size, uint64_t batches, uint32_t readers) {
+    typedef concurrent_bit_vector<bit_vector, uint64_t> cbv_type;
+    std::mt19937 mt(size + batches);
+    std::vector<uint8_t> control;
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    for (uint64_t i = 0; i < size; i++) {
+        bool v = mt() % 2;
+        bv->insert(i, v);
+        control.push_back(v);
+    }
+    cbv_type* cbv = new cbv_type(bv);
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> failures(0);
+    auto read = [&](uint32_t seed) {
+        std::mt19937 r_mt(seed);
+        uint64_t version = 0;
+        while (!done.load()) {
+            auto snap = cbv->reader();
+            if (snap->version() < version) failures++;
+            version = snap->version();
+            uint64_t n = snap->size();
+            if (snap->rank(n) != snap->sum()) failures++;
+            for (uint32_t j = 0; j < 50; j++) {
+                uint64_t i = r_mt() % n;
+                uint64_t r = snap->rank(i);
+                if (snap->at(i) != bool(snap->rank(i + 1) - r)) failures++;
+                if (snap->at(i) && snap->select(r + 1) != i) failures++;
+            }
+        }
+    };
+    std::thread* threads = new std::thread[readers];
+    for (uint32_t t = 0; t < readers; t++) {
+        threads[t] = std::thread(read, t);
+    }
+    for (uint64_t b = 0; b < batches; b++) {
+        uint64_t ops = 1 + mt() % 200;
+        for (uint64_t i = 0; i < ops; i++) {
+            uint64_t pos = mt() % control.size();
+            bool v = mt() % 2;
+            switch (mt() % 5) {
+                case 0:
+                    cbv->insert(pos, v);
+                    control.insert(control.begin() + pos, v);
+                    break;
+                case 1:
+                    cbv->remove(pos);
+                    control.erase(control.begin() + pos);
+                    break;
+                case 2:
+                    // Sorted run of insertions, applied as a single batch.
+                    for (; i < ops && pos <= control.size(); i++) {
+                        cbv->insert(pos, v);
+                        control.insert(control.begin() + pos, v);
+                        pos += 1 + mt() % 300;
+                        v = mt() % 2;
+                    }
+                    i--;
+                    break;
+                case 3:
+                    // Sorted run of removals, applied as a single batch.
+                    for (; i < ops && pos < control.size(); i++) {
+                        cbv->remove(pos);
+                        control.erase(control.begin() + pos);
+                        pos += mt() % 300;
+                    }
+                    i--;
+                    break;
+                default:
+                    cbv->set(pos, v);
+                    control[pos] = v;
+            }
+        }
+        ASSERT_EQ(ops, cbv->pending());
+        ASSERT_EQ(ops, cbv->apply());
+        ASSERT_EQ(0u, cbv->apply());
+    }
+    done = true;
+    for (uint32_t t = 0; t < readers; t++) {
+        threads[t].join();
+    }
+    delete[] threads;
+    ASSERT_EQ(0u, failures.load());
+    auto snap = cbv->reader();
+    snap->validate();
+    ASSERT_EQ(control.size(), cbv->size());
+    uint64_t ones = 0;
+    for (uint64_t i = 0; i < control.size(); i++) {
+        ASSERT_EQ(bool(control[i]), snap->at(i)) << "i = " << i;
+        ones += control[i];
+    }
+    ASSERT_EQ(ones, cbv->sum());
+    delete (cbv);
+    ASSERT_EQ(ones, snap->sum());
+    snap.reset();
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
+template <class alloc, class bit_vector>
+void bv_independent_threads_test(uint64_t size, uint64_t rounds,
+                                 uint32_t threads) {
+    std::vector<alloc*> allocs(threads);
+    std::vector<bit_vector*> bvs(threads);
+    std::vector<std::vector<uint8_t>> controls(threads);
+    auto work = [&](uint32_t t) {
+        std::mt19937 mt(size + t);
+        bit_vector* bv = bvs[t];
+        std::vector<uint8_t>& control = controls[t];
+        bv->insert_run(0, true, size);
+        control.insert(control.end(), size, true);
+        std::vector<uint64_t> pos;
+        bool vals[64];
+        for (uint64_t r = 0; r < rounds; r++) {
+            pos.clear();
+            uint64_t p = mt() % (control.size() + 1);
+            for (size_t i = 0; i < 64; i++) {
+                pos.push_back(p + i);
+                vals[i] = mt() % 2;
+                p += mt() % 100;
+                p = p < control.size() ? p : control.size();
+            }
+            bv->insert_batch(pos.data(), vals, 64);
+            for (size_t i = 0; i < 64; i++) {
+                control.insert(control.begin() + pos[i], vals[i]);
+            }
+            pos.clear();
+            p = mt() % (control.size() / 2);
+            for (size_t i = 0; i < 48; i++) {
+                pos.push_back(p);
+                p += 1 + mt() % 100;
+            }
+            bv->remove_batch(pos.data(), 48);
+            for (size_t i = 48; i > 0; i--) {
+                control.erase(control.begin() + pos[i - 1]);
+            }
+            p = mt() % (control.size() + 1);
+            uint64_t len = 1 + mt() % 3000;
+            bool v = mt() % 2;
+            bv->insert_run(p, v, len);
+            control.insert(control.begin() + p, len, v);
+            uint64_t words[8];
+            p = mt() % (control.size() + 1);
+            len = 1 + mt() % 500;
+            for (uint64_t i = 0; i < 8; i++) {
+                words[i] = uint64_t(mt()) << 32 | mt();
+            }
+            bv->insert_range(p, words, len);
+            for (uint64_t i = 0; i < len; i++) {
+                control.insert(control.begin() + p + i,
+                               (words[i / 64] >> (i % 64)) & 1);
+            }
+            len = 1 + mt() % 2000;
+            p = mt() % (control.size() - len + 1);
+            bv->remove_range(p, p + len);
+            control.erase(control.begin() + p, control.begin() + p + len);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; t++) {
+        allocs[t] = new alloc();
+        bvs[t] = new bit_vector(allocs[t]);
+        workers.emplace_back(work, t);
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+        workers[t].join();
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+        bvs[t]->validate();
+        ASSERT_EQ(controls[t].size(), bvs[t]->size());
+        for (uint64_t i = 0; i < controls[t].size(); i++) {
+            ASSERT_EQ(bool(controls[t][i]), bvs[t]->at(i)) << "i = " << i;
+        }
+        delete (bvs[t]);
+        ASSERT_EQ(0u, allocs[t]->live_allocations());
+        delete (allocs[t]);
+    }
+}
+
+template <class alloc, class bit_vector, class mapped, class other_mapped>
+void bv_mapped_test(uint64_t size, bool runs) {
+    std::mt19937 mt(size);
+    alloc* a = new alloc();
+    bit_vector* bv = new bit_vector(a);
+    while (bv->size() < size) {
+        bool v = mt() % 2;
+        uint64_t len = runs || mt() % 8 == 0 ? 1 + mt() % 40000 : 1;
+        bv->insert_run(bv->size(), v, len);
+    }
+    // Leave some operations in leaf buffers.
+    for (uint64_t i = 0; i < 100; i++) {
+        bv->insert(mt() % (bv->size() + 1), mt() % 2);
+        bv->remove(mt() % bv->size());
+    }
+    std::string path = testing::TempDir() + "bv_mapped_test";
+    ASSERT_TRUE(bv->serialize_mapped(path));
+
+    mapped m(path);
+    ASSERT_TRUE(m.is_open());
+    ASSERT_EQ(bv->size(), m.size());
+    ASSERT_EQ(bv->sum(), m.sum());
+    uint64_t n = bv->size();
+    for (uint64_t q = 0; q < 10000; q++) {
+        uint64_t i = q < 2 ? q * (n - 1) : mt() % n;
+        ASSERT_EQ(bv->at(i), m.at(i)) << "i = " << i;
+        ASSERT_EQ(bv->rank(i), m.rank(i)) << "i = " << i;
+        uint64_t c = 1 + mt() % bv->sum();
+        ASSERT_EQ(bv->select(c), m.select(c)) << "c = " << c;
+    }
+    ASSERT_EQ(bv->rank(n), m.rank(n));
+    ASSERT_EQ(bv->select(bv->sum()), m.select(bv->sum()));
+
+    other_mapped other(path);
+    ASSERT_FALSE(other.is_open());
+    std::remove(path.c_str());
+    m.close();
+    ASSERT_FALSE(m.is_open());
+    ASSERT_FALSE(m.open(path));
+
+    delete (bv);
+    ASSERT_EQ(0u, a->live_allocations());
+    delete (a);
+}
+
 TEST(SimpleBV, InstantiateWithAlloc) {
     bv_instantiation_with_allocator_test<ma, test_bv>();
 }
@@ -507,4 +1722,275 @@ TEST(SimpleBV, Select0) {
     bv_select_0_test<test_bv, dyn::suc_bv>(10000);
 }
 
-#endif
\ No newline at end of file
+TEST(SimpleBV, BuildLeaf) { bv_build_test<ma, test_bv>(SIZE - 3); }
+
+TEST(SimpleBV, BuildNode) { bv_build_test<ma, test_bv>(5 * SIZE + 17); }
+
+TEST(SimpleBV, BuildNodeNode) { bv_build_test<ma, test_bv>(40 * SIZE + 5); }
+
+TEST(SimpleBV, BuilderLeaf) { bv_builder_test<ma, test_bv>(SIZE - 3); }
+
+TEST(SimpleBV, BuilderNode) { bv_builder_test<ma, test_bv>(5 * SIZE + 17); }
+
+TEST(SimpleBV, BuilderNodeNode) {
+    bv_builder_test<ma, test_bv>(40 * SIZE + 5);
+    bv_builder_test<ma, test_bv>(17 * BRANCH * SIZE + 100);
+}
+
+TEST(SimpleBV, InsertBatchLeaf) {
+    bv_insert_batch_test<ma, test_bv>(0, SIZE / 4, 3);
+    bv_insert_batch_test<ma, test_bv>(SIZE / 2, 2 * SIZE, 1);
+}
+
+TEST(SimpleBV, InsertBatchNode) {
+    bv_insert_batch_test<ma, test_bv>(10 * SIZE, 7, 20);
+    bv_insert_batch_test<ma, test_bv>(10 * SIZE, SIZE, 5);
+    bv_insert_batch_test<ma, test_bv>(BRANCH * SIZE, 20 * SIZE, 2);
+}
+
+TEST(SimpleBV, RemoveBatchLeaf) {
+    bv_remove_batch_test<ma, test_bv>(SIZE, SIZE / 4, 3);
+}
+
+TEST(SimpleBV, RemoveBatchNode) {
+    bv_remove_batch_test<ma, test_bv>(10 * SIZE, 7, 20);
+    bv_remove_batch_test<ma, test_bv>(10 * SIZE, SIZE, 8);
+    bv_remove_batch_test<ma, test_bv>(10 * SIZE, 3 * SIZE, 2, true);
+}
+
+TEST(SimpleBV, RemoveBatchNodeNode) {
+    bv_remove_batch_test<ma, test_bv>(40 * SIZE, 4 * SIZE, 4);
+    bv_remove_batch_test<ma, test_bv>(40 * SIZE, 17 * SIZE, 2, true);
+    bv_remove_batch_test<ma, test_bv>(40 * SIZE, 40 * SIZE - 100, 1);
+}
+
+TEST(SimpleBV, BuildParallel) { bv_build_test<ma, test_bv>(40 * SIZE + 5, 3); }
+
+TEST(SimpleBV, RemoveBatchRle) {
+    bv_remove_batch_test<ma, rle_bv>(SIZE, SIZE / 4, 3, false, true);
+    bv_remove_batch_test<ma, rle_bv>(40 * SIZE, 7, 20, false, true);
+    bv_remove_batch_test<ma, rle_bv>(40 * SIZE, 4 * SIZE, 4, false, true);
+    bv_remove_batch_test<ma, rle_bv>(40 * SIZE, 17 * SIZE, 2, true, true);
+    typedef simple_bv<16, 1024, 8, true, false, true> small_rle_bv;
+    bv_remove_batch_test<ma, small_rle_bv>(100000, 300, 20, false, true);
+    bv_mixed_range_test<ma, small_rle_bv>(100000, 3000, 200, true);
+}
+
+TEST(SimpleBV, RemoveBatchSmallLeaves) {
+    bv_remove_batch_test<ma, simple_bv<8, 384, 8>>(100000, 7, 40);
+    bv_remove_batch_test<ma, simple_bv<8, 512, 16>>(100000, 3000, 10);
+    bv_remove_node_node_test<ma, simple_bv<8, 384, 8>>(384);
+    bv_remove_node_node_test<ma, simple_bv<0, 512, 16>>(512);
+}
+
+TEST(SimpleBV, QueryBatchLeaf) {
+    bv_query_batch_test<ma, test_bv>(SIZE - 3, 100);
+}
+
+TEST(SimpleBV, QueryBatchNodeNode) {
+    bv_query_batch_test<ma, test_bv>(40 * SIZE + 5, 1003);
+}
+
+TEST(SimpleBV, InsertRangeLeaf) {
+    bv_insert_range_test<ma, test_bv>(SIZE / 8, 12, false);
+}
+
+TEST(SimpleBV, InsertRangeNode) {
+    bv_insert_range_test<ma, test_bv>(5 * SIZE, 40, false);
+}
+
+TEST(SimpleBV, InsertRunRle) {
+    bv_insert_range_test<ma, rle_bv>(5 * SIZE, 40, true);
+}
+
+TEST(SimpleBV, RemoveRangeLeaf) {
+    bv_remove_range_test<ma, test_bv>(SIZE - 3, 500, 20);
+}
+
+TEST(SimpleBV, RemoveRangeNode) {
+    bv_remove_range_test<ma, test_bv>(300 * SIZE, 20 * SIZE, 40);
+}
+
+TEST(SimpleBV, RemoveRangeRle) {
+    bv_remove_range_test<ma, rle_bv>(300 * SIZE, 20 * SIZE, 40);
+    bv_mixed_range_test<ma, rle_bv>(40 * SIZE, 5 * SIZE, 40, false);
+    typedef simple_bv<16, 1024, 8, true, false, true> small_rle_bv;
+    bv_mixed_range_test<ma, small_rle_bv>(100000, 3000, 200, false);
+}
+
+TEST(SimpleBV, RemoveBatchAfterRangeInsert) {
+    bv_mixed_range_test<ma, simple_bv<8, 2048, 16>>(200000, 3000, 200, true);
+    bv_mixed_range_test<ma, test_bv>(40 * SIZE, 5 * SIZE, 40, true);
+}
+
+TEST(SimpleBV, RemoveRangeAfterRangeInsert) {
+    bv_mixed_range_test<ma, simple_bv<8, 2048, 16>>(200000, 3000, 200, false);
+    bv_mixed_range_test<ma, test_bv>(40 * SIZE, 5 * SIZE, 40, false);
+}
+
+TEST(SimpleBV, SetRangeLeaf) {
+    bv_set_range_test<ma, test_bv>(SIZE / 2, 1000, 60, false);
+}
+
+TEST(SimpleBV, SetRangeNode) {
+    bv_set_range_test<ma, test_bv>(100 * SIZE, 20 * SIZE, 60, false);
+}
+
+TEST(SimpleBV, SetRangeRle) {
+    bv_set_range_test<ma, rle_bv>(20 * SIZE, 5 * SIZE, 60, true);
+}
+
+TEST(SimpleBV, SetRangeRleSmallLeaves) {
+    typedef simple_bv<16, 1024, 8, true, false, true> small_rle_bv;
+    bv_set_range_test<ma, small_rle_bv>(100000, 3000, 600, false, true);
+    bv_set_range_test<ma, small_rle_bv>(100000, 50, 600, false, true);
+}
+
+TEST(SimpleBV, CountLeaf) {
+    bv_count_test<ma, test_bv>(SIZE / 2, 2000, 1000, false);
+}
+
+TEST(SimpleBV, CountNode) {
+    bv_count_test<ma, test_bv>(100 * SIZE, 20 * SIZE, 10000, false);
+}
+
+TEST(SimpleBV, CountRle) {
+    bv_count_test<ma, rle_bv>(20 * SIZE, 5 * SIZE, 10000, true);
+}
+
+TEST(SimpleBV, IteratorLeaf) { bv_iterator_test<ma, test_bv>(SIZE / 2, false); }
+
+TEST(SimpleBV, IteratorNode) { bv_iterator_test<ma, test_bv>(100 * SIZE, false); }
+
+TEST(SimpleBV, IteratorRle) { bv_iterator_test<ma, rle_bv>(20 * SIZE, true); }
+
+TEST(SimpleBV, ForEachOneLeaf) {
+    bv_for_each_one_test<ma, test_bv>(SIZE / 2, 100, false);
+}
+
+TEST(SimpleBV, ForEachOneNode) {
+    bv_for_each_one_test<ma, test_bv>(100 * SIZE, 20, false);
+}
+
+TEST(SimpleBV, ForEachOneRle) {
+    bv_for_each_one_test<ma, rle_bv>(20 * SIZE, 20, true);
+}
+
+TEST(SimpleBV, NextPrevLeaf) {
+    bv_next_prev_test<ma, test_bv>(SIZE / 2, 1000, false);
+}
+
+TEST(SimpleBV, NextPrevNode) {
+    bv_next_prev_test<ma, test_bv>(100 * SIZE, 10000, false);
+}
+
+TEST(SimpleBV, NextPrevRle) {
+    bv_next_prev_test<ma, rle_bv>(100 * SIZE, 10000, true);
+}
+
+TEST(SimpleBV, ForEachRunLeaf) {
+    bv_for_each_run_test<ma, test_bv>(SIZE / 2, 100, false);
+}
+
+TEST(SimpleBV, ForEachRunNode) {
+    bv_for_each_run_test<ma, test_bv>(100 * SIZE, 20, false);
+}
+
+TEST(SimpleBV, ForEachRunRle) {
+    bv_for_each_run_test<ma, rle_bv>(100 * SIZE, 100, true);
+}
+
+TEST(SimpleBV, CursorLocal) {
+    bv_cursor_test<ma, test_bv>(12 * SIZE, 40000, 100);
+}
+
+TEST(SimpleBV, CursorSpread) {
+    bv_cursor_test<ma, test_bv>(12 * SIZE, 40000, 12 * SIZE);
+}
+
+TEST(SimpleBV, CursorRle) {
+    bv_cursor_test<ma, rle_bv>(12 * SIZE, 40000, 1000);
+}
+
+TEST(SimpleBV, SerializeLeaf) {
+    bv_serialize_test<ma, test_bv, rle_bv>(SIZE / 2, false);
+}
+
+TEST(SimpleBV, SerializeNode) {
+    bv_serialize_test<ma, test_bv, rle_bv>(100 * SIZE, false);
+}
+
+TEST(SimpleBV, SerializeRle) {
+    bv_serialize_test<ma, rle_bv, test_bv>(100 * SIZE, true);
+}
+
+TEST(SimpleBV, SerializeSmall) {
+    bv_serialize_test<ma, bv::small_bv<8, SIZE, 16>, test_bv>(20 * SIZE, false);
+}
+
+TEST(SimpleBV, SerializeNoBuffer) {
+    bv_serialize_test<ma, simple_bv<0, 4096, 16>, test_bv>(100 * 4096, false);
+}
+
+TEST(SimpleBV, MappedLeaf) {
+    bv_mapped_test<ma, test_bv, mapped_bit_vector<uint64_t, BRANCH>,
+                   mapped_bit_vector<uint32_t, BRANCH>>(SIZE / 2, false);
+}
+
+TEST(SimpleBV, MappedNode) {
+    bv_mapped_test<ma, test_bv, mapped_bit_vector<uint64_t, BRANCH>,
+                   mapped_bit_vector<uint64_t, 64>>(100 * SIZE, false);
+}
+
+TEST(SimpleBV, MappedRle) {
+    bv_mapped_test<ma, rle_bv, bv::mapped_bv,
+                   mapped_bit_vector<uint64_t, BRANCH>>(100 * SIZE, true);
+}
+
+TEST(SimpleBV, MappedSmall) {
+    bv_mapped_test<ma, bv::small_bv<8, SIZE, 16>,
+                   mapped_bit_vector<uint32_t, 16>,
+                   mapped_bit_vector<uint64_t, 16>>(20 * SIZE, false);
+}
+
+TEST(SimpleBV, SnapshotLeaf) {
+    bv_snapshot_test<ma, test_bv>(SIZE / 2, 200, false);
+}
+
+TEST(SimpleBV, SnapshotNode) {
+    bv_snapshot_test<ma, test_bv>(40 * SIZE, 400, false);
+}
+
+TEST(SimpleBV, SnapshotRle) {
+    bv_snapshot_test<ma, rle_bv>(40 * SIZE, 400, true);
+}
+
+TEST(SimpleBV, SnapshotBatch) {
+    bv_snapshot_batch_test<ma, simple_bv<8, 512, 8>>(4000, 512, 8);
+}
+
+TEST(SimpleBV, IndependentThreads) {
+    bv_independent_threads_test<ma, test_bv>(20 * SIZE, 200, 4);
+}
+
+TEST(SimpleBV, IndependentThreadsRle) {
+    bv_independent_threads_test<ma, rle_bv>(20 * SIZE, 200, 4);
+}
+
+TEST(SimpleBV, ConcurrentNode) {
+    bv_concurrent_test<ma, test_bv>(40 * SIZE, 100, 3);
+}
+
+TEST(SimpleBV, ConcurrentRle) {
+    bv_concurrent_test<ma, rle_bv>(40 * SIZE, 100, 3);
+}
+
+TEST(SimpleBV, ConcurrentUnsortedBuffers) {
+    typedef leaf<BUFFER_SIZE, SIZE, true, false, false> u_leaf;
+    typedef bit_vector<u_leaf, node<u_leaf, uint64_t, SIZE, BRANCH>, ma, SIZE,
+                       BRANCH, uint64_t>
+        u_bv;
+    bv_concurrent_test<ma, u_bv>(40 * SIZE, 100, 3);
+}
+
+#endif
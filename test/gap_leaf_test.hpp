@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <iostream>
+#include <sstream>
+#include <string>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
 
@@ -451,6 +453,44 @@ template <class leaf, class alloc>
 void gap_leaf_commit_test(uint64_t size) {
 }*/
 
+template <class leaf, class alloc>
+void gap_leaf_serialize_test(uint32_t n) {
+    alloc* allocator = new alloc();
+    leaf* l = allocator->template allocate_leaf<leaf>();
+    for (uint32_t i = 0; i < n; i++) {
+        if (l->need_realloc()) {
+            l = allocator->template reallocate_leaf<leaf>(l, l->capacity(), l->desired_capacity());
+        }
+        l->insert((i * 7919) % (i + 1), i % 3 == 0);
+    }
+    std::stringstream ss;
+    l->serialize(ss);
+    std::string bytes = ss.str();
+    leaf* loaded = leaf::load(ss, allocator);
+    ASSERT_NE(loaded, nullptr);
+    ASSERT_EQ(l->size(), loaded->size());
+    ASSERT_EQ(l->p_sum(), loaded->p_sum());
+    ASSERT_EQ(l->capacity(), loaded->capacity());
+    for (uint32_t i = 0; i < n; i++) {
+        ASSERT_EQ(l->at(i), loaded->at(i)) << "i = " << i;
+    }
+    for (uint32_t i = 0; i < 1000; i++) {
+        if (loaded->need_realloc()) break;
+        uint32_t idx = (i * 104729) % (n + i + 1);
+        l->insert(idx, i % 2);
+        loaded->insert(idx, i % 2);
+    }
+    for (uint32_t i = 0; i <= l->size(); i++) {
+        ASSERT_EQ(l->rank(i), loaded->rank(i)) << "i = " << i;
+    }
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+    ASSERT_EQ(leaf::load(truncated, allocator), nullptr);
+    allocator->deallocate_leaf(l);
+    allocator->deallocate_leaf(loaded);
+    ASSERT_EQ(0u, allocator->live_allocations());
+    delete allocator;
+}
+
 TEST(GapLeaf, Init) {
     gap_leaf_init_test<g_leaf, ma>();
 }
@@ -554,4 +594,8 @@ TEST(GapLeaf, BlockJump) {
     delete allocator;
 }
 
-#endif
\ No newline at end of file
+TEST(GapLeaf, Serialize) {
+    gap_leaf_serialize_test<g_leaf, ma>(10000);
+}
+
+#endif
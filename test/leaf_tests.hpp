@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <iostream>
+#include <random>
+#include <vector>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
 
@@ -210,6 +212,43 @@ void leaf_select_test(uint64_t n) {
     delete allocator;
 }
 
+template <class leaf, class alloc>
+void leaf_select0_test(uint64_t n) {
+    alloc* allocator = new alloc();
+    leaf* l = allocator->template allocate_leaf<leaf>(8);
+    std::vector<bool> control;
+    std::mt19937 mt(n);
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t pos = mt() % (control.size() + 1);
+        bool v = mt() % 3 == 0;
+        l->insert(pos, v);
+        control.insert(control.begin() + pos, v);
+        if (l->need_realloc()) {
+            uint64_t cap = l->capacity();
+            l = allocator->template reallocate_leaf<leaf>(l, cap, 2 * cap);
+        }
+    }
+    // Leave some removals in the buffer.
+    for (uint64_t i = 0; i < 3; i++) {
+        uint64_t pos = mt() % control.size();
+        l->remove(pos);
+        control.erase(control.begin() + pos);
+    }
+
+    for (uint64_t p = 0; p < control.size(); p += 1 + n / 7) {
+        uint32_t x = 0;
+        for (uint64_t i = p; i < control.size(); i++) {
+            if (!control[i]) {
+                x++;
+                ASSERT_EQ(i, l->select0(x, p)) << "x = " << x << ", p = " << p;
+            }
+        }
+    }
+
+    allocator->template deallocate_leaf<leaf>(l);
+    delete allocator;
+}
+
 template <class leaf, class alloc>
 void leaf_select_offset_test(uint64_t n) {
     alloc* allocator = new alloc();
@@ -535,6 +574,46 @@ void leaf_append_all_test() {
     delete allocator;
 }
 
+template <class leaf, class alloc>
+void leaf_const_query_test(uint64_t n) {
+    alloc* allocator = new alloc();
+    leaf* l = allocator->template allocate_leaf<leaf>(8);
+    const leaf* c = l;
+    std::vector<bool> control;
+    std::mt19937 mt(n);
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t pos = mt() % (control.size() + 1);
+        bool v = mt() % 3 == 0;
+        l->insert(pos, v);
+        control.insert(control.begin() + pos, v);
+        if (l->need_realloc()) {
+            uint64_t cap = l->capacity();
+            l = allocator->template reallocate_leaf<leaf>(l, cap, 2 * cap);
+            c = l;
+        }
+        if (i % 97 != 0) continue;
+        // Queries should be answered without committing the buffer.
+        uint8_t buffered = c->buffer_count();
+        uint32_t ones = 0;
+        for (uint32_t j = 0; j < control.size(); j++) {
+            ASSERT_EQ(control[j], c->at(j)) << "i = " << i << ", j = " << j;
+            ASSERT_EQ(ones, c->rank(j)) << "i = " << i << ", j = " << j;
+            if (control[j]) {
+                ones++;
+                ASSERT_EQ(j, c->select(ones)) << "i = " << i << ", j = " << j;
+            } else {
+                ASSERT_EQ(j, c->select0(j + 1 - ones, 0))
+                    << "i = " << i << ", j = " << j;
+            }
+        }
+        ASSERT_EQ(ones, c->p_sum());
+        ASSERT_EQ(buffered, c->buffer_count());
+    }
+
+    allocator->template deallocate_leaf<leaf>(l);
+    delete allocator;
+}
+
 template <class leaf, class alloc>
 void leaf_hit_buffer_test() {
     alloc* allocator = new alloc();
@@ -699,6 +778,8 @@ TEST(SimpleLeaf, SelectOffset) { leaf_select_test<sl, ma>(11); }
 
 TEST(SimpleLeaf, SelectBlock) { leaf_select_offset_test<sl, ma>(3000); }
 
+TEST(SimpleLeaf, Select0) { leaf_select0_test<sl, ma>(3000); }
+
 TEST(SimpleLeaf, Set) { leaf_set_test<sl, ma>(10000); }
 
 TEST(SimpleLeaf, ClearFirst) { leaf_clear_start_test<sl, ma>(); }
@@ -715,6 +796,17 @@ TEST(SimpleLeaf, BufferHit) { leaf_hit_buffer_test<sl, ma>(); }
 
 TEST(SimpleLeaf, Commit) { leaf_commit_test<sl, ma>(SIZE); }
 
+TEST(SimpleLeaf, ConstQuery) { leaf_const_query_test<sl, ma>(3000); }
+
+TEST(SimpleLeaf, UnsortedConstQuery) {
+    leaf_const_query_test<leaf<BUFFER_SIZE, SIZE, true, false, false>, ma>(
+        3000);
+}
+
+TEST(SimpleLeaf, UnsortedSet) {
+    leaf_set_test<leaf<BUFFER_SIZE, SIZE, true, false, false>, ma>(10000);
+}
+
 // A couple of tests to check that unbuffered works as well.
 TEST(SimpleLeafUnb, Insert) { leaf_insert_test<ubl, ma>(10000); }
 
@@ -728,6 +820,8 @@ TEST(SimpleLeafUnb, Select) { leaf_select_test<ubl, ma>(10000); }
 
 TEST(SimpleLeafUnb, SelectOffset) { leaf_select_test<ubl, ma>(11); }
 
+TEST(SimpleLeafUnb, Select0) { leaf_select0_test<ubl, ma>(3000); }
+
 TEST(SimpleLeafUnb, Set) { leaf_set_test<ubl, ma>(10000); }
 
 #endif
\ No newline at end of file
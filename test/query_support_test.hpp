@@ -3,6 +3,7 @@
 
 #include <cstdint>
 #include <iostream>
+#include <random>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
 
@@ -194,6 +195,190 @@ void qs_sparse_bv_select_test(uint64_t size, uint64_t ones) {
     delete qs;
 }
 
+template <class bit_vector, bool packed = false>
+void qs_next_prev_test(uint64_t size, uint64_t queries) {
+    std::mt19937 mt(size);
+    bit_vector bv;
+    while (bv.size() < size) {
+        // Occasional long runs to get leaves without 0- or 1-bits.
+        uint64_t len = mt() % 4 == 0 ? 1 + mt() % 100000 : 1 + mt() % 10;
+        bv.insert_run(bv.size(), mt() % 2, len);
+    }
+    auto* qs = bv.template generate_query_structure<2048, false, packed>();
+    uint64_t n = bv.size();
+    for (uint64_t q = 0; q < queries; q++) {
+        uint64_t i = q < 2 ? q * (n - 1) : mt() % n;
+        ASSERT_EQ(bv.next_one(i), qs->next_one(i)) << "i = " << i;
+        ASSERT_EQ(bv.next_zero(i), qs->next_zero(i)) << "i = " << i;
+        ASSERT_EQ(bv.prev_one(i), qs->prev_one(i)) << "i = " << i;
+        ASSERT_EQ(bv.prev_zero(i), qs->prev_zero(i)) << "i = " << i;
+    }
+    ASSERT_EQ(n, qs->next_one(n));
+    ASSERT_EQ(bv.prev_zero(n - 1), qs->prev_zero(n));
+
+    delete qs;
+}
+
+template <class bit_vector, class Q>
+void qs_check(const bit_vector& bv, const Q* qs, std::mt19937& mt,
+              uint64_t queries) {
+    ASSERT_EQ(bv.size(), qs->size());
+    ASSERT_EQ(bv.sum(), qs->p_sum());
+    uint64_t n = bv.size();
+    uint64_t ones = bv.sum();
+    for (uint64_t q = 0; n > 0 && q < queries; q++) {
+        uint64_t i = mt() % n;
+        ASSERT_EQ(bv.at(i), qs->at(i)) << "i = " << i;
+        ASSERT_EQ(bv.rank(i), qs->rank(i)) << "i = " << i;
+        if (ones > 0) {
+            uint64_t c = 1 + mt() % ones;
+            ASSERT_EQ(bv.select(c), qs->select(c)) << "c = " << c;
+        }
+    }
+    ASSERT_EQ(bv.rank(n), qs->rank(n));
+}
+
+template <class bit_vector, bool packed = false>
+void qs_update_test(uint64_t size, uint64_t rounds, uint64_t density) {
+    std::mt19937 mt(size + density);
+    bit_vector bv;
+    for (uint64_t i = 0; i < size; i++) {
+        bv.insert(i, mt() % density == 0);
+    }
+    auto* qs = bv.template generate_query_structure<2048, false, packed>();
+    qs_check(bv, qs, mt, 1000);
+    for (uint64_t r = 0; r < rounds; r++) {
+        uint64_t n = bv.size();
+        uint64_t i = mt() % n;
+        uint64_t len = 1 + mt() % 10000;
+        len = i + len <= n ? len : n - i;
+        switch (mt() % 6) {
+            case 0:
+                for (uint64_t j = 0; j < 100; j++) {
+                    bv.insert(i, mt() % density == 0);
+                }
+                break;
+            case 1:
+                for (uint64_t j = 0; j < 100 && i < bv.size(); j++) {
+                    bv.remove(i);
+                }
+                break;
+            case 2:
+                bv.set(i, !bv.at(i));
+                break;
+            case 3:
+                bv.set_range(i, i + len, mt() % 2);
+                break;
+            case 4:
+                bv.insert_run(i, mt() % 2, len);
+                break;
+            default:
+                bv.remove_range(i, i + len);
+        }
+        if (r % 10 == 4) {
+            // Flushing copies buffered leaves shared with the snapshot, and
+            // the originals are freed with the snapshot.
+            const bit_vector* snap = bv.snapshot();
+            bv.flush();
+            delete snap;
+        }
+        if (r % 10 == 9) {
+            // Interleaved generation forces a full rebuild on update.
+            auto* other = bv.generate_query_structure();
+            qs_check(bv, other, mt, 100);
+            delete other;
+            bv.set(0, bv.at(0));
+        }
+        qs->update(&bv);
+        ASSERT_EQ(bv.version(), qs->version());
+        qs_check(bv, qs, mt, 1000);
+    }
+
+    delete qs;
+}
+
+template <class bit_vector, bool packed = false>
+void qs_select0_test(uint64_t size, uint64_t density) {
+    std::mt19937 mt(size + density);
+    bit_vector bv;
+    for (uint64_t i = 0; i < size; i++) {
+        bv.insert(mt() % (i + 1), mt() % density != 0);
+    }
+    auto* qs = bv.template generate_query_structure<2048, false, packed>();
+    uint64_t zeros = bv.size() - bv.sum();
+    uint64_t step = 1 + zeros / 10000;
+    for (uint64_t i = 1; i <= zeros; i += step) {
+        ASSERT_EQ(bv.select0(i), qs->select0(i)) << "i = " << i;
+        ASSERT_EQ(bv.select(false, i), qs->select(false, i));
+    }
+    for (uint64_t i = 0; i <= size; i += 1 + size / 1000) {
+        ASSERT_EQ(bv.rank0(i), qs->rank0(i)) << "i = " << i;
+    }
+
+    delete qs;
+}
+
+template <class bit_vector, bool packed = false>
+void qs_parallel_test(uint64_t size, uint64_t density, uint32_t threads) {
+    std::mt19937 mt(size + density);
+    std::vector<uint64_t> data(size / 64 + 1);
+    for (uint64_t i = 0; i < size; i++) {
+        data[i / 64] |= uint64_t(mt() % density == 0) << (i % 64);
+    }
+    bit_vector bv(data.data(), size);
+    // Leave some operations in leaf buffers.
+    for (uint64_t i = 0; i < 1000; i++) {
+        bv.insert(mt() % bv.size(), mt() % density == 0);
+    }
+    auto* qs =
+        bv.template generate_query_structure<2048, false, packed>(threads);
+    qs_check(bv, qs, mt, 10000);
+    uint64_t zeros = bv.size() - bv.sum();
+    for (uint64_t q = 0; q < 10000 && zeros > 0; q++) {
+        uint64_t i = 1 + mt() % zeros;
+        ASSERT_EQ(bv.select0(i), qs->select0(i)) << "i = " << i;
+    }
+
+    delete qs;
+}
+
+template <class bit_vector>
+void qs_flat_test(uint64_t size, uint64_t density) {
+    std::mt19937 mt(size + density);
+    bit_vector bv;
+    for (uint64_t i = 0; i < size; i++) {
+        bv.insert(mt() % (i + 1), mt() % density == 0);
+    }
+    auto* qs = bv.generate_flat_query_structure();
+    ASSERT_EQ(bv.version(), qs->version());
+    for (uint64_t r = 0; r < 3; r++) {
+        qs_check(bv, qs, mt, 10000);
+        uint64_t n = bv.size();
+        uint64_t zeros = n - bv.sum();
+        for (uint64_t q = 0; q < 10000 && zeros > 0; q++) {
+            uint64_t i = 1 + mt() % zeros;
+            ASSERT_EQ(bv.select0(i), qs->select0(i)) << "i = " << i;
+        }
+        for (uint64_t q = 0; q < 10000; q++) {
+            uint64_t i = q < 2 ? q * (n - 1) : mt() % n;
+            ASSERT_EQ(bv.next_one(i), qs->next_one(i)) << "i = " << i;
+            ASSERT_EQ(bv.next_zero(i), qs->next_zero(i)) << "i = " << i;
+            ASSERT_EQ(bv.prev_one(i), qs->prev_one(i)) << "i = " << i;
+            ASSERT_EQ(bv.prev_zero(i), qs->prev_zero(i)) << "i = " << i;
+        }
+        // The flat copy is independent of the tree until updated.
+        uint64_t old = qs->rank(n);
+        bv.insert_run(mt() % n, true, 1 + mt() % 5000);
+        bv.remove_range(0, 512);
+        ASSERT_EQ(old, qs->rank(n));
+        qs->update(&bv);
+        ASSERT_EQ(bv.version(), qs->version());
+    }
+    qs_check(bv, qs, mt, 10000);
+
+    delete qs;
+}
+
 TEST(QuerySupport, SingleAccess) { qs_access_single_leaf<qs, sl, ma>(SIZE); }
 
 TEST(QuerySupport, SingleRank) { qs_rank_single_leaf<qs, sl, ma>(SIZE); }
@@ -214,4 +399,46 @@ TEST(QuerySupport, SparseSelect) {
     qs_sparse_bv_select_test<bv::bv>(100000, 34);
 }
 
-#endif
\ No newline at end of file
+TEST(QuerySupport, NextPrev) { qs_next_prev_test<bv::bv>(10000000, 10000); }
+
+TEST(QuerySupport, Select0) { qs_select0_test<bv::bv>(1000000, 2); }
+
+TEST(QuerySupport, DenseSelect0) { qs_select0_test<bv::bv>(1000000, 5000); }
+
+TEST(QuerySupport, Parallel) { qs_parallel_test<bv::bv>(10000000, 2, 4); }
+
+TEST(QuerySupport, ParallelSparse) {
+    qs_parallel_test<bv::bv>(10000000, 5000, 3);
+}
+
+TEST(QuerySupport, Update) { qs_update_test<bv::bv>(1000000, 100, 2); }
+
+TEST(QuerySupport, UpdateSparse) {
+    qs_update_test<bv::bv>(1000000, 100, 5000);
+}
+
+TEST(QuerySupport, PackedNextPrev) {
+    qs_next_prev_test<bv::bv, true>(10000000, 10000);
+}
+
+TEST(QuerySupport, PackedSelect0) {
+    qs_select0_test<bv::bv, true>(1000000, 2);
+}
+
+TEST(QuerySupport, PackedDenseSelect0) {
+    qs_select0_test<bv::bv, true>(1000000, 5000);
+}
+
+TEST(QuerySupport, PackedParallel) {
+    qs_parallel_test<bv::bv, true>(10000000, 2, 4);
+}
+
+TEST(QuerySupport, PackedUpdate) { qs_update_test<bv::bv, true>(1000000, 100, 2); }
+
+#endif
+
+TEST(QuerySupport, Flat) { qs_flat_test<bv::bv>(1000000, 2); }
+
+TEST(QuerySupport, FlatSparse) { qs_flat_test<bv::bv>(1000000, 1000); }
+
+TEST(QuerySupport, FlatSmall) { qs_flat_test<bv::small_bv<8, 16384, 64>>(1000, 2); }
@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <iostream>
+#include <random>
+#include <vector>
 
 #include "../deps/googletest/googletest/include/gtest/gtest.h"
 
@@ -65,6 +67,32 @@ void rle_leaf_insert_test(uint32_t size, uint32_t i_count) {
     delete a;
 }
 
+template <class rl_l, class alloc>
+void rle_leaf_select0_test(uint32_t size, uint32_t i_count) {
+    alloc* a = new alloc();
+    rl_l* l = a->template allocate_leaf<rl_l>(32, size, false);
+    std::vector<bool> control(size, false);
+    std::mt19937 mt(size);
+    for (uint32_t i = 0; i < i_count; i++) {
+        uint32_t pos = mt() % (control.size() + 1);
+        l->insert(pos, true);
+        control.insert(control.begin() + pos, true);
+    }
+    EXPECT_TRUE(l->is_compressed());
+    for (uint32_t p = 0; p < control.size(); p += 1 + size / 5) {
+        uint32_t x = 0;
+        for (uint32_t i = p; i < control.size(); i++) {
+            if (!control[i]) {
+                x++;
+                ASSERT_EQ(i, l->select0(x, p)) << "x = " << x << ", p = " << p;
+            }
+        }
+    }
+
+    a->deallocate_leaf(l);
+    delete a;
+}
+
 template<class rl_l, class alloc>
 void rle_leaf_insert_middle_test(uint32_t size, uint32_t i_count) {
     alloc* a = new alloc();
@@ -520,6 +548,8 @@ TEST(RleLeaf, InsertMiddle) {
 
 TEST(RleLeaf, InsertEnd) { rle_leaf_insert_end_test<rll, ma>(10000, 100); }
 
+TEST(RleLeaf, Select0) { rle_leaf_select0_test<rll, ma>(10000, 20); }
+
 TEST(RleLeaf, Remove) { rle_leaf_remove_test<rll, ma>(200, 100); }
 
 TEST(RleLeaf, Set) { rle_leaf_set_test<rll, ma>(200, 100); }